@@ -0,0 +1,538 @@
+/********** ast.c **********/
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include "ast.h"
+#include "getSource.h"
+#include "ir.h"
+
+/* stdlib.hはOperatorのdivと衝突するので読まない */
+extern void *malloc(size_t size);
+extern void *realloc(void *p, size_t size);
+extern void free(void *p);
+
+#define CHUNKSIZE 65536    /* 構文木の領域を確保する単位 */
+
+/* 構文木の領域(アリーナ)の一かたまり */
+typedef struct chunk {
+	struct chunk *next;
+	int size;                  /* data[]の大きさ(バイト) */
+	int used;                  /* 使用済みの大きさ */
+	union {                    /* 境界合わせのための共用体 */
+		long l;
+		double d;
+		void *p;
+	} data[1];
+} Chunk;
+
+/* ブロックの節点とその情報 */
+typedef struct blockNode {
+	Node node;
+	BlockInfo info;
+} BlockNode;
+
+static Chunk *arena = NULL;       /* 現在割り当て中のかたまり(古いものはnextにつながる) */
+static Node **blocks = NULL;      /* 番号からブロックを引く表 */
+static int nBlocks, maxBlocks;
+static Node **kids = NULL;        /* 集めている途中の子のスタック */
+static int nKids, maxKids;
+
+static Node *curBlk;              /* コード生成中のブロック */
+static void genBlock(Node *b);    /* ブロックのコード生成 */
+
+/* 構文木用の領域を確保 */
+void *astAlloc(int size)
+{
+	Chunk *c;
+	void *p;
+	size = (size + sizeof(c->data[0]) - 1) / sizeof(c->data[0]) * sizeof(c->data[0]);
+	if (arena == NULL || arena->used + size > arena->size) {
+		int n = size > CHUNKSIZE ? size : CHUNKSIZE;
+		if ((c = malloc(offsetof(Chunk, data) + n)) == NULL)
+			errorF("out of memory");
+		c->next = arena;
+		c->size = n;
+		c->used = 0;
+		arena = c;
+	}
+	p = (char *)arena->data + arena->used;
+	arena->used += size;
+	return p;
+}
+
+/* 構文木の領域を一括して解放 */
+void astFree()
+{
+	Chunk *c;
+	while ((c = arena) != NULL) {
+		arena = c->next;
+		free(c);
+	}
+	nBlocks = 0;
+	nKids = 0;
+}
+
+/* 子の数がnKidの節点を作る */
+Node *newNode(NodeKind k, int nKid)
+{
+	Node *n = astAlloc(sizeof(Node) + nKid * sizeof(Node *));    /* 子の配列は節点に続けてとる */
+	n->kind = k;
+	n->line = sourceLine();
+	n->nKid = nKid;
+	n->kid = nKid > 0 ? (Node **)(n + 1) : NULL;
+	memset(&n->u, 0, sizeof(n->u));
+	return n;
+}
+
+/* 子が一つの節点 */
+Node *newNode1(NodeKind k, Node *a)
+{
+	Node *n = newNode(k, 1);
+	n->kid[0] = a;
+	return n;
+}
+
+/* 子が二つの節点 */
+Node *newNode2(NodeKind k, Node *a, Node *b)
+{
+	Node *n = newNode(k, 2);
+	n->kid[0] = a;
+	n->kid[1] = b;
+	return n;
+}
+
+/* 式や文の複製(ブロックは複製しない) */
+Node *copyNode(Node *n)
+{
+	Node *c;
+	int i;
+	if (n == NULL)
+		return NULL;
+	c = newNode(n->kind, n->nKid);
+	c->line = n->line;
+	c->u = n->u;
+	for (i = 0; i < n->nKid; i++)
+		c->kid[i] = copyNode(n->kid[i]);
+	return c;
+}
+
+/* ブロックの節点を作る(番号を割り当てる). ブロックの情報は節点に続けてとる */
+Node *newBlock()
+{
+	BlockNode *bn = astAlloc(sizeof(BlockNode));
+	Node *b = &bn->node;
+	b->kind = BlockN;
+	b->line = sourceLine();
+	b->nKid = 0;
+	b->kid = NULL;
+	memset(&bn->info, 0, sizeof(bn->info));
+	b->u.blk = &bn->info;
+	if (nBlocks == maxBlocks) {
+		maxBlocks = maxBlocks ? maxBlocks * 2 : 64;
+		if ((blocks = realloc(blocks, maxBlocks * sizeof(Node *))) == NULL)
+			errorF("out of memory");
+	}
+	b->u.blk->id = nBlocks;
+	blocks[nBlocks++] = b;
+	return b;
+}
+
+/* 番号idのブロック */
+Node *blockOf(int id)
+{
+	return 0 <= id && id < nBlocks ? blocks[id] : NULL;
+}
+
+/* 子を集め始める(返した値をendKidsに渡す) */
+int kidMark()
+{
+	return nKids;
+}
+
+/* 子を一つ集める */
+void pushKid(Node *n)
+{
+	if (nKids == maxKids) {
+		maxKids = maxKids ? maxKids * 2 : 256;
+		if ((kids = realloc(kids, maxKids * sizeof(Node *))) == NULL)
+			errorF("out of memory");
+	}
+	kids[nKids++] = n;
+}
+
+/* markから集めた子をnの子(連続した配列)にする */
+Node *endKids(Node *n, int mark)
+{
+	n->nKid = nKids - mark;
+	n->kid = n->nKid > 0 ? astAlloc(n->nKid * sizeof(Node *)) : NULL;
+	if (n->nKid > 0)
+		memcpy(n->kid, kids + mark, n->nKid * sizeof(Node *));
+	nKids = mark;
+	return n;
+}
+
+/* 構文木から目的コードを生成 */
+void genProgram(Node *prog)
+{
+	curBlk = NULL;
+	genBlock(prog);
+}
+
+/* 文、式、ブロックnから生成する命令語の数の上限(展開などでコードが
+   MAXCODEを越えないように見積もる). genNodeと合わせること */
+int codeSize(Node *n)
+{
+	int s = 0, i;
+	if (n == NULL)
+		return 0;
+	for (i = 0; i < n->nKid; i++)
+		s += codeSize(n->kid[i]);
+	switch (n->kind) {
+	case SeqN:
+	case BeginN:
+		return s;
+	case TailN:                                 /* パラメタごとのstoとjmp */
+		return s + n->nKid + 1;
+	case IfN:
+		return s + (n->nKid > 2 ? 2 : 1);
+	case UnlessN:
+	case WhileN:
+	case DoN:
+	case ParForN:                               /* ParForNはpforとsto(ループ変数のlodは子の分) */
+		return s + 2;
+	case RepeatN:
+		return s + 1;
+	case ForN:
+		return s + 4;
+	case VecN:                                  /* スカラーの値を広げるvbcの分を多めに見積もる */
+		return 2 * s + 9;
+	case BlockN:                                /* jmp, ict, retと主文 */
+		return s + 3 + codeSize(n->u.blk->body);
+	default:
+		return s + 1;
+	}
+}
+
+/* ブロックの先頭の、内部関数を飛び越すjmpを生成 */
+void genBlockStart(Node *b)
+{
+	setCodeLine(b->line);
+	b->u.blk->start = genCodeV(jmp, 0);          /* 後でバックパッチ */
+}
+
+/* ブロックの開始番地のict命令を生成(内部関数のコードのあと、主文の前) */
+void genBlockEntry(Node *b)
+{
+	setCodeLine(b->line);
+	backPatch(b->u.blk->start);                 /* 内部関数を飛び越す命令にパッチ */
+	b->u.blk->entry = nextCode();               /* この関数の開始番地 */
+	genCodeV(ict, b->u.blk->frame);             /* このブロックの実行時の必要記憶域をとる命令 */
+	curBlk = b;
+}
+
+/* ブロックの主文のあとのret命令を生成. 一度に生成するときは、主文の中の並列のforの
+   繰り返しの手続きをこのあとに生成してpfor命令の飛び先を直す */
+void genBlockEnd(Node *b)
+{
+	Node *k;
+	int i;
+
+	setCodeLine(b->u.blk->endLine);
+	genCodeR(b->u.blk->isProc, b->u.blk->level, b->u.blk->pars);    /* ret命令 */
+	enterProc(b->u.blk->start, b->u.blk->entry, nextCode(),
+		b->u.blk->level, b->u.blk->pars, b->u.blk->isProc);    /* 最適化のために目的コードの位置を登録 */
+	for (i = 0; i < b->nKid; i++)
+		if ((k = b->kid[i])->u.blk->entry == 0) {
+			genBlock(k);
+			if (k->u.blk->callAt > 0)
+				codeAt(k->u.blk->callAt)->u.addr.addr = k->u.blk->entry;
+		}
+}
+
+/* ブロックのコード生成 */
+static void genBlock(Node *b)
+{
+	Node *outer = curBlk;
+	int i;
+
+	genBlockStart(b);
+	for (i = 0; i < b->nKid; i++)
+		genBlock(b->kid[i]);
+	genBlockEntry(b);
+	genNode(b->u.blk->body);                    /* このブロックの主文 */
+	genBlockEnd(b);
+	curBlk = outer;
+}
+
+/* レベルlevelの名前のブロックbを呼ぶ飛び先(toEntryなら開始番地、でなければ先頭のjmp) */
+RelAddr callAddr(Node *b, int level, int toEntry)
+{
+	RelAddr a;
+	a.level = level;
+	a.addr = b == NULL ? 0 : toEntry ? b->u.blk->entry : b->u.blk->start;
+	return a;
+}
+
+/* 呼び出しの飛び先(ブロックの先頭のjmpか開始番地) */
+static RelAddr callTarget(Node *n)
+{
+	return callAddr(n->u.call.blk, n->u.call.level, n->u.call.toEntry);
+}
+
+/* 式nが変数vを参照するか */
+static int usesVar(Node *n, RelAddr v)
+{
+	int i;
+	if (n->kind == VarN)
+		return n->u.addr.level == v.level && n->u.addr.addr == v.addr;
+	for (i = 0; i < n->nKid; i++)
+		if (usesVar(n->kid[i], v))
+			return 1;
+	return 0;
+}
+
+/* VecNの添字x(v, v+c, c+v, v-c)のcの値 */
+static int vecOffset(Node *x)
+{
+	if (x->kind == VarN)
+		return 0;
+	if (x->kid[1]->kind == NumN)
+		return x->u.optr == add ? x->kid[1]->u.value : -x->kid[1]->u.value;
+	return x->kid[0]->u.value;
+}
+
+/* VecNの代入する式のコード生成(vはループ変数). vを含まない式はスカラーで計算して広げる */
+static void genVec(Node *n, RelAddr v)
+{
+	if (!usesVar(n, v)) {
+		genNode(n);
+		setCodeLine(n->line);
+		genCodeV(vbc, 0);
+		return;
+	}
+	switch (n->kind) {
+	case ArrN:
+		setCodeLine(n->line);
+		genCodeV(lit, vecOffset(n->kid[0]));
+		genCodeA(vld, n->u.addr);
+		return;
+	case UnN:
+	case BinN:
+		genVec(n->kid[0], v);
+		if (n->nKid > 1)
+			genVec(n->kid[1], v);
+		setCodeLine(n->line);
+		genCodeV(vop, n->u.optr);                 /* アドレス部は演算の種類 */
+		return;
+	default:
+		return;
+	}
+}
+
+/* 文、式のコード生成 */
+void genNode(Node *n)
+{
+	int backP, backP2, backP3, backP4, i;
+	RelAddr a;
+
+	if (n == NULL)
+		return;
+	switch (n->kind) {
+	case NumN:
+		setCodeLine(n->line);
+		genCodeV(lit, n->u.value);
+		return;
+	case VarN:
+		setCodeLine(n->line);
+		genCodeA(lod, n->u.addr);
+		return;
+	case ArrN:
+		genNode(n->kid[0]);                     /* 添字の式、loda命令がそれを要素の値に置き換える */
+		setCodeLine(n->line);
+		genCodeA(loda, n->u.addr);
+		return;
+	case CallN:
+	case CallStN:
+		for (i = 0; i < n->nKid; i++)           /* 実引数 */
+			genNode(n->kid[i]);
+		setCodeLine(n->line);
+		genCodeA(cal, callTarget(n));           /* call命令 */
+		return;
+	case SpawnN:
+		for (i = 0; i < n->nKid; i++)           /* 実引数 */
+			genNode(n->kid[i]);
+		setCodeLine(n->line);
+		genCodeA(spn, callTarget(n));           /* 仕事にして値の場所を空けておく */
+		return;
+	case SyncN:
+		genNode(n->kid[0]);
+		setCodeLine(n->line);
+		genCodeV(syn, n->u.value);              /* 仕事を待って値を入れる */
+		return;
+	case TailN:
+		for (i = 0; i < n->nKid; i++)           /* 実引数 */
+			genNode(n->kid[i]);
+		setCodeLine(n->line);
+		a.level = curBlk->u.blk->level;
+		for (i = n->nKid - 1; i >= 0; i--) {    /* 後ろのパラメタから代入する */
+			a.addr = i - n->nKid;
+			genCodeA(sto, a);
+		}
+		genCodeV(jmp, curBlk->u.blk->entry + 1); /* ictの次へ */
+		return;
+	case UnN:
+		genNode(n->kid[0]);
+		setCodeLine(n->line);
+		genCodeO(n->u.optr);
+		return;
+	case BinN:
+		genNode(n->kid[0]);
+		genNode(n->kid[1]);
+		setCodeLine(n->line);
+		genCodeO(n->u.optr);
+		return;
+	case SeqN:
+	case BeginN:
+		for (i = 0; i < n->nKid; i++)
+			genNode(n->kid[i]);
+		return;
+	case AssignN:
+		genNode(n->kid[0]);
+		setCodeLine(n->line);
+		genCodeA(sto, n->u.addr);
+		return;
+	case AssignArrN:
+		genNode(n->kid[0]);
+		genNode(n->kid[1]);
+		setCodeLine(n->line);
+		genCodeA(stoa, n->u.addr);
+		return;
+	case IfN:
+		genNode(n->kid[0]);                     /* 条件式 */
+		setCodeLine(n->line);
+		backP = genCodeV(jpc, 0);
+		genNode(n->kid[1]);
+		if (n->nKid > 2) {
+			setCodeLine(n->line);
+			backP2 = genCodeV(jmp, 0);
+			backPatch(backP);
+			genNode(n->kid[2]);
+			backPatch(backP2);
+		}
+		else
+			backPatch(backP);
+		return;
+	case UnlessN:
+		genNode(n->kid[0]);
+		setCodeLine(n->line);
+		backP = genCodeV(jpc, 0);
+		backP2 = genCodeV(jmp, 0);
+		backPatch(backP);
+		genNode(n->kid[1]);
+		backPatch(backP2);
+		return;
+	case WhileN:
+		backP2 = nextCode();                    /* while文の最後のjmp命令の飛び先 */
+		genNode(n->kid[0]);
+		setCodeLine(n->line);
+		backP = genCodeV(jpc, 0);               /* 条件式が偽のとき飛び出すjpc命令 */
+		genNode(n->kid[1]);
+		setCodeLine(n->line);
+		genCodeV(jmp, backP2);                  /* while文の先頭へのジャンプ命令 */
+		backPatch(backP);
+		return;
+	case DoN:
+		backP = nextCode();
+		genNode(n->kid[0]);
+		genNode(n->kid[1]);
+		setCodeLine(n->line);
+		backP2 = genCodeV(jpc, 0);
+		genCodeV(jmp, backP);
+		backPatch(backP2);
+		return;
+	case RepeatN:
+		backP = nextCode();
+		genNode(n->kid[0]);
+		genNode(n->kid[1]);
+		setCodeLine(n->line);
+		genCodeV(jpc, backP);
+		return;
+	case ForN:
+		genNode(n->kid[0]);                     /* 初期化 */
+		backP4 = nextCode();
+		genNode(n->kid[1]);                     /* 条件 */
+		setCodeLine(n->line);
+		backP2 = genCodeV(jpc, 0);
+		backP = genCodeV(jmp, 0);
+		backP3 = nextCode();
+		genNode(n->kid[2]);                     /* 増分 */
+		setCodeLine(n->line);
+		genCodeV(jmp, backP4);
+		backPatch(backP);
+		genNode(n->kid[3]);                     /* 文 */
+		setCodeLine(n->line);
+		genCodeV(jmp, backP3);
+		backPatch(backP2);
+		return;
+	case VecN:
+		a = n->kid[1]->u.addr;                  /* ループ変数 */
+		backP2 = nextCode();
+		setCodeLine(n->line);
+		genCodeA(lod, a);
+		genNode(n->kid[0]);                     /* 終りの値 */
+		setCodeLine(n->line);
+		genCodeV(vlp, 0);                       /* まとめて計算する要素の数を決め、残りがあるか */
+		backP = genCodeV(jpc, 0);
+		for (i = 2; i < n->nKid; i++) {         /* 配列の要素への代入 */
+			genVec(n->kid[i]->kid[1], a);
+			setCodeLine(n->kid[i]->line);
+			genCodeV(lit, vecOffset(n->kid[i]->kid[0]));
+			genCodeA(vst, n->kid[i]->u.addr);
+		}
+		setCodeLine(n->line);
+		genCodeA(lod, a);                       /* まとめた要素の数だけ進める */
+		genCodeV(vlen, 0);
+		genCodeO(add);
+		genCodeA(sto, a);
+		genCodeV(jmp, backP2);
+		backPatch(backP);
+		return;
+	case ParForN:
+		genNode(n->kid[0]);                     /* 初期化 */
+		setCodeLine(n->line);
+		genCodeA(lod, n->kid[3]->u.addr);       /* 初めの値 */
+		genNode(n->kid[1]);                     /* 終りの値 */
+		genNode(n->kid[2]);                     /* 増分 */
+		setCodeLine(n->line);
+		i = genCodeA(pfor, callTarget(n));      /* 繰り返しの手続きをスレッドに分けて呼ぶ */
+		if (n->u.call.blk->u.blk->entry == 0)   /* 繰り返しの手続きはブロックの後ろに生成する */
+			n->u.call.blk->u.blk->callAt = i;
+		genCodeA(sto, n->kid[3]->u.addr);       /* ループ変数の最後の値 */
+		return;
+	case RetN:
+		if (n->nKid == 0) {
+			setCodeLine(n->line);
+			genCodeR(1, curBlk->u.blk->level, curBlk->u.blk->pars);
+		}
+		else {
+			genNode(n->kid[0]);
+			setCodeLine(n->line);
+			genCodeR(0, curBlk->u.blk->level, curBlk->u.blk->pars);
+		}
+		return;
+	case WriteN:
+		genNode(n->kid[0]);
+		setCodeLine(n->line);
+		genCodeO(wrt);                          /* その値を出力するwrt命令 */
+		return;
+	case WriteLnN:
+		setCodeLine(n->line);
+		genCodeO(wrl);                          /* 改行を出力するwrl命令 */
+		return;
+	case BlockN:
+		genBlock(n);
+		return;
+	default:
+		return;
+	}
+}
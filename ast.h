@@ -0,0 +1,98 @@
+/********** ast.h **********/
+#ifndef AST_H_
+#define AST_H_
+
+#include "table.h"
+#include "codegen.h"
+
+/* 構文木の節点の種類 */
+typedef enum nodeKinds {
+	/* 式 */
+	NumN,          /* 定数                 u.value */
+	VarN,          /* 変数、パラメタ        u.addr */
+	ArrN,          /* 配列の要素           u.addr, kid[0]:添字 */
+	CallN,         /* 関数呼び出し          u.call, kid[]:実引数 */
+	UnN,           /* 単項演算(neg, odd)   u.optr, kid[0] */
+	BinN,          /* 二項演算             u.optr, kid[0], kid[1] */
+	SeqN,          /* 演算子のない並び(エラー回復で生じる) kid[]を順に評価 */
+	SpawnN,        /* 仕事にする関数呼び出し(--spawn) u.call, kid[]:実引数 */
+	SyncN,         /* 評価してから仕事を待ち合わせる式 u.value:待つ仕事の数, kid[0] */
+	/* 文 */
+	AssignN,       /* 代入文               u.addr, kid[0]:式 */
+	AssignArrN,    /* 配列要素への代入文     u.addr, kid[0]:添字, kid[1]:式 */
+	IfN,           /* if文                kid[0]:条件, kid[1]:then部, (kid[2]:else部) */
+	UnlessN,       /* unless文            kid[0]:条件, kid[1]:文 */
+	WhileN,        /* while文             kid[0]:条件, kid[1]:文 */
+	DoN,           /* do ... while文      kid[0]:文, kid[1]:条件 */
+	RepeatN,       /* repeat ... until文  kid[0]:文, kid[1]:条件 */
+	ForN,          /* for文               kid[0]:初期化, kid[1]:条件, kid[2]:増分, kid[3]:文 */
+	VecN,          /* ベクトル化したfor文  kid[0]:終りの値(含まない), kid[1]:ループ変数の代入(式はNULL), kid[2..]:配列の要素への代入 */
+	ParForN,       /* 並列のfor文          u.call(blk:繰り返しの手続き), kid[0]:初期化, kid[1]:終りの値(含まない), kid[2]:増分(NumN), kid[3]:ループ変数(VarN) */
+	CallStN,       /* call文              u.call, kid[]:実引数 */
+	TailN,         /* 自分自身の末尾呼び出し u.call, kid[]:実引数(パラメタに代入して主文の先頭へ飛ぶ) */
+	RetN,          /* return文            (kid[0]:返す式) */
+	BeginN,        /* begin ... end文     kid[]:文の並び */
+	WriteN,        /* write文             kid[0]:式 */
+	WriteLnN,      /* writeln文 */
+	/* ブロック */
+	BlockN,        /* 主ブロック、関数、手続き u.blk, kid[]:内部の関数と手続き(宣言順) */
+	end_of_NodeKind
+} NodeKind;
+
+/* ブロックの情報(ほかの節点を大きくしないように共用体の外に置く) */
+typedef struct blockInfo {
+	int id;                   /* ブロックの番号(名前表には関数の番地の代わりにこれを入れる) */
+	int level;                /* ブロックのレベル */
+	int isProc;               /* 手続きのブロックか */
+	int pars;                 /* パラメタ数 */
+	int frame;                /* 実行時に必要とする記憶域(ict命令の値) */
+	int started;              /* 主文の解析を始めたか */
+	int start;                /* 先頭(内部関数を飛び越すjmp)の番地 */
+	int entry;                /* 開始番地(ict命令の番地) */
+	int endLine;              /* 主文の終りの行 */
+	int callAt;               /* 開始番地より先に生成した、このブロックを呼ぶpfor命令の番地 */
+	struct node *body;        /* 主文 */
+} BlockInfo;
+
+/* 構文木の節点 (子の並びは連続した配列) */
+typedef struct node {
+	NodeKind kind;
+	int line;                     /* ソースの行(ヒートマップ用) */
+	int nKid;                     /* 子の数 */
+	struct node **kid;            /* 子の配列(NULLの子はコードを生成しない) */
+	union {
+		int value;                /* NumN, SyncN */
+		Operator optr;            /* UnN, BinN */
+		RelAddr addr;             /* VarN, ArrN, AssignN, AssignArrN */
+		struct {
+			int level;            /* 呼ぶ関数の名前のレベル */
+			int toEntry;          /* 開始番地(ict)を呼ぶか(偽ならブロックの先頭のjmpを呼ぶ) */
+			struct node *blk;     /* 呼ぶ関数のブロック */
+		} call;                   /* CallN, CallStN, TailN, ParForN, SpawnN */
+		struct blockInfo *blk;    /* BlockN */
+	} u;
+} Node;
+
+void *astAlloc(int size);                   /* 構文木用の領域を確保 */
+void astFree();                             /* 構文木の領域を一括して解放 */
+
+Node *newNode(NodeKind k, int nKid);        /* 子の数がnKidの節点を作る */
+Node *newNode1(NodeKind k, Node *a);        /* 子が一つの節点 */
+Node *newNode2(NodeKind k, Node *a, Node *b);    /* 子が二つの節点 */
+Node *copyNode(Node *n);                    /* 式や文の複製 */
+Node *newBlock();                           /* ブロックの節点を作る(番号を割り当てる) */
+Node *blockOf(int id);                      /* 番号idのブロック */
+
+int kidMark();                              /* 子を集め始める */
+void pushKid(Node *n);                      /* 子を一つ集める */
+Node *endKids(Node *n, int mark);           /* markから集めた子をnの子にする */
+
+void genProgram(Node *prog);                /* 構文木から目的コードを生成 */
+void genBlockStart(Node *b);                /* ブロックの先頭のjmpを生成 */
+void genBlockEntry(Node *b);                /* ブロックの開始番地のictを生成 */
+void genBlockEnd(Node *b);                  /* ブロックの主文のあとのretを生成 */
+void genNode(Node *n);                      /* 文、式のコード生成 */
+RelAddr callAddr(Node *b, int level, int toEntry);    /* ブロックbを呼ぶ飛び先 */
+int codeSize(Node *n);                      /* nから生成する命令語の数(の上限) */
+
+#endif
@@ -0,0 +1,248 @@
+/********** batch.c **********/
+/*
+ * 多くのプログラムの並列な実行(--batch)
+ *
+ * pl0d [options] --batch src...
+ *
+ * コンパイラは名前表や目的コードを大域変数に持ち、致命的な誤りではプロセスを終えるので、
+ * プログラムごとに子プロセスを作ってコンパイルし(同時にnThreads個まで)、検査を通った
+ * 目的コードをパイプで受け取って仮想機械のインスタンス(Vm)にする. WINDOW個ずつ
+ * 受け取ってから、それらのインスタンスをスレッドプールでnThreads個までのスレッドに
+ * 分けて実行する.
+ * インスタンスの出力はそれぞれのバッファにたまり、プログラムが終わってそれより前の
+ * プログラムもみな終わっていれば、プログラムの順に
+ *   ; src: 状態
+ *   出力
+ * と印字するので、ほかのプログラムの出力と混ざらない. 状態はok、コンパイルの誤り、
+ * 実行時の誤り(スタックの溢れ、0での割り算、配列の範囲外、命令語の数の上限)のどれか.
+ * 止まらないプログラムも、実行した命令語の数がbatchSteps(--steps=n)を越えると止める.
+ * 並列のforと仕事にした呼び出しは、インスタンスの中では順に実行する
+ * (スレッドはほかのプログラムが使う).
+ */
+#include <stdio.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include "codegen.h"
+#include "getSource.h"
+#include "pool.h"
+#include "batch.h"
+
+/* stdlib.hはOperatorのdivと衝突するので読まない */
+extern void *calloc(size_t n, size_t size);
+extern void *malloc(size_t size);
+extern void free(void *p);
+
+#define WINDOW 256    /* 一度にコンパイルして実行するプログラムの数 */
+
+long batchSteps = 1000000000;    /* インスタンスが実行する命令語の数の上限(0なら制限しない) */
+
+int compile();       /* compile.c */
+
+/* 子プロセスから返すコンパイルの結果(このあとに目的コードが続く) */
+typedef struct header {
+	int ok;              /* 開けてコンパイルできたか */
+	int errors;          /* エラーメッセージの数 */
+	int nCode;           /* 目的コードの命令語の数 */
+	int opNeed;          /* verifyCodeが求めたオペランドの数の最大値 */
+} Header;
+
+/* 一つのプログラム */
+typedef struct prog {
+	char *src;
+	pid_t pid;           /* コンパイルしている子プロセス */
+	int fd;              /* その結果を読むパイプ */
+	Vm *vm;              /* 実行するインスタンス(コンパイルできなければNULL) */
+	char *error;         /* コンパイルできなかったわけ */
+	int done;            /* 実行を終えたか */
+} Prog;
+
+/* 実行しているプログラムの並び */
+typedef struct batch {
+	Prog *prog;
+	int n;
+	int base;            /* 実行しているWINDOW個の先頭 */
+	int printed;         /* 結果を印字したプログラムの数(次に印字するプログラム) */
+	int failed;          /* 最後まで実行できなかったプログラムの数 */
+	pthread_mutex_t lock;    /* printed, failedと印字 */
+} Batch;
+
+/* fdからn文字読む(読めなければ0を返す) */
+static int readAll(int fd, void *buf, long n)
+{
+	long k;
+	char *p = buf;
+	while (n > 0) {
+		if ((k = read(fd, p, n)) <= 0)
+			return 0;
+		p += k;
+		n -= k;
+	}
+	return 1;
+}
+
+/* fdにn文字書く */
+static void writeAll(int fd, void *buf, long n)
+{
+	long k;
+	char *p = buf;
+	while (n > 0 && (k = write(fd, p, n)) > 0) {
+		p += k;
+		n -= k;
+	}
+}
+
+/* 子プロセスの中でsrcをコンパイルし、結果をfdに書く */
+static void compileChild(char *src, int fd)
+{
+	Header h;
+	Vm *v;
+
+	freopen("/dev/null", "w", stdout);    /* コンパイラのメッセージは捨てる(誤りは.htmlに書かれる) */
+	h.ok = openSource(src);
+	h.errors = h.nCode = h.opNeed = 0;
+	if (h.ok) {
+		h.ok = compile();                 /* 致命的な誤りならここで終わる */
+		h.errors = errorN();
+		closeSource();
+	}
+	v = h.ok ? vmNew(NULL, 0, 0) : NULL;
+	if (h.ok && v == NULL)
+		h.ok = 0;
+	if (v != NULL) {
+		h.nCode = v->nCode;
+		h.opNeed = v->opNeed;
+	}
+	writeAll(fd, &h, sizeof(h));
+	if (v != NULL)
+		writeAll(fd, v->code, (long)v->nCode * sizeof(Inst));
+}
+
+/* pのコンパイルを子プロセスで始める */
+static void startCompile(Prog *p)
+{
+	int fd[2];
+
+	p->pid = -1;
+	p->fd = -1;
+	fflush(stdout);
+	if (pipe(fd) < 0)
+		return;
+	if ((p->pid = fork()) < 0) {
+		close(fd[0]);
+		close(fd[1]);
+		return;
+	}
+	if (p->pid == 0) {
+		close(fd[0]);
+		compileChild(p->src, fd[1]);
+		_exit(0);
+	}
+	close(fd[1]);
+	p->fd = fd[0];
+}
+
+/* pのコンパイルの結果を受け取ってインスタンスを作る */
+static void finishCompile(Prog *p)
+{
+	Header h;
+	Inst *c = NULL;
+	int status;
+
+	if (p->fd < 0) {
+		p->error = "can't compile";
+		return;
+	}
+	if (!readAll(p->fd, &h, sizeof(h)))
+		p->error = "fatal errors";        /* errorF()で途中終了した */
+	else if (!h.ok)
+		p->error = h.errors ? "compile errors" : "can't open";
+	else if (h.nCode <= 0 || (c = malloc((long)h.nCode * sizeof(Inst))) == NULL
+			|| !readAll(p->fd, c, (long)h.nCode * sizeof(Inst)))
+		p->error = "can't compile";
+	else if ((p->vm = vmNew(c, h.nCode, h.opNeed)) == NULL)
+		p->error = vmMessage(vmNoMemory);
+	else
+		p->vm->stepMax = batchSteps;
+	free(c);
+	close(p->fd);
+	waitpid(p->pid, &status, 0);
+}
+
+/* プログラムpの結果を印字する */
+static void report(Batch *b, Prog *p)
+{
+	Vm *v = p->vm;
+	if (v == NULL) {
+		printf("; %s: %s\n", p->src, p->error);
+		b->failed++;
+		return;
+	}
+	printf("; %s: %s\n", p->src, vmMessage(v->status));
+	fwrite(v->out, 1, v->outLen, stdout);
+	if (v->outLen > 0 && v->out[v->outLen - 1] != '\n')
+		printf("\n");
+	if (v->status != vmOk)
+		b->failed++;
+	vmFree(v);
+	p->vm = NULL;
+}
+
+/* プログラムkが終わった. それより前がみな終わっていれば、まだ印字していない結果を順に印字する */
+static void finished(Batch *b, long k)
+{
+	pthread_mutex_lock(&b->lock);
+	b->prog[k].done = 1;
+	if (b->printed == k) {
+		while (b->printed < b->n && b->prog[b->printed].done)
+			report(b, &b->prog[b->printed++]);
+		fflush(stdout);
+	}
+	pthread_mutex_unlock(&b->lock);
+}
+
+/* base+from..base+to-1のプログラムを実行する(poolForから呼ぶ) */
+static void runProgs(void *arg, void *ctx, long from, long to)
+{
+	Batch *b = arg;
+	long k;
+	for (k = b->base + from; k < b->base + to; k++) {
+		if (b->prog[k].vm != NULL)
+			vmExecute(b->prog[k].vm);
+		finished(b, k);
+	}
+}
+
+/* src[0..n-1]をコンパイルして並列に実行し、順に結果を印字する.
+   最後まで実行できなかったプログラムの数を返す */
+int batchRun(char *src[], int n)
+{
+	Batch b;
+	int k, lo, hi, done;
+
+	b.prog = calloc(n > 0 ? n : 1, sizeof(Prog));
+	if (b.prog == NULL) {
+		printf("; out of memory\n");
+		return n;
+	}
+	b.n = n;
+	b.printed = b.failed = 0;
+	pthread_mutex_init(&b.lock, NULL);
+	for (k = 0; k < n; k++)
+		b.prog[k].src = src[k];
+	for (lo = 0; lo < n; lo = hi) {
+		hi = n - lo > WINDOW ? lo + WINDOW : n;
+		for (k = done = lo; done < hi; ) {    /* 子プロセスはnThreads個まで同時に走らせる */
+			if (k < hi && k - done < nThreads)
+				startCompile(&b.prog[k++]);
+			else
+				finishCompile(&b.prog[done++]);
+		}
+		b.base = lo;
+		poolFor(hi - lo, runProgs, &b, NULL);
+	}
+	pthread_mutex_destroy(&b.lock);
+	free(b.prog);
+	return b.failed;
+}
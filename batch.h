@@ -0,0 +1,11 @@
+/********** batch.h **********/
+#ifndef BATCH_H_
+#define BATCH_H_
+
+extern long batchSteps;    /* インスタンスが実行する命令語の数の上限(--steps=n、0なら制限しない) */
+
+/* src[0..n-1]をコンパイルして並列に実行し、順に結果を印字する(--batch).
+   最後まで実行できなかったプログラムの数を返す */
+int batchRun(char *src[], int n);
+
+#endif
@@ -0,0 +1,396 @@
+/********** genpl0.c **********/
+/*
+ * 大きさを指定してPL/0'のソースプログラムを生成する
+ * (字句解析、構文解析、名前表の性能測定用)
+ *
+ * genpl0 [-p 手続き数] [-n 関数の入れ子の深さ] [-v 局所変数の数] [-g 大域変数の数]
+ *        [-s 文の数] [-d 文の入れ子の深さ] [-e 式の項の数] [-l ループの回数] [-r 乱数の種]
+ *        [-i 1]
+ *
+ * 生成したプログラムは正しいPL/0'のプログラムで、必ず停止する.
+ * -i 1 なら式の因子にx+0, 0*x, x*1などの恒等式を混ぜ、配列を初期化してから使う
+ * (出力が初期化していない値によらないので、-Oあり、なしの出力を比べられる. make equiv).
+ * 結果は標準出力に書く.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#define MAXDEPTH 3      /* 内部関数の最大の深さ(ブロックの最大深さ5から主ブロックとトップレベルを引いたもの) */
+#define LINEW    72     /* 出力する行の幅の目安(getSource.cのMAXLINEより小さいこと) */
+#define NCONST   5      /* 定数の数 */
+#define ASIZE    8      /* 配列の大きさ(ループ回数にこれを加えたもの) */
+
+static int nProc = 10;     /* トップレベルの手続き、関数の数 */
+static int nDepth = 1;     /* 内部関数の入れ子の深さ */
+static int nVar = 5;       /* 各ブロックの局所変数の数 */
+static int nGlobal = 10;   /* 大域変数の数 */
+static int nStmt = 8;      /* 各ブロックの主文の文の数 */
+static int sDepth = 2;     /* 文(ループ)の入れ子の深さ */
+static int nTerm = 4;      /* 式の項の数 */
+static int nLoop = 3;      /* ループの回数 */
+static int identities;     /* 恒等式を混ぜて配列を初期化するか(-i) */
+
+static int col;            /* 出力中の行の桁位置 */
+static int indent;         /* 字下げの深さ */
+static char lastc;         /* 最後に出力した文字 */
+
+/* 生成中のブロックの情報 */
+typedef struct blk {
+	char name[32];         /* ブロックの名前(名前の接頭辞) */
+	int isFunc;            /* 関数か */
+	int depth;             /* 内部関数の深さ(トップレベルは0) */
+	int hasInner;          /* 内部関数を持つか */
+	int loop;              /* 現在のループの入れ子の深さ */
+	struct blk *outer;     /* 一つ外側のブロック(トップレベルならNULL) */
+} Blk;
+
+static int rnd(int n)
+{
+	return rand() % n;
+}
+
+/* 字下げ付きで新しい行を始める */
+static void newLine()
+{
+	int i;
+	putchar('\n');
+	for (i = 0; i < indent; i++)
+		putchar(' ');
+	col = indent;
+}
+
+/* 行の幅を超えないように語を出力する */
+static void word(char *fmt, ...)
+{
+	char buf[128];
+	va_list ap;
+	int n;
+	va_start(ap, fmt);
+	n = vsprintf(buf, fmt, ap);
+	va_end(ap);
+	if (col + n + 1 > LINEW)
+		newLine();
+	else if (col > indent && lastc != '(' && !strchr(");,", buf[0]))
+		putchar(' '), col++;
+	fputs(buf, stdout);
+	col += n;
+	lastc = buf[n - 1];
+}
+
+static void expr(Blk *b, int n);
+
+/* 値を持つ因子を一つ出力する */
+static void operand(Blk *b)
+{
+	Blk *o;
+	int n;
+	switch (rnd(9)) {
+	case 0:
+		word("%d", rnd(100));
+		return;
+	case 1:
+		word("k%d", rnd(NCONST));
+		return;
+	case 2:
+		if (nGlobal > 0) {
+			word("g%d", rnd(nGlobal));
+			return;
+		}
+	case 3:
+		word("ga[%d]", rnd(nLoop + ASIZE));
+		return;
+	case 4:
+		if (b->loop > 0) {                               /* ループの中なら制御変数で配列を引く */
+			word("%sa[%si%d + %d]", b->name, b->name, rnd(b->loop), rnd(ASIZE));
+			return;
+		}
+	case 5:                                              /* 外側のブロックのパラメタ */
+		for (o = b, n = rnd(b->depth + 1); n > 0 && o->outer; n--)
+			o = o->outer;
+		word("%sp%d", o->name, rnd(2));
+		return;
+	case 6:                                              /* 内部関数の呼び出し */
+		if (b->hasInner && rnd(2)) {
+			word("%snf(", b->name);
+			expr(b, 1);
+			word(",");
+			expr(b, 1);
+			word(")");
+			return;
+		}
+	default:
+		if (nVar > 0)
+			word("%sv%d", b->name, rnd(nVar));
+		else
+			word("%d", rnd(100));
+		return;
+	}
+}
+
+/* 因子を一つ、値の変わらない演算で包んで出力する */
+static void identity(Blk *b)
+{
+	switch (rnd(10)) {
+	case 0: word("("); operand(b); word("+ 0)"); break;
+	case 1: word("(0 +"); operand(b); word(")"); break;
+	case 2: word("("); operand(b); word("- 0)"); break;
+	case 3: word("("); operand(b); word("* 1)"); break;
+	case 4: word("(1 *"); operand(b); word(")"); break;
+	case 5: word("("); operand(b); word("/ 1)"); break;
+	case 6: word("(-(-"); operand(b); word("))"); break;
+	case 7: word("(0 * ("); operand(b); word("+ 0))"); break;
+	case 8: word("(0 * ("); operand(b); word("* 1))"); break;
+	default: word("(("); operand(b); word("- 0) * 0)"); break;
+	}
+}
+
+/* 項の数がn個の式を出力する */
+static void expr(Blk *b, int n)
+{
+	int i;
+	for (i = 0; i < n; i++) {
+		if (i > 0)
+			word(rnd(3) ? "+" : "-");
+		switch (rnd(identities ? 8 : 6)) {
+		case 6:
+		case 7:
+			identity(b);
+			break;
+		case 0:
+			word("(");
+			operand(b);
+			word("* %d", rnd(3) + 1);
+			word(")");
+			break;
+		case 1:
+			operand(b);
+			word("/ %d", rnd(7) + 1);
+			break;
+		default:
+			operand(b);
+			break;
+		}
+	}
+}
+
+/* 代入できる変数を一つ出力する(ループの制御変数は選ばない) */
+static void lvalue(Blk *b)
+{
+	switch (rnd(4)) {
+	case 0:
+		if (nGlobal > 0) {
+			word("g%d", rnd(nGlobal));
+			return;
+		}
+	case 1:
+		if (b->loop > 0) {
+			word("%sa[%si%d + %d]", b->name, b->name, rnd(b->loop), rnd(ASIZE));
+			return;
+		}
+	default:
+		if (nVar > 0)
+			word("%sv%d", b->name, rnd(nVar));
+		else
+			word("%sp%d", b->name, rnd(2));
+		return;
+	}
+}
+
+/* 文を一つ出力する(dは残りの入れ子の深さ) */
+static void statement(Blk *b, int d)
+{
+	char ctl[40];
+	int r = d > 0 ? rnd(6) : 3;
+	switch (r) {
+	case 0:                                              /* 回数の決まったwhile文 */
+	case 1:                                              /* 回数の決まったfor文 */
+		sprintf(ctl, "%si%d", b->name, b->loop);
+		if (r == 0) {                                    /* 初期化とwhile文を一つの文にまとめる */
+			word("begin %s := 0;", ctl);
+			word("while %s < %d do", ctl, nLoop);
+		}
+		else
+			word("for %s := 0; %s < %d; %s := %s + 1 do", ctl, ctl, nLoop, ctl, ctl);
+		b->loop++;
+		indent += 2; newLine();
+		word("begin");
+		indent += 2; newLine();
+		statement(b, d - 1);
+		word(";"); newLine();
+		statement(b, d - 1);
+		if (r == 0) {
+			word(";"); newLine();
+			word("%s := %s + 1", ctl, ctl);
+		}
+		indent -= 2; newLine();
+		word(r == 0 ? "end end" : "end");
+		indent -= 2;
+		b->loop--;
+		return;
+	case 2:                                              /* if文 */
+		word("if");
+		expr(b, 2);
+		word(rnd(2) ? "<" : ">=");
+		expr(b, 2);
+		word("then");
+		indent += 2; newLine();
+		statement(b, d - 1);
+		indent -= 2;
+		if (rnd(2)) {
+			newLine(); word("else");
+			indent += 2; newLine();
+			statement(b, d - 1);
+			indent -= 2;
+		}
+		return;
+	default:                                             /* 代入文 */
+		lvalue(b);
+		word(":=");
+		expr(b, nTerm);
+		return;
+	}
+}
+
+/* 手続きか関数を一つ出力する */
+static void block(Blk *outer, char *name, int isFunc, int depth)
+{
+	Blk b;
+	int i;
+
+	strcpy(b.name, name);
+	b.isFunc = isFunc;
+	b.depth = depth;
+	b.hasInner = depth < nDepth;
+	b.loop = 0;
+	b.outer = outer;
+
+	newLine();
+	word("%s %sf(%sp0, %sp1)", isFunc ? "function" : "procedure", name, name, name);
+	indent += 2; newLine();
+	word("var");
+	for (i = 0; i < nVar; i++)
+		word("%sv%d,", name, i);
+	for (i = 0; i < sDepth; i++)
+		word("%si%d,", name, i);
+	word("%sa[%d];", name, nLoop + ASIZE);
+	if (b.hasInner) {                                    /* 内部関数 */
+		char inner[32];
+		sprintf(inner, "%sn", name);
+		block(&b, inner, 1, depth + 1);
+	}
+	indent -= 2; newLine();
+	word("begin");
+	indent += 2;
+	if (identities && sDepth > 0) {                      /* 配列の初期化 */
+		newLine();
+		word("for %si0 := 0;", name);
+		word("%si0 < %d;", name, nLoop + ASIZE);
+		word("%si0 := %si0 + 1 do", name, name);
+		word("%sa[%si0] := %si0;", name, name, name);
+	}
+	for (i = 0; i < nVar; i++) {                         /* 局所変数の初期化 */
+		newLine();
+		word("%sv%d := %sp%d + %d;", name, i, name, i % 2, i);
+	}
+	for (i = 0; i < nStmt; i++) {
+		newLine();
+		statement(&b, sDepth);
+		word(";");
+	}
+	newLine();
+	if (isFunc) {
+		word("return");
+		expr(&b, nTerm);
+	}
+	else
+		word("write %sp0", name);
+	indent -= 2; newLine();
+	word("end;");
+}
+
+static void usage()
+{
+	fprintf(stderr, "genpl0 [-p procs] [-n nest] [-v vars] [-g globals] [-s stmts]"
+			" [-d depth] [-e terms] [-l loops] [-r seed] [-i 1]\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int i, seed = 1;
+	char name[32];
+
+	for (i = 1; i < argc; i++) {
+		int v;
+		if (argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0' || i + 1 >= argc)
+			usage();
+		v = atoi(argv[i + 1]);
+		switch (argv[i][1]) {
+		case 'p': nProc = v; break;
+		case 'n': nDepth = v > MAXDEPTH ? MAXDEPTH : v; break;
+		case 'v': nVar = v; break;
+		case 'g': nGlobal = v; break;
+		case 's': nStmt = v; break;
+		case 'd': sDepth = v; break;
+		case 'e': nTerm = v > 0 ? v : 1; break;
+		case 'l': nLoop = v > 0 ? v : 1; break;
+		case 'r': seed = v; break;
+		case 'i': identities = v; break;
+		default: usage();
+		}
+		i++;
+	}
+	srand(seed);
+
+	col = 0; indent = 0;
+	word("const");
+	for (i = 0; i < NCONST; i++)
+		word(i < NCONST - 1 ? "k%d = %d," : "k%d = %d;", i, i + 2);
+	newLine();
+	word("var");
+	for (i = 0; i < nGlobal; i++)
+		word("g%d,", i);
+	word("ga[%d];", nLoop + ASIZE);
+	newLine();
+
+	for (i = 0; i < nProc; i++) {
+		sprintf(name, "q%d", i);
+		block(NULL, name, i % 2 == 0, 0);
+		newLine();
+	}
+
+	newLine();
+	word("var s;");
+	newLine();
+	word("begin");
+	indent += 2;
+	newLine();
+	if (identities) {                                    /* 大域の配列の初期化(sを制御変数に使う) */
+		word("for s := 0; s < %d; s := s + 1 do ga[s] := s;", nLoop + ASIZE);
+		newLine();
+	}
+	word("s := 0;");
+	for (i = 0; i < nGlobal; i++) {
+		newLine();
+		word("g%d := %d;", i, i);
+	}
+	for (i = 0; i < nProc; i++) {
+		newLine();
+		if (i % 2 == 0)
+			word("s := s + q%df(%d, %d) / 16;", i, i, i + 1);
+		else
+			word("call q%df(%d, %d);", i, i, i + 1);
+	}
+	newLine();
+	word("write s;");
+	for (i = 0; i < nGlobal; i++)
+		word("write g%d;", i);
+	newLine();
+	word("writeln");
+	indent -= 2; newLine();
+	word("end.");
+	putchar('\n');
+	return 0;
+}
@@ -0,0 +1,195 @@
+/********** pl0bench.c **********/
+/*
+ * コンパイラの各段階の処理速度とメモリー使用量を測る
+ *
+ * pl0bench [-r 繰り返し回数] src...
+ *
+ * 段階ごとに子プロセスを作って計測するので、各段階の最大常駐メモリーが
+ * 他の段階の影響を受けない. 時間は繰り返しの中の最小値をとる.
+ *   lex     : nextToken()だけでソースを最後の"."まで読む(.htmlへのトークンの印字を含む)
+ *   compile : compile()全体(字句解析、構文解析、名前表、コード生成)
+ *   parse   : compileとlexの差(構文解析、名前表、コード生成の分)
+ *   list    : listCode()による目的コードのリスティング
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "../getSource.h"
+
+int compile();       /* compile.c */
+void listCode();     /* codegen.c (codegen.h はstdlib.hのdivと衝突するので読まない) */
+
+/* 段階の種類 */
+typedef enum phase {
+	idle, lex, comp, list, end_of_Phase
+} Phase;
+
+static char *phaseName[] = { "idle", "lex", "compile", "list" };
+
+/* 子プロセスから返す計測結果 */
+typedef struct result {
+	double sec;        /* 経過時間(秒) */
+	long tokens;       /* 読んだトークン数 */
+	long maxrss;       /* 最大常駐メモリー(KB) */
+	int ok;            /* コンパイルが成功したか */
+} Result;
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* 子プロセスの中で段階pを実行する */
+static Result runPhase(Phase p, char *src)
+{
+	Result r;
+	struct rusage ru;
+	double t0 = 0, t1 = 0;
+
+	memset(&r, 0, sizeof(r));
+	r.ok = 1;
+	if (p != idle && !openSource(src)) {
+		r.ok = 0;
+		return r;
+	}
+	switch (p) {
+	case idle:
+		break;
+	case lex:
+		t0 = now();
+		initSource();
+		do
+			r.tokens++;
+		while (nextToken().kind != Period);
+		t1 = now();
+		closeSource();
+		break;
+	case comp:
+		t0 = now();
+		r.ok = compile();
+		t1 = now();
+		closeSource();
+		break;
+	case list:
+		r.ok = compile();
+		t0 = now();
+		if (r.ok)
+			listCode();
+		t1 = now();
+		closeSource();
+		break;
+	default:
+		break;
+	}
+	r.sec = t1 - t0;
+	getrusage(RUSAGE_SELF, &ru);
+	r.maxrss = ru.ru_maxrss;
+	return r;
+}
+
+/* 段階pを子プロセスで実行し、結果を受け取る */
+static int measure(Phase p, char *src, Result *res)
+{
+	int fd[2], status;
+	pid_t pid;
+	Result r;
+
+	fflush(stdout);
+	if (pipe(fd) < 0 || (pid = fork()) < 0) {
+		perror("pl0bench");
+		exit(1);
+	}
+	if (pid == 0) {
+		close(fd[0]);
+		freopen("/dev/null", "w", stdout);    /* コンパイラのメッセージやリスティングは捨てる */
+		r = runPhase(p, src);
+		write(fd[1], &r, sizeof(r));
+		_exit(0);
+	}
+	close(fd[1]);
+	if (read(fd[0], res, sizeof(*res)) != sizeof(*res))
+		res->ok = 0;                           /* errorF()などで途中終了した */
+	close(fd[0]);
+	waitpid(pid, &status, 0);
+	return res->ok;
+}
+
+/* ファイルの行数とバイト数を数える */
+static long countLines(char *src, long *bytes)
+{
+	FILE *fp;
+	long n = 0;
+	int c;
+	*bytes = 0;
+	if ((fp = fopen(src, "r")) == NULL)
+		return 0;
+	while ((c = getc(fp)) != EOF) {
+		++*bytes;
+		if (c == '\n')
+			n++;
+	}
+	fclose(fp);
+	return n;
+}
+
+static void report(char *name, double sec, long lines, long tokens, long kb)
+{
+	printf("  %-8s %10.3f ms %12.0f lines/s %12.0f tokens/s %8ld KB\n",
+		name, sec * 1e3, sec > 0 ? lines / sec : 0, sec > 0 ? tokens / sec : 0, kb);
+}
+
+static void bench(char *src, int repeat)
+{
+	Result best[end_of_Phase], r;
+	long lines, bytes;
+	int p, i;
+
+	lines = countLines(src, &bytes);
+	for (p = 0; p < end_of_Phase; p++) {
+		for (i = 0; i < repeat; i++) {
+			if (!measure(p, src, &r)) {
+				printf("%s: %s failed\n", src, phaseName[p]);
+				return;
+			}
+			if (i == 0 || r.sec < best[p].sec)
+				best[p].sec = r.sec;
+			if (i == 0 || r.maxrss > best[p].maxrss)
+				best[p].maxrss = r.maxrss;
+			best[p].tokens = r.tokens;
+		}
+	}
+	printf("%s: %ld lines, %ld bytes, %ld tokens\n", src, lines, bytes, best[lex].tokens);
+	for (p = lex; p < end_of_Phase; p++) {
+		report(phaseName[p], best[p].sec, lines, best[lex].tokens, best[p].maxrss - best[idle].maxrss);
+		if (p == comp)
+			report("parse", best[comp].sec - best[lex].sec, lines, best[lex].tokens,
+				best[comp].maxrss - best[lex].maxrss);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int i, repeat = 3;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+			repeat = atoi(argv[++i]);
+		else {
+			fprintf(stderr, "pl0bench [-r repeat] src...\n");
+			return 1;
+		}
+	}
+	if (i == argc || repeat < 1) {
+		fprintf(stderr, "pl0bench [-r repeat] src...\n");
+		return 1;
+	}
+	for (; i < argc; i++)
+		bench(argv[i], repeat);
+	return 0;
+}
@@ -1,30 +1,365 @@
 /********** codegen.c **********/
 #include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <limits.h>
 #include "codegen.h"
 #include "table.h"
 #include "getSource.h"
+#include "stats.h"
+#include "ir.h"
+#include "pool.h"
 
-#define MAXCODE 200    /* 目的コードの最大長さ */
-#define MAXMEM 2000    /* 実行時スタックの最大長さ */
-#define MAXREG 20      /* 演算レジスタスタックの最大長さ */
-#define MAXLEVEL 5     /* ブロックの最大深さ */
-
-/* 命令語の型 */
-typedef struct inst {
-	OpCode  opCode;
-	union {
-		RelAddr addr;
-		int value;
-		Operator optr;
-	} u;
-} Inst;
+
+/* 計数しない実行ループと計数する実行ループを一つの関数から作るためのインライン展開の指定 */
+#if defined(__GNUC__)
+#define ALWAYS_INLINE __inline__ __attribute__((always_inline))
+#define NOINLINE __attribute__((noinline))
+#define THREAD_LOCAL __thread
+#else
+#define ALWAYS_INLINE
+#define NOINLINE
+#define THREAD_LOCAL _Thread_local
+#endif
+
+/* stdlib.hはOperatorのdivと衝突するので読まない */
+extern void qsort(void *base, size_t n, size_t size, int (*cmp)(const void *, const void *));
+extern void *calloc(size_t n, size_t size);
+extern void *realloc(void *p, size_t size);
+extern void free(void *p);
 
 static char ref[MAXCODE];        /* ref[i]が0ならcode[i]は参照されている. */
 static Inst code[MAXCODE];       /* 目的コードが入る */
+static int lineOf[MAXCODE];      /* code[i]を生成したソースの行 */
+static int codeLine;             /* 次に生成する命令語に対応するソースの行 */
 static int cIndex = -1;          /* 最後に生成した命令語のインデックス */
 static void checkMax();          /* 目的コードのインデックスの増加とチェック */
-static void printCode(int i);    /* 命令語の印字 */
+static void printCode(FILE *fp, int i);    /* 命令語の印字 */
 static void updateRef(int i);
+static int vPars[MAXCODE];       /* 入口eのブロックが戻るときに取り除くパラメタの数(verifyCodeで求める) */
+
+/* 実行ループの種類 */
+typedef enum runModes {
+	plainRun,       /* 計数しない */
+	countRun,       /* 統計とプロファイルをとる */
+	memoRun,        /* 計数しないが、関数の値を覚える命令語(--memo)も実行する */
+	evalRun,        /* 最適化で関数を評価する(実行する命令語の数に上限があり、実行時の誤りは失敗にする) */
+	parRun,         /* 並列のforの繰り返しや仕事にした関数呼び出しを一つ実行する(ワーカースレッドでも実行する) */
+	vmRun           /* 仮想機械のインスタンスで実行する(出力はバッファへ、実行時の誤りは状態にして止める) */
+} RunMode;
+
+/* スレッドで実行する呼び出しの実行時スタックの領域とディスプレイ. 各スレッドは
+   実行時スタックの自分の領域(スレッドw>0はw*MAXMEMからMAXMEM個)にフレームと
+   オペランドを積み、仕事を作ったときのディスプレイを写して外側のブロックの変数を共有する.
+   スレッドプールの仕事の文脈(ctx)には、待つあいだに使える領域を入れて渡す */
+typedef struct parWork {
+	int *display;
+	int base, end;              /* stack[base..end-1]を使う */
+	Vm *vm;                     /* vmRunで実行するインスタンス */
+} ParWork;
+
+/* 並列のfor(pfor命令)の仕事. ループ変数の値ごとに、繰り返しの手続き(パラメタはループ変数)を呼ぶ */
+typedef struct parJob {
+	int *stack;
+	Vm *vm;                     /* インスタンスの中の並列のforなら繰り返しを順に実行する */
+	int display[MAXLEVEL];      /* pfor命令を実行したときのディスプレイ */
+	int entry, level;           /* 繰り返しの手続きの開始番地(ict)とブロックのレベル */
+	long first, step;           /* k番目の繰り返しのループ変数の値はfirst + k*step */
+} ParJob;
+
+/* 仕事にした関数呼び出し(spn命令). 値はsyn命令が待ってからslotに入れる */
+typedef struct spawnTask {
+	PoolTask t;
+	int *stack;
+	int display[MAXLEVEL];      /* spn命令を実行したときのディスプレイ */
+	int entry, level;           /* 関数の開始番地(ict)とブロックのレベル */
+	int args[SPAWNARGS], nArgs;
+	int slot;                   /* 値を入れる実行時スタックの番地 */
+	int result;
+} SpawnTask;
+
+static ALWAYS_INLINE int run(RunMode mode, int stack[], ParWork *w, int entry, int level, int args[], int nArgs, long limit, int *result);
+
+/* 実行プロファイル用. 命令語の種類(キー)はopCode、ただしoprは演算の種類ごとに分ける */
+#define NKEY (end_of_OpCode + end_of_Operator)
+static unsigned char keyOf[MAXCODE];     /* 各番地の命令語のキー */
+static long execCount[MAXCODE];          /* 各番地の命令語の実行回数 */
+static long pairCount[NKEY + 1][NKEY];   /* 続けて実行した命令語のキーの組の回数(NKEY行は実行の先頭) */
+static long *sortCount;                  /* 整列に使う回数の表 */
+
+/* 純粋な関数の値を覚えておく表(--memo). 関数と実引数の組から求めた位置に一つだけ覚え、
+   同じ位置に入る別の組が来たら置き換える */
+#define MEMOSIZE 65536    /* 表の大きさ(2のべき乗) */
+typedef struct memo {
+	int entry;            /* 関数のentm命令の番地(0なら空き) */
+	int args[MEMOARGS];   /* 実引数 */
+	int value;            /* 関数の値 */
+} Memo;
+static Memo memo[MEMOSIZE];
+
+/* 番地entryの関数と実引数args[0..n-1]の組の表での位置 */
+static int memoSlot(int entry, int args[], int n)
+{
+	unsigned h = (unsigned)entry * 2654435761u;
+	int k;
+	for (k = 0; k < n; k++)
+		h = (h ^ (unsigned)args[k]) * 2654435761u;
+	return (h ^ h >> 16) & (MEMOSIZE - 1);
+}
+
+/* 表tabに覚えておいた値があればその表の位置を、なければ-1を返す
+   (実行ループのレジスタを使わないように展開しない) */
+static NOINLINE int memoFind(Memo tab[], int entry, int args[], int n)
+{
+	int s = memoSlot(entry, args, n), k;
+	if (tab[s].entry != entry)
+		return -1;
+	for (k = 0; k < n; k++)
+		if (tab[s].args[k] != args[k])
+			return -1;
+	return s;
+}
+
+/* 関数の値を表tabに覚えておく */
+static NOINLINE void memoStore(Memo tab[], int entry, int args[], int n, int value)
+{
+	int s = memoSlot(entry, args, n), k;
+	tab[s].entry = entry;
+	for (k = 0; k < n; k++)
+		tab[s].args[k] = args[k];
+	tab[s].value = value;
+}
+
+/* ベクトル命令(-O)のベクトルレジスタ. vlp命令がまとめて計算する要素の数vLenと先頭の添字vBaseを
+   決め、vld, vbc, vop, vst命令はレジスタのスタックvreg[0..vsp-1]の上で計算する.
+   演算はいつもVECLEN個の全部について(符号なしで、あふれは切り捨てる)行うので、
+   Cコンパイラが繰り返しをSIMD命令にする */
+#define VECLEN 64         /* まとめて計算する要素の数の上限 */
+static THREAD_LOCAL unsigned vreg[VECDEPTH][VECLEN];    /* 並列のforのワーカーはそれぞれのレジスタを使う */
+static THREAD_LOCAL int vsp, vBase, vLen;
+
+/* ベクトル命令iを実行して新しいtopを返す(実行ループのレジスタを使わないように展開しない).
+   endが0でなければ、配列の要素がstack[0..end-1]の外になるときに-1を返す */
+static NOINLINE int vecStep(Inst i, int stack[], int display[], int top, int end)
+{
+	unsigned *r, *s, x;
+	long n;
+	int k, a;
+	switch (i.opCode) {
+	case vlp:                         /* 添字と終りの値から、残りがあるかを積む */
+		--top;
+		n = (long)stack[top] - stack[top - 1];
+		vBase = stack[top - 1];
+		vLen = n > VECLEN ? VECLEN : (int)n;
+		vsp = 0;
+		stack[top - 1] = n > 0;
+		break;
+	case vlen:
+		stack[top++] = vLen;
+		break;
+	case vld:                         /* 配列の要素 i+c .. を読む(cはスタックのトップ) */
+		--top;
+		a = display[i.u.addr.level] + i.u.addr.addr + vBase + stack[top];
+		if (end > 0 && (a < 0 || a + vLen > end))
+			return -1;
+		memcpy(vreg[vsp++], &stack[a], vLen * sizeof(int));
+		break;
+	case vst:
+		--top;
+		a = display[i.u.addr.level] + i.u.addr.addr + vBase + stack[top];
+		if (end > 0 && (a < 0 || a + vLen > end))
+			return -1;
+		memcpy(&stack[a], vreg[--vsp], vLen * sizeof(int));
+		break;
+	case vbc:                         /* スカラーの値をすべての要素に広げる */
+		r = vreg[vsp++];
+		x = (unsigned)stack[--top];
+		for (k = 0; k < VECLEN; k++)
+			r[k] = x;
+		break;
+	case vop:
+		r = vreg[vsp - 1];
+		if (i.u.optr == neg) {
+			for (k = 0; k < VECLEN; k++)
+				r[k] = -r[k];
+			break;
+		}
+		s = r;
+		r = vreg[--vsp - 1];
+		switch (i.u.optr) {
+		case add:
+			for (k = 0; k < VECLEN; k++)
+				r[k] += s[k];
+			break;
+		case sub:
+			for (k = 0; k < VECLEN; k++)
+				r[k] -= s[k];
+			break;
+		case mul:
+			for (k = 0; k < VECLEN; k++)
+				r[k] *= s[k];
+			break;
+		default:
+			break;
+		}
+		break;
+	default:
+		break;
+	}
+	return top;
+}
+
+/* 仕事の文脈ctxから、実行するスレッドの領域をpwに入れる(NULLならワーカーの領域全体) */
+static void workArea(ParWork *pw, void *ctx)
+{
+	ParWork *c = ctx;
+	if (c != NULL) {
+		pw->base = c->base;
+		pw->end = c->end;
+	}
+	else {
+		pw->base = poolSelf() * MAXMEM;
+		pw->end = pw->base + MAXMEM;
+	}
+}
+
+static NOINLINE int vmCall(ParWork *w, int entry, int level, int args[], int nArgs);
+
+/* jobの繰り返しfrom..to-1を実行する(poolForから呼ぶ). インスタンスの中では
+   実行時の誤りになった繰り返しで止める */
+static void parIters(void *arg, void *ctx, long from, long to)
+{
+	ParJob *job = arg;
+	ParWork pw;
+	long k;
+	int v;
+	workArea(&pw, ctx);
+	pw.display = job->display;
+	pw.vm = job->vm;
+	for (k = from; k < to; k++) {
+		v = (int)(job->first + k * job->step);
+		if (job->vm == NULL)
+			run(parRun, job->stack, &pw, job->entry, job->level, &v, 1, 0, NULL);
+		else if (!vmCall(&pw, job->entry, job->level, &v, 1))
+			break;
+	}
+}
+
+/* pfor命令iを実行して新しいtopを返す. 積まれたループ変数の初めの値、終りの値(含まない)、
+   増分から繰り返しの数を求めてスレッドプールで実行し、ループ変数の最後の値を積む.
+   このスレッドの分はstack[top..end-1]で実行する.
+   ワーカーが実行した命令語は統計とプロファイルには数えない.
+   インスタンスvmの中では(ほかのインスタンスがスレッドを使うので)繰り返しを順に実行する */
+static NOINLINE int parFor(Inst i, int stack[], int display[], int top, int end, Vm *vm)
+{
+	ParJob job;
+	ParWork here;
+	long step = stack[top - 1], hi = stack[top - 2], lo = stack[top - 3], n = 0;
+
+	top -= 3;
+	if (step > 0 && hi > lo)
+		n = (hi - lo + step - 1) / step;
+	else if (step < 0 && hi < lo)
+		n = (lo - hi - step - 1) / -step;
+	job.stack = stack;
+	job.vm = vm;
+	memcpy(job.display, display, sizeof(job.display));
+	job.entry = i.u.addr.addr;
+	job.level = i.u.addr.level + 1;
+	job.first = lo;
+	job.step = step;
+	here.base = top;
+	here.end = end;
+	if (vm != NULL)
+		parIters(&job, &here, 0, n);
+	else
+		poolFor(n, parIters, &job, &here);
+	stack[top++] = (int)(lo + n * step);
+	return top;
+}
+
+/* スレッドごとの仕事にした関数呼び出しの表 */
+#define MAXTASKS 64              /* スレッドが待たずにおける仕事の数 */
+static THREAD_LOCAL SpawnTask tasks[MAXTASKS];    /* 積んだ仕事(積んだ順に使い、逆順に待つ) */
+static THREAD_LOCAL int nTasks;
+static THREAD_LOCAL SpawnTask *pend[MAXMEM];      /* spn命令ごとの仕事(calと同じに呼んだものはNULL) */
+static THREAD_LOCAL int nPend;   /* spn命令の値はオペランドにあるのでMAXMEMを越えない */
+
+/* 仕事にした関数呼び出しを実行する */
+static void spawnRun(PoolTask *t, void *ctx)
+{
+	SpawnTask *s = (SpawnTask *)t;
+	ParWork pw;
+	workArea(&pw, ctx);
+	pw.display = s->display;
+	run(parRun, s->stack, &pw, s->entry, s->level, s->args, s->nArgs, 0, &s->result);
+}
+
+/* spn命令iの呼び出しを仕事にしてスレッドプールに積み、値の場所を空けて新しいtopを返す.
+   仕事にしない(noSpawnが1:計数する、2:評価する(待ち合わせもしない)か、ほかのスレッドが
+   盗める仕事がまだある)ときはcalと同じにフレームを作って-1を返す(戻り番地はpc).
+   パラメタの数はverifyCodeが求めてある */
+static NOINLINE int spawnCall(Inst i, int stack[], int display[], int top, int pc, int noSpawn)
+{
+	SpawnTask *s = &tasks[nTasks];
+	int n = vPars[i.u.addr.addr], k, lev = i.u.addr.level + 1;
+
+	if (noSpawn || n < 0 || n > SPAWNARGS || nTasks == MAXTASKS || !poolIdle()) {
+		if (noSpawn < 2)
+			pend[nPend++] = NULL;
+		stack[top] = display[lev];
+		stack[top + 1] = pc; display[lev] = top;
+		return -1;
+	}
+	s->t.fn = spawnRun;
+	s->stack = stack;
+	memcpy(s->display, display, sizeof(s->display));
+	s->entry = i.u.addr.addr;
+	s->level = i.u.addr.level + 1;
+	s->nArgs = n;
+	for (k = 0; k < n; k++)
+		s->args[k] = stack[top - n + k];
+	if (!poolSpawn(&s->t)) {
+		pend[nPend++] = NULL;
+		stack[top] = display[lev];
+		stack[top + 1] = pc; display[lev] = top;
+		return -1;
+	}
+	nTasks++;
+	pend[nPend++] = s;
+	top -= n;
+	s->slot = top;
+	return top + 1;
+}
+
+/* syn命令: 最後のn個のspn命令の仕事を待って値を入れる. 待つあいだはstack[top..end-1]で
+   ほかの仕事を手伝う */
+static NOINLINE void joinCalls(int n, int stack[], int top, int end)
+{
+	SpawnTask *s;
+	ParWork here;
+	here.base = top;
+	here.end = end;
+	while (n-- > 0) {
+		if ((s = pend[--nPend]) == NULL)
+			continue;
+		poolJoin(&s->t, end - top >= MAXMEM / 4 ? &here : NULL);
+		stack[s->slot] = s->result;
+		nTasks--;
+	}
+}
+
+static char *opName[] = {
+	"lit", "opr", "lod", "sto", "cal", "ret", "ict", "jmp", "jpc",
+	"loda", "stoa", "retp", "cals", "ents", "rets", "shl", "shr", "msk",
+	"calm", "entm", "retm",
+	"vlp", "vlen", "vld", "vst", "vbc", "vop",
+	"pfor", "spn", "syn"
+};
+static char *optrName[] = {
+	"neg", "add", "sub", "mul", "div", "odd", "eq", "ls", "gr",
+	"neq", "lseq", "greq", "wrt", "wrl"
+};
 
 /* 次の命令語のアドレスを返す */
 int nextCode()
@@ -32,6 +367,63 @@ int nextCode()
 	return cIndex + 1;
 }
 
+/* 番地iの命令語(最適化用) */
+Inst *codeAt(int i)
+{
+	return &code[i];
+}
+
+/* dead[i]が真の命令語を取り除いて詰め、飛び先と呼び出し先を付け替える.
+   newAddr[i](0<=i<=nextCode())には新しい番地を返す(取り除いた命令語は次に残る命令語の番地) */
+void removeCode(char dead[], int newAddr[])
+{
+	int i, k = 0;
+	for (i = 0; i <= cIndex; i++) {
+		newAddr[i] = k;
+		if (!dead[i])
+			k++;
+	}
+	newAddr[cIndex + 1] = k;
+	for (i = 0; i <= cIndex; i++) {
+		if (dead[i])
+			continue;
+		switch (code[i].opCode) {
+		case jmp:
+		case jpc:
+			code[i].u.value = newAddr[code[i].u.value];
+			break;
+		case cal:
+		case cals:
+		case calm:
+		case pfor:
+		case spn:
+			code[i].u.addr.addr = newAddr[code[i].u.addr.addr];
+			break;
+		default:
+			break;
+		}
+		code[newAddr[i]] = code[i];
+		lineOf[newAddr[i]] = lineOf[i];
+	}
+	cIndex = k - 1;
+}
+
+/* 番地fromからtoの前までの命令語を後ろに写し、その範囲の中へのjmp, jpcの飛び先を
+   写した先へ付け替える. 写した先頭の番地を返す(入りきらなければ-1) */
+int copyCode(int from, int to)
+{
+	int i, d = cIndex + 1 - from;
+	if (cIndex + 1 + (to - from) > MAXCODE)
+		return -1;
+	for (i = from; i < to; i++) {
+		code[++cIndex] = code[i];
+		lineOf[cIndex] = lineOf[i];
+		if ((code[i].opCode == jmp || code[i].opCode == jpc) && from <= code[i].u.value && code[i].u.value < to)
+			code[cIndex].u.value += d;
+	}
+	return from + d;
+}
+
 /* 命令語の生成、アドレス部にv */
 int genCodeV(OpCode op, int v)
 {
@@ -41,12 +433,12 @@ int genCodeV(OpCode op, int v)
 	return cIndex;
 }
 
-/* 命令語の生成、アドレスは名前表から */
-int genCodeT(OpCode op, int ti)
+/* 命令語の生成、アドレス部にa */
+int genCodeA(OpCode op, RelAddr a)
 {
 	checkMax();
 	code[cIndex].opCode = op;
-	code[cIndex].u.addr = relAddr(ti);
+	code[cIndex].u.addr = a;
 	return cIndex;
 }
 
@@ -59,27 +451,35 @@ int genCodeO(Operator p)
 	return cIndex;
 }
 
-/* ret命令語の生成 */
-int genCodeR(int forProc)
+/* ret命令語の生成(levelはブロックのレベル、parsはパラメタ数) */
+int genCodeR(int forProc, int level, int pars)
 {
 	/* 直前がretなら生成せず */
 	if (code[cIndex].opCode == ret)
 		return cIndex;
 	checkMax();
 	code[cIndex].opCode = forProc ? retp : ret;
-	code[cIndex].u.addr.level = bLevel();
-	code[cIndex].u.addr.addr = fPars();    /* パラメタ数(実行スタックの解放用)*/
+	code[cIndex].u.addr.level = level;
+	code[cIndex].u.addr.addr = pars;    /* パラメタ数(実行スタックの解放用)*/
 	return cIndex;
 }
 
 /* 目的コードのインデックスの増加とチェック */
 void checkMax()
 {
-	if (++cIndex < MAXCODE)
+	if (++cIndex < MAXCODE) {
+		lineOf[cIndex] = codeLine;
 		return;
+	}
 	errorF("too many code");
 }
 
+/* 以後に生成する命令語に対応するソースの行をセット */
+void setCodeLine(int line)
+{
+	codeLine = line;
+}
+
 /* 命令語のバックパッチ(次の番地を) */
 void backPatch(int i)
 {
@@ -101,7 +501,7 @@ void listCode()
 			printf("L%3.3d: ", i);
 		else
 			printf("      ");
-		printCode(i);
+		printCode(stdout, i);
 	}
 }
 
@@ -122,6 +522,24 @@ void updateRef(int i)
 	case loda: flag = 2; break;
 	case stoa: flag = 2; break;
 	case retp: flag = 2; break;
+	case cals: flag = 5; break;
+	case ents: flag = 2; break;
+	case rets: flag = 2; break;
+	case shl: flag = 1; break;
+	case shr: flag = 1; break;
+	case msk: flag = 1; break;
+	case calm: flag = 5; break;
+	case entm: flag = 2; break;
+	case retm: flag = 2; break;
+	case vlp: flag = 1; break;
+	case vlen: flag = 1; break;
+	case vld: flag = 2; break;
+	case vst: flag = 2; break;
+	case vbc: flag = 1; break;
+	case vop: flag = 1; break;
+	case pfor: flag = 5; break;
+	case spn: flag = 5; break;
+	case syn: flag = 1; break;
 	}
 	switch(flag) {
 	case 1:
@@ -156,73 +574,603 @@ void updateRef(int i)
 }
 
 /* 命令語の印字 */
-void printCode(int i)
+void printCode(FILE *fp, int i)
 {
 	int flag;
 	switch(code[i].opCode) {
-	case lit: printf("lit"); flag = 1; break;
-	case opr: printf("opr"); flag = 3; break;
-	case lod: printf("lod"); flag = 2; break;
-	case sto: printf("sto"); flag = 2; break;
-	case cal: printf("cal"); flag = 5; break;
-	case ret: printf("ret"); flag = 2; break;
-	case ict: printf("ict"); flag = 1; break;
-	case jmp: printf("jmp"); flag = 4; break;
-	case jpc: printf("jpc"); flag = 4; break;
-	case loda: printf("loda"); flag = 2; break;
-	case stoa: printf("stoa"); flag = 2; break;
-	case retp: printf("retp"); flag = 2; break;
+	case lit: fprintf(fp, "lit"); flag = 1; break;
+	case opr: fprintf(fp, "opr"); flag = 3; break;
+	case lod: fprintf(fp, "lod"); flag = 2; break;
+	case sto: fprintf(fp, "sto"); flag = 2; break;
+	case cal: fprintf(fp, "cal"); flag = 5; break;
+	case ret: fprintf(fp, "ret"); flag = 2; break;
+	case ict: fprintf(fp, "ict"); flag = 1; break;
+	case jmp: fprintf(fp, "jmp"); flag = 4; break;
+	case jpc: fprintf(fp, "jpc"); flag = 4; break;
+	case loda: fprintf(fp, "loda"); flag = 2; break;
+	case stoa: fprintf(fp, "stoa"); flag = 2; break;
+	case retp: fprintf(fp, "retp"); flag = 2; break;
+	case cals: fprintf(fp, "cals"); flag = 5; break;
+	case ents: fprintf(fp, "ents"); flag = 2; break;
+	case rets: fprintf(fp, "rets"); flag = 2; break;
+	case shl: fprintf(fp, "shl"); flag = 1; break;
+	case shr: fprintf(fp, "shr"); flag = 1; break;
+	case msk: fprintf(fp, "msk"); flag = 1; break;
+	case calm: fprintf(fp, "calm"); flag = 5; break;
+	case entm: fprintf(fp, "entm"); flag = 2; break;
+	case retm: fprintf(fp, "retm"); flag = 2; break;
+	case vlp: fprintf(fp, "vlp"); flag = 1; break;
+	case vlen: fprintf(fp, "vlen"); flag = 1; break;
+	case vld: fprintf(fp, "vld"); flag = 2; break;
+	case vst: fprintf(fp, "vst"); flag = 2; break;
+	case vbc: fprintf(fp, "vbc"); flag = 1; break;
+	case vop: fprintf(fp, "vop"); flag = 3; break;
+	case pfor: fprintf(fp, "pfor"); flag = 5; break;
+	case spn: fprintf(fp, "spn"); flag = 5; break;
+	case syn: fprintf(fp, "syn"); flag = 1; break;
 	}
 	switch(flag) {
 	case 1:
-		printf(",%d\n", code[i].u.value);
+		fprintf(fp, ",%d\n", code[i].u.value);
 		return;
 	case 2:
-		printf(",%d", code[i].u.addr.level);
-		printf(",%d\n", code[i].u.addr.addr);
+		fprintf(fp, ",%d", code[i].u.addr.level);
+		fprintf(fp, ",%d\n", code[i].u.addr.addr);
 		return;
 	case 3:
 		switch(code[i].u.optr) {
-		case neg: printf(",neg\n"); return;
-		case add: printf(",add\n"); return;
-		case sub: printf(",sub\n"); return;
-		case mul: printf(",mul\n"); return;
-		case div: printf(",div\n"); return;
-		case odd: printf(",odd\n"); return;
-		case eq: printf(",eq\n"); return;
-		case ls: printf(",ls\n"); return;
-		case gr: printf(",gr\n"); return;
-		case neq: printf(",neq\n"); return;
-		case lseq: printf(",lseq\n"); return;
-		case greq: printf(",greq\n"); return;
-		case wrt: printf(",wrt\n"); return;
-		case wrl: printf(",wrl\n"); return;
+		case neg: fprintf(fp, ",neg\n"); return;
+		case add: fprintf(fp, ",add\n"); return;
+		case sub: fprintf(fp, ",sub\n"); return;
+		case mul: fprintf(fp, ",mul\n"); return;
+		case div: fprintf(fp, ",div\n"); return;
+		case odd: fprintf(fp, ",odd\n"); return;
+		case eq: fprintf(fp, ",eq\n"); return;
+		case ls: fprintf(fp, ",ls\n"); return;
+		case gr: fprintf(fp, ",gr\n"); return;
+		case neq: fprintf(fp, ",neq\n"); return;
+		case lseq: fprintf(fp, ",lseq\n"); return;
+		case greq: fprintf(fp, ",greq\n"); return;
+		case wrt: fprintf(fp, ",wrt\n"); return;
+		case wrl: fprintf(fp, ",wrl\n"); return;
 		}
 	case 4:
-		printf(",L%3.3d\n", code[i].u.value);
+		fprintf(fp, ",L%3.3d\n", code[i].u.value);
 		return;
 	case 5:
-		printf(",%d", code[i].u.addr.level);
-		printf(",L%3.3d\n", code[i].u.addr.addr);
+		fprintf(fp, ",%d", code[i].u.addr.level);
+		fprintf(fp, ",L%3.3d\n", code[i].u.addr.addr);
 		return;
 	}
 }
 
+/* 目的コードの検査に使う表 */
+static int stackNeed[MAXCODE];   /* stackNeed[e]は入口eのブロックが積むオペランドの最大数 */
+static int opNeed;               /* 静的でないフレームの上に積むオペランドの数の最大値 */
+static int vDepth[MAXCODE];      /* 命令語を実行する前のオペランドの数 */
+static int vVec[MAXCODE];        /* 命令語を実行する前のベクトルレジスタの数 */
+static int vMark[MAXCODE];       /* ブロックをたどったときの印 */
+static int vSeen[MAXCODE];       /* 戻り方を調べたときの印 */
+static int vWork[MAXCODE];       /* たどる命令語(入れ子に調べるブロックの分は上に積む) */
+static int nWork, vStamp;
+static int vRes[MAXCODE];        /* 入口eのブロックが返す値の数(戻らなければ-1) */
+static char vState[MAXCODE];     /* 入口eのブロックを 1:調べている 2:調べた 3:調べる予定 */
+static char vSig[MAXCODE];       /* vPars, vResを求めたか */
+static int todo[MAXCODE], nTodo; /* 調べる予定のブロック */
+
+/* 目的コードの誤りを報告してコンパイルを終える */
+static void badCode(int p, char *m)
+{
+	char buf[80];
+	sprintf(buf, "bad code at L%3.3d: %s", p, m);
+	errorF(buf);
+}
+
+/* 命令語pから飛ぶかそのまま進む先qを、たどる命令語に入れる(戻り方を調べるとき) */
+static void reach(int p, int q, int stamp)
+{
+	if (q < 0 || q > cIndex)
+		badCode(p, "control leaves the code");
+	if (vSeen[q] == stamp)
+		return;
+	if (nWork >= MAXCODE)
+		badCode(p, "code too complex to verify");
+	vSeen[q] = stamp;
+	vWork[nWork++] = q;
+}
+
+/* 命令語pから飛ぶかそのまま進む先qを、オペランドの数d、ベクトルレジスタの数vdでたどる命令語に入れる */
+static void flow(int p, int q, int d, int vd, int stamp)
+{
+	if (q < 0 || q > cIndex)
+		badCode(p, "control leaves the code");
+	if (vMark[q] == stamp) {
+		if (vDepth[q] != d || vVec[q] != vd)
+			badCode(q, "operand stack depth differs at a merge");
+		return;
+	}
+	if (nWork >= MAXCODE)
+		badCode(p, "code too complex to verify");
+	vMark[q] = stamp;
+	vDepth[q] = d;
+	vVec[q] = vd;
+	vWork[nWork++] = q;
+}
+
+/* 入口eの(静的でない)ブロックが戻るときに取り除くパラメタの数と返す値の数を
+   ret, retp, retm命令から求める */
+static void signature(int e)
+{
+	int base = nWork, stamp = ++vStamp, p, pars = -1, res = -1, k;
+	Inst *c;
+	reach(e, e + 1, stamp);
+	while (nWork > base) {
+		p = vWork[--nWork];
+		c = &code[p];
+		switch (c->opCode) {
+		case ret:
+		case retm:
+		case retp:
+			k = c->opCode != retp;
+			if (pars >= 0 && (pars != c->u.addr.addr || res != k))
+				badCode(p, "returns disagree");
+			pars = c->u.addr.addr;
+			res = k;
+			continue;
+		case jmp:
+			reach(p, c->u.value, stamp);
+			continue;
+		case jpc:
+			reach(p, c->u.value, stamp);
+			break;
+		case ict:
+		case ents:
+		case entm:
+		case rets:
+			continue;                   /* 誤りはverifyBlockで報告する */
+		default:
+			break;
+		}
+		reach(p, p + 1, stamp);
+	}
+	vPars[e] = pars;
+	vRes[e] = res;
+	vSig[e] = 1;
+}
+
+/* 入口e(ict, ents, entm)のブロックを命令語の順にたどって、取り出すオペランドがあること、
+   合流する場所でオペランドの数が同じことを確かめ、オペランドの最大数stackNeed[e]を求める.
+   静的なフレームのブロック(ents)は、呼び出し元のオペランドの上で実行するので先に調べる */
+static void verifyBlock(int e, int isMain)
+{
+	int base = nWork, stamp = ++vStamp, p, d, vd, t, pop, push, vpop, vpush, next, jumps, use, max = 0, res = -2;
+	OpCode kind = code[e].opCode;
+	Inst *c;
+
+	vState[e] = 1;
+	flow(e, e + 1, 0, 0, stamp);
+	while (nWork > base) {
+		p = vWork[--nWork];
+		c = &code[p];
+		d = vDepth[p];
+		vd = vVec[p];
+		pop = push = vpop = vpush = 0;
+		next = 1;
+		jumps = 0;
+		use = 0;
+		switch (c->opCode) {
+		case lit:
+			push = 1; break;
+		case lod:
+			if (c->u.addr.level < 0 || c->u.addr.level >= MAXLEVEL)
+				badCode(p, "bad level");
+			push = 1; break;
+		case sto:
+			if (c->u.addr.level < 0 || c->u.addr.level >= MAXLEVEL)
+				badCode(p, "bad level");
+			pop = 1; break;
+		case loda:
+			if (c->u.addr.level < 0 || c->u.addr.level >= MAXLEVEL)
+				badCode(p, "bad level");
+			pop = push = 1; break;
+		case stoa:
+			if (c->u.addr.level < 0 || c->u.addr.level >= MAXLEVEL)
+				badCode(p, "bad level");
+			pop = 2; break;
+		case shl:
+		case shr:
+		case msk:
+			pop = push = 1; break;
+		case opr:
+			switch (c->u.optr) {
+			case neg: case odd: pop = push = 1; break;
+			case add: case sub: case mul: case div:
+			case eq: case ls: case gr: case neq: case lseq: case greq:
+				pop = 2; push = 1; break;
+			case wrt: pop = 1; break;
+			case wrl: break;
+			default: badCode(p, "unknown operator");
+			}
+			break;
+		case jmp:
+			next = 0; jumps = 1; break;
+		case jpc:
+			pop = 1; jumps = 1; break;
+		case cal:
+		case calm:
+		case spn:
+			t = c->u.addr.addr;
+			if (t < 0 || t > cIndex || code[t].opCode != (c->opCode == calm ? entm : ict))
+				badCode(p, "call to a non-entry");
+			if (c->u.addr.level < 0 || c->u.addr.level + 1 >= MAXLEVEL)
+				badCode(p, "bad level");
+			if (!vSig[t])
+				signature(t);
+			if (c->opCode == calm && vPars[t] >= 0 && vPars[t] != code[t].u.addr.level)
+				badCode(p, "parameter count disagrees");
+			if (c->opCode == spn && vRes[t] >= 0 && vRes[t] != 1)
+				badCode(p, "spawned call of a procedure");
+			if (vState[t] == 0) {
+				vState[t] = 3;
+				todo[nTodo++] = t;
+			}
+			use = d + 2;                    /* ディスプレイの退避場所と戻り番地 */
+			if (vRes[t] < 0)
+				next = 0;                   /* 戻らない */
+			else {
+				pop = vPars[t];
+				push = vRes[t];
+			}
+			break;
+		case pfor:
+			t = c->u.addr.addr;
+			if (t < 0 || t > cIndex || code[t].opCode != ict)
+				badCode(p, "call to a non-entry");
+			if (c->u.addr.level < 0 || c->u.addr.level + 1 >= MAXLEVEL)
+				badCode(p, "bad level");
+			if (!vSig[t])
+				signature(t);
+			if (vRes[t] >= 0 && (vRes[t] != 0 || vPars[t] != 1))
+				badCode(p, "loop body of pfor is not a procedure of one parameter");
+			if (vState[t] == 0) {
+				vState[t] = 3;
+				todo[nTodo++] = t;
+			}
+			pop = 3;                        /* 初めの値、終りの値、増分 */
+			push = 1;                       /* ループ変数の最後の値 */
+			break;
+		case syn:
+			if (c->u.value < 1 || c->u.value > d)
+				badCode(p, "bad number of spawned calls");    /* 待つ仕事の値の場所はオペランドにある */
+			break;
+		case cals:
+			t = c->u.addr.addr;
+			if (t < 0 || t > cIndex || code[t].opCode != ents)
+				badCode(p, "call to a non-entry");
+			if (vState[t] == 1)
+				badCode(p, "recursive call of a static frame");
+			if (vState[t] != 2)
+				verifyBlock(t, 0);
+			pop = code[t].u.addr.level;
+			if (d < pop)
+				badCode(p, "operand stack underflow");
+			use = d - pop + stackNeed[t];   /* 呼び出し先は実引数を除いたオペランドの上で実行する */
+			if (vRes[t] < 0)
+				next = 0;
+			else
+				push = vRes[t];
+			break;
+		case ret:
+		case retm:
+			if (kind == ents || (kind == ict) != (c->opCode == ret))
+				badCode(p, "return does not match the entry");
+			if (d != 1 && !(isMain && d == 0))    /* 主ブロックのretは局所変数を一つ読み捨てる */
+				badCode(p, "operand stack depth at return");
+			next = 0;
+			break;
+		case retp:
+			if (kind != ict)
+				badCode(p, "return does not match the entry");
+			if (d != 0)
+				badCode(p, "operand stack depth at return");
+			next = 0;
+			break;
+		case rets:
+			if (kind != ents)
+				badCode(p, "return does not match the entry");
+			if (d > 1 || (res >= 0 && d != res))
+				badCode(p, "operand stack depth at return");
+			res = d;
+			next = 0;
+			break;
+		case vlp:
+			if (vd != 0)
+				badCode(p, "vector registers in use");
+			pop = 2; push = 1; break;
+		case vlen:
+			push = 1; break;
+		case vld:
+		case vst:
+			if (c->u.addr.level < 0 || c->u.addr.level >= MAXLEVEL)
+				badCode(p, "bad level");
+			pop = 1;
+			if (c->opCode == vld)
+				vpush = 1;
+			else
+				vpop = 1;
+			break;
+		case vbc:
+			pop = 1; vpush = 1; break;
+		case vop:
+			switch (c->u.optr) {
+			case neg: vpop = vpush = 1; break;
+			case add: case sub: case mul: vpop = 2; vpush = 1; break;
+			default: badCode(p, "unknown operator");
+			}
+			break;
+		case ict:
+		case ents:
+		case entm:
+			badCode(p, "jump into another block");
+			break;
+		default:
+			badCode(p, "unknown instruction");
+		}
+		if (vd < vpop)
+			badCode(p, "vector register underflow");
+		vd += vpush - vpop;
+		if (vd > VECDEPTH)
+			badCode(p, "too many vector registers");
+		if (vd > 0 && c->opCode != vld && c->opCode != vst && c->opCode != vbc && c->opCode != vop
+				&& c->opCode != lit && c->opCode != lod && c->opCode != opr && c->opCode != loda
+				&& c->opCode != shl && c->opCode != shr && c->opCode != msk)
+			badCode(p, "vector registers in use");    /* 飛び越し、呼び出し、戻りをまたいでは使わない */
+		if (d < pop)
+			badCode(p, "operand stack underflow");
+		d += push - pop;
+		if (use < d)
+			use = d;
+		if (use > max)
+			max = use;
+		if (next)
+			flow(p, p + 1, d, vd, stamp);
+		if (jumps)
+			flow(p, c->u.value, d, vd, stamp);
+	}
+	if (kind == ents) {
+		vPars[e] = code[e].u.addr.level;
+		vRes[e] = res >= 0 ? res : -1;
+	}
+	stackNeed[e] = max;
+	if (kind != ents && max > opNeed)
+		opNeed = max;
+	vState[e] = 2;
+}
+
+/* 目的コードの検査. 番地0から実行しうるブロックごとに、飛び先が目的コードの中にあること、
+   取り出すオペランドがあること、合流する場所でオペランドの数が同じこと、呼び出し先の
+   入口の命令語と戻り方が合うこと(pfor命令の繰り返しはパラメタが一つの手続き、spn命令で
+   呼ぶのは関数)、syn命令が待つ仕事の数がオペランドの数を越えないこと、
+   ベクトルレジスタがVECDEPTH個を越えず、飛び越しや呼び出しをまたいで使われないことを
+   確かめ、誤りがあればコンパイルを終える.
+   ブロックのオペランドの最大数(静的なフレームの呼び出し先の分を含む)を求めておき、
+   実行ではict, entm命令でフレームをとるときに、その最大数の分も含めて一度だけ溢れを調べる */
+void verifyCode()
+{
+	int p = 0, k;
+	for (k = 0; k <= cIndex && p >= 0 && p <= cIndex && code[p].opCode == jmp; k++)
+		p = code[p].u.value;
+	if (p < 0 || p > cIndex || code[p].opCode != ict)
+		badCode(0, "no main block");
+	nWork = nTodo = opNeed = 0;
+	verifyBlock(p, 1);
+	while (nTodo > 0)
+		if (vState[p = todo[--nTodo]] != 2)
+			verifyBlock(p, 0);
+}
+
 /* 目的コード(命令語)の実行 */
 void execute()
 {
-	int stack[MAXMEM];        /* 実行時スタック */
+	int i;
+	int stack[MAXMEM * MAXTHREADS];    /* 実行時スタック(並列のforのスレッドw>0はw*MAXMEMからの領域を使う) */
+	printf("; start execution\n");
+	/* 統計もプロファイルもとらないときは計数のない実行ループを使う */
+	if (statsMode == noStats && profTop == 0 && !heatMode) {
+		if (memoMode)
+			run(memoRun, stack, NULL, 0, 0, NULL, 0, 0, NULL);
+		else
+			run(plainRun, stack, NULL, 0, 0, NULL, 0, 0, NULL);
+		return;
+	}
+	for (i = 0; i <= cIndex; i++)
+		keyOf[i] = code[i].opCode == opr ? end_of_OpCode + code[i].u.optr : code[i].opCode;
+	run(countRun, stack, NULL, 0, 0, NULL, 0, 0, NULL);
+}
+
+/* 番地entryから始まるレベルlevelの関数を実引数args[0..nArgs-1]で呼んだときの値を
+   *resultに求める. 実行する命令語の数がlimitを越えるか、実行時の誤りになれば0を返す.
+   関数はそのレベルの変数だけを読み書きし、出力しないものとする(最適化用) */
+int evalCall(int entry, int level, int args[], int nArgs, long limit, int *result)
+{
+	int stack[MAXMEM];
+	return run(evalRun, stack, NULL, entry, level, args, nArgs, limit, result);
+}
+
+/* 目的コードc[0..nCode-1]を写した仮想機械のインスタンスを作る(cがNULLなら今の
+   目的コードとverifyCodeが求めたオペランドの数). 作れなければNULLを返す */
+Vm *vmNew(Inst c[], int nCode, int need)
+{
+	Vm *v = calloc(1, sizeof(Vm));
+	if (c == NULL) {
+		c = code;
+		nCode = cIndex + 1;
+		need = opNeed;
+	}
+	if (v == NULL || (v->code = calloc(nCode > 0 ? nCode : 1, sizeof(Inst))) == NULL) {
+		free(v);
+		return NULL;
+	}
+	memcpy(v->code, c, nCode * sizeof(Inst));
+	v->nCode = nCode;
+	v->opNeed = need;
+	return v;
+}
+
+void vmFree(Vm *v)
+{
+	if (v == NULL)
+		return;
+	free(v->code);
+	free(v->out);
+	free(v);
+}
+
+/* インスタンスvの実行を状態statusで止める(実行ループの値として0を返す) */
+static int vmError(Vm *v, int status)
+{
+	v->status = status;
+	return 0;
+}
+
+/* インスタンスvの出力のバッファにfmtでvalueを書く. 書けなければ0を返す
+   (実行ループのレジスタを使わないように展開しない) */
+static NOINLINE int vmPrint(Vm *v, char *fmt, int value)
+{
+	char buf[16];
+	char *p;
+	int n = sprintf(buf, fmt, value), m;
+	if (v->outLen + n > v->outMax) {
+		m = v->outMax ? v->outMax * 2 : 256;
+		while (m < v->outLen + n)
+			m *= 2;
+		if ((p = realloc(v->out, m)) == NULL)
+			return vmError(v, vmNoMemory);
+		v->out = p;
+		v->outMax = m;
+	}
+	memcpy(v->out + v->outLen, buf, n);
+	v->outLen += n;
+	return 1;
+}
+
+/* インスタンスvがまだ実行してよい命令語の数 */
+static long vmBudget(Vm *v)
+{
+	return v->stepMax > 0 ? v->stepMax - v->steps : LONG_MAX;
+}
+
+/* インスタンスw->vmで番地entryのレベルlevelのブロックを実引数args[0..nArgs-1]で呼ぶ
+   (w->displayがNULLなら主ブロックから実行する). 実行時の誤りになれば0を返す */
+static NOINLINE int vmCall(ParWork *w, int entry, int level, int args[], int nArgs)
+{
+	return run(vmRun, w->vm->stack, w, entry, level, args, nArgs, vmBudget(w->vm), NULL);
+}
+
+/* インスタンスvを実行して状態(VmStatus)を返す. 実行時スタックと値を覚えておく表は
+   実行するあいだだけ持つ(同時に実行しているインスタンスの分しか記憶を使わない).
+   初期化していない変数は0とする */
+int vmExecute(Vm *v)
+{
+	ParWork w;
+	int k, memoing = 0;
+	for (k = 0; k < v->nCode; k++)
+		if (v->code[k].opCode == calm)
+			memoing = 1;
+	v->status = vmOk;
+	v->outLen = 0;
+	v->steps = 0;
+	v->stack = calloc(MAXMEM, sizeof(int));
+	v->memo = memoing ? calloc(MEMOSIZE, sizeof(Memo)) : NULL;
+	if (v->stack == NULL || (memoing && v->memo == NULL))
+		v->status = vmNoMemory;
+	else {
+		w.display = NULL;
+		w.base = 0;
+		w.end = MAXMEM;
+		w.vm = v;
+		vmCall(&w, 0, 0, NULL, 0);
+	}
+	free(v->stack);
+	free(v->memo);
+	v->stack = NULL;
+	v->memo = NULL;
+	return v->status;
+}
+
+/* 状態statusの説明 */
+char *vmMessage(int status)
+{
+	switch (status) {
+	case vmOk: return "ok";
+	case vmOverflow: return "stack overflow";
+	case vmDivide: return "division by zero";
+	case vmRange: return "array index out of range";
+	case vmSteps: return "step limit exceeded";
+	case vmNoMemory: return "out of memory";
+	}
+	return "unknown status";
+}
+
+/* 実行ループ(modeは定数で呼ぶので、計数や評価の処理は展開先ごとに消える) */
+int run(RunMode mode, int stack[], ParWork *w, int entry, int level, int args[], int nArgs, long limit, int *result)
+{
 	int display[MAXLEVEL];    /* 現在見える各ブロックの先頭番地のディスプレイ */
 	int pc, top, lev, temp;
 	Inst i;                   /* 実行する命令語 */
+	RelAddr a;
+	long steps = 0, calls = 0, memoCalls = 0, memoHits = 0;
+	int maxTop = 0;
+	int key, prevKey = NKEY;
+	int counting = mode == countRun;
+	int memoing = mode == memoRun || mode == vmRun || counting;    /* calm, entm, retm命令を実行するか */
+	int end = mode == parRun || mode == vmRun ? w->end : MAXMEM;    /* 使える実行時スタックの終り */
+	int topMax = end - (mode == vmRun ? w->vm->opNeed : opNeed);    /* フレームをとったあとのtopの上限(オペランドはverifyCodeで求めた数までしか積まない) */
+	Inst *insts = mode == vmRun ? w->vm->code : code;    /* 実行する目的コード */
+	Memo *tab = mode == vmRun ? w->vm->memo : memo;       /* 関数の値を覚えておく表 */
 
-	printf("; start execution\n");
 	top = 0;  pc = 0;               /* top:次にスタックに入れる場所、pc:命令語のカウンタ */
-	stack[0] = 0;  stack[1] = 0;    /* stack[top]はcalleeで壊すディスプレイの退避場所 stack[top+1]はcallerへの戻り番地 */
-	display[0] = 0;                 /* 主ブロックの先頭番地は 0 */
+	if (mode == parRun || (mode == vmRun && w->display != NULL)) {    /* 番地0から繰り返しの手続きや関数を呼んだことにする */
+		for (lev = 0; lev < MAXLEVEL; lev++)
+			display[lev] = w->display[lev];
+		top = w->base;
+		for (temp = 0; temp < nArgs; temp++)
+			stack[top++] = args[temp];
+		stack[top] = 0;  stack[top + 1] = 0;
+		display[level] = top;
+		pc = entry;
+	}
+	else {
+		stack[0] = 0;  stack[1] = 0;    /* stack[top]はcalleeで壊すディスプレイの退避場所 stack[top+1]はcallerへの戻り番地 */
+		display[0] = 0;                 /* 主ブロックの先頭番地は 0 */
+	}
+	if (mode == evalRun) {          /* 番地0から呼んだことにする(retで番地0へ戻ると終わる) */
+		if (level <= 0 || level >= MAXLEVEL || nArgs + 2 >= MAXMEM)
+			return 0;
+		for (lev = 1; lev < MAXLEVEL; lev++)
+			display[lev] = 0;
+		for (top = 0; top < nArgs; top++)
+			stack[top] = args[top];
+		stack[top] = 0;  stack[top + 1] = 0;
+		display[level] = top;
+		pc = entry;
+	}
 
 	do {
-		i = code[pc++];    /* これから実行する命令語 */
+		if (mode == evalRun && (++steps > limit || top >= MAXMEM - 2))    /* 命令語は二つまでしか積まない */
+			return 0;
+		if (mode == vmRun && ++steps > limit)    /* インスタンスの命令語の数の上限(limitは残りの数) */
+			return vmError(w->vm, vmSteps);
+		if (counting) {
+			steps++;
+			if (top > maxTop)
+				maxTop = top;
+			execCount[pc]++;
+			key = keyOf[pc];
+			pairCount[prevKey][key]++;
+			prevKey = key;
+		}
+		i = insts[pc++];    /* これから実行する命令語 */
 		switch(i.opCode) {
 		case lit:
 			stack[top++] = i.u.value;
@@ -234,6 +1182,8 @@ void execute()
 			stack[display[i.u.addr.level] + i.u.addr.addr] = stack[--top];
 			break;
 		case cal:
+			if (counting)
+				calls++;
 			lev = i.u.addr.level + 1;                     /* i.u.addr.levelはcalleeの名前のレベル calleeのブロックのレベルlevはそれに+1したもの */
 			stack[top] = display[lev];                    /* display[lev]の退避 */
 			stack[top + 1] = pc; display[lev] = top;        /* 現在のtopがcalleeのブロックの先頭番地 */
@@ -248,9 +1198,18 @@ void execute()
 			stack[top++] = temp;                          /* 返す値をスタックのトップへ */
 			break;
 		case ict:
+			if (mode == evalRun) {       /* 初期化していない局所変数を読んでも評価の結果が決まるように */
+				if (top + i.u.value >= MAXMEM)
+					return 0;
+				for (temp = 2; temp < i.u.value; temp++)
+					stack[top + temp] = 0;
+			}
 			top += i.u.value;
-			if (top >= MAXMEM - MAXREG)
+			if (top > topMax) {
+				if (mode == vmRun)
+					return vmError(w->vm, vmOverflow);
 				errorF("stack overflow");
+			}
 			break;
 		case jmp:
 			pc = i.u.value; break;
@@ -264,7 +1223,14 @@ void execute()
 			case add: --top;  stack[top - 1] += stack[top]; continue;
 			case sub: --top; stack[top - 1] -= stack[top]; continue;
 			case mul: --top;  stack[top - 1] *= stack[top];  continue;
-			case div: --top;  stack[top - 1] /= stack[top]; continue;
+			case div:
+				--top;
+				if (mode == evalRun && stack[top] == 0)
+					return 0;
+				if (mode == vmRun && stack[top] == 0)
+					return vmError(w->vm, vmDivide);
+				stack[top - 1] /= stack[top];
+				continue;
 			case odd: stack[top - 1] = stack[top - 1] & 1; continue;
 			case eq: --top;  stack[top - 1] = (stack[top - 1] == stack[top]); continue;
 			case ls: --top;  stack[top - 1] = (stack[top - 1] < stack[top]); continue;
@@ -272,15 +1238,43 @@ void execute()
 			case neq: --top;  stack[top - 1] = (stack[top - 1] != stack[top]); continue;
 			case lseq: --top;  stack[top - 1] = (stack[top - 1] <= stack[top]); continue;
 			case greq: --top;  stack[top - 1] = (stack[top - 1] >= stack[top]); continue;
-			case wrt: printf("%d ", stack[--top]); continue;
-			case wrl: printf("\n"); continue;
+			case wrt:
+				if (mode == evalRun)
+					return 0;
+				if (mode == vmRun) {
+					if (!vmPrint(w->vm, "%d ", stack[--top]))
+						return 0;
+					continue;
+				}
+				printf("%d ", stack[--top]);
+				continue;
+			case wrl:
+				if (mode == evalRun)
+					return 0;
+				if (mode == vmRun) {
+					if (!vmPrint(w->vm, "\n", 0))
+						return 0;
+					continue;
+				}
+				printf("\n");
+				continue;
 			}
 		case loda:
-			stack[top - 1] = stack[display[i.u.addr.level] + i.u.addr.addr + stack[top - 1]];
+			temp = display[i.u.addr.level] + i.u.addr.addr + stack[top - 1];
+			if (mode == evalRun && (temp < 0 || temp >= top - 1))    /* 配列の範囲外 */
+				return 0;
+			if (mode == vmRun && (temp < 0 || temp >= end))        /* 実行時スタックの外 */
+				return vmError(w->vm, vmRange);
+			stack[top - 1] = stack[temp];
 			break;
 		case stoa:
-			--top;
-			stack[display[i.u.addr.level] + i.u.addr.addr + stack[top - 1]] = stack[top--];
+			top -= 2;                                     /* stack[top]が添字、stack[top + 1]が代入する値 */
+			temp = display[i.u.addr.level] + i.u.addr.addr + stack[top];
+			if (mode == evalRun && (temp < 0 || temp >= top))
+				return 0;
+			if (mode == vmRun && (temp < 0 || temp >= end))
+				return vmError(w->vm, vmRange);
+			stack[temp] = stack[top + 1];
 			break;
 		case retp:
 			top = display[i.u.addr.level];                /* topを呼ばれたときの値に戻す */
@@ -288,6 +1282,214 @@ void execute()
 			pc = stack[top + 1];
 			top -= i.u.addr.addr;                         /* 実引数の分だけトップを戻す */
 			break;
+		case cals:                                        /* 静的なフレームを持つcalleeの呼び出し */
+			if (counting)
+				calls++;
+			a = insts[i.u.addr.addr].u.addr;              /* 呼び出し先のents命令のパラメタ数とパラメタの番地 */
+			top -= a.level;
+			for (lev = 0; lev < a.level; lev++)           /* 実引数をパラメタへ移す */
+				stack[a.addr + lev] = stack[top + lev];
+			stack[a.addr + a.level + 1] = pc;             /* 戻り番地はフレームの1番地へ */
+			pc = i.u.addr.addr + 1;                       /* ents命令は実行しない */
+			break;
+		case ents:                                        /* cals命令が読むだけ */
+			break;
+		case rets:                                        /* 返す値はスタックのトップにそのまま残る */
+			pc = stack[display[i.u.addr.level] + i.u.addr.addr];
+			break;
+		case shl:                                         /* 2のvalue乗を掛ける */
+			stack[top - 1] = (int)((unsigned)stack[top - 1] << i.u.value);
+			break;
+		case shr:                                         /* 2のvalue乗で割る(divと同じく0の方へ切り捨てる) */
+			temp = stack[top - 1];
+			if (temp < 0)
+				temp += (1 << i.u.value) - 1;
+			stack[top - 1] = temp >> i.u.value;
+			break;
+		case msk:
+			stack[top - 1] &= i.u.value;
+			break;
+		case calm:                                        /* 値を覚えておく関数の呼び出し */
+			if (!memoing)
+				break;
+			a = insts[i.u.addr.addr].u.addr;              /* 呼び出し先のentm命令のパラメタ数とフレームの大きさ */
+			if (counting)
+				memoCalls++;
+			if ((temp = memoFind(tab, i.u.addr.addr, &stack[top - a.level], a.level)) >= 0) {
+				if (counting)                             /* フレームを作らずに覚えておいた値を返す */
+					memoHits++;
+				top -= a.level;
+				stack[top++] = tab[temp].value;
+				break;
+			}
+			lev = i.u.addr.level + 1;                     /* 覚えていなければcalと同じ */
+			stack[top] = display[lev];
+			stack[top + 1] = pc; display[lev] = top;
+			pc = i.u.addr.addr;
+			if (counting)
+				calls++;
+			break;
+		case entm:                                        /* ictと同じ(calm命令がパラメタ数を読む) */
+			if (!memoing)
+				break;
+			top += i.u.addr.addr;
+			if (top > topMax) {
+				if (mode == vmRun)
+					return vmError(w->vm, vmOverflow);
+				errorF("stack overflow");
+			}
+			break;
+		case retm:                                        /* 値を覚えてから戻る(パラメタは代入されない) */
+			if (!memoing)
+				break;
+			temp = display[i.u.addr.level];
+			if (stack[temp + 1] > 0 && insts[stack[temp + 1] - 1].opCode == calm)    /* 呼び出したcalmの飛び先で覚える */
+				memoStore(tab, insts[stack[temp + 1] - 1].u.addr.addr, &stack[temp - i.u.addr.addr], i.u.addr.addr, stack[top - 1]);
+			temp = stack[--top];                          /* あとはretと同じ */
+			top = display[i.u.addr.level];
+			display[i.u.addr.level] = stack[top];
+			pc = stack[top + 1];
+			top -= i.u.addr.addr;
+			stack[top++] = temp;
+			break;
+		case vlp:                                         /* ベクトル命令(-O) */
+		case vlen:
+		case vld:
+		case vst:
+		case vbc:
+		case vop:
+			if (mode == evalRun)
+				return 0;
+			top = vecStep(i, stack, display, top, mode == vmRun ? end : 0);
+			if (mode == vmRun && top < 0)
+				return vmError(w->vm, vmRange);
+			break;
+		case pfor:                                        /* 並列のforの繰り返しをスレッドに分ける */
+			if (mode == evalRun)
+				return 0;
+			if (mode == vmRun) {                          /* 繰り返しの命令語もインスタンスの数に入れる */
+				w->vm->steps += steps;
+				steps = 0;
+			}
+			top = parFor(i, stack, display, top, end, mode == vmRun ? w->vm : NULL);
+			if (mode == vmRun && w->vm->status != vmOk)
+				return 0;
+			if (mode == vmRun)
+				limit = vmBudget(w->vm);
+			break;
+		case spn:                                         /* 関数の呼び出しを仕事にする */
+			if (counting)
+				calls++;
+			if ((temp = spawnCall(i, stack, display, top, pc, mode == evalRun || mode == vmRun ? 2 : counting)) < 0)
+				pc = i.u.addr.addr;                       /* calと同じにフレームを作った */
+			else
+				top = temp;
+			break;
+		case syn:                                         /* 仕事を待ち合わせる */
+			if (mode != evalRun && mode != vmRun)
+				joinCalls(i.u.value, stack, top, end);
+			break;
 		}
 	} while (pc != 0);
+	if (mode == vmRun)
+		w->vm->steps += steps;
+	if (counting) {
+		stats.steps = steps;
+		stats.calls = calls;
+		stats.maxStack = maxTop > top ? maxTop : top;
+		stats.memoCalls = memoCalls;
+		stats.memoHits = memoHits;
+	}
+	if ((mode == evalRun || mode == parRun) && result != NULL)
+		*result = stack[top - 1];
+	return 1;
+}
+
+/* キーkの名前 */
+static void printKey(FILE *fp, int k)
+{
+	if (k < end_of_OpCode)
+		fprintf(fp, "%-10s", opName[k]);
+	else
+		fprintf(fp, "opr,%-6s", optrName[k - end_of_OpCode]);
+}
+
+/* 回数の多い順に整列するための比較関数 */
+static int byCount(const void *a, const void *b)
+{
+	long ca = sortCount[*(int *)a], cb = sortCount[*(int *)b];
+	if (ca != cb)
+		return ca < cb ? 1 : -1;
+	return *(int *)a - *(int *)b;
+}
+
+/* 実行プロファイルの上位n個を出力 */
+void profileReport(int n)
+{
+	static int order[MAXCODE > NKEY * NKEY ? MAXCODE : NKEY * NKEY];
+	long keyCount[NKEY], total = 0;
+	int i, m;
+
+	for (i = 0; i < NKEY; i++)
+		keyCount[i] = 0;
+	for (i = 0; i <= cIndex; i++) {
+		keyCount[keyOf[i]] += execCount[i];
+		total += execCount[i];
+	}
+	if (total == 0)
+		total = 1;
+	fprintf(stderr, "; profile\n");
+
+	/* 命令語(oprは演算)の種類ごとの回数 */
+	fprintf(stderr, "; opcodes\n");
+	for (i = 0; i < NKEY; i++)
+		order[i] = i;
+	sortCount = keyCount;
+	qsort(order, NKEY, sizeof(int), byCount);
+	for (i = 0; i < NKEY && keyCount[order[i]]; i++) {
+		fprintf(stderr, ";   ");
+		printKey(stderr, order[i]);
+		fprintf(stderr, " %12ld %6.2f%%\n", keyCount[order[i]], 100.0 * keyCount[order[i]] / total);
+	}
+
+	/* 続けて実行した命令語の組の回数(実行の先頭は数えない) */
+	fprintf(stderr, "; opcode pairs\n");
+	for (i = 0; i < NKEY * NKEY; i++)
+		order[i] = i;
+	sortCount = &pairCount[0][0];
+	qsort(order, NKEY * NKEY, sizeof(int), byCount);
+	for (i = 0; i < NKEY * NKEY && i < n && sortCount[order[i]]; i++) {
+		fprintf(stderr, ";   ");
+		printKey(stderr, order[i] / NKEY);
+		printKey(stderr, order[i] % NKEY);
+		fprintf(stderr, " %12ld %6.2f%%\n", sortCount[order[i]], 100.0 * sortCount[order[i]] / total);
+	}
+
+	/* 実行回数の多い番地 */
+	fprintf(stderr, "; hot instructions\n");
+	m = cIndex + 1;
+	for (i = 0; i < m; i++)
+		order[i] = i;
+	sortCount = execCount;
+	qsort(order, m, sizeof(int), byCount);
+	for (i = 0; i < m && i < n && execCount[order[i]]; i++) {
+		fprintf(stderr, "; %12ld %6.2f%%  L%3.3d: ", execCount[order[i]],
+			100.0 * execCount[order[i]] / total, order[i]);
+		printCode(stderr, order[i]);
+	}
+}
+
+/* 行ごとの実行回数をソースの.htmlファイルにヒートマップとして書き込む */
+void heatMap()
+{
+	long *count;
+	int i, n = sourceLines();
+
+	if ((count = calloc(n + 1, sizeof(long))) == NULL)
+		return;
+	for (i = 0; i <= cIndex; i++)
+		if (lineOf[i] <= n)
+			count[lineOf[i]] += execCount[i];
+	heatSource(count, n);
+	free(count);
 }
@@ -2,26 +2,93 @@
 #ifndef CODEGEN_H_
 #define CODEGEN_H_
 
+#include "table.h"
+
+#ifndef MAXCODE
+#define MAXCODE 1000   /* 目的コードの最大長さ(-Oでは最適化で詰める前のコードも収まること) */
+#endif
+#ifndef MAXMEM
+#define MAXMEM 2000    /* 実行時スタックの最大長さ */
+#endif
+#define MAXLEVEL 5     /* ブロックの最大深さ(ディスプレイの大きさ) */
+#define MEMOARGS 4     /* 値を覚えておく関数(--memo)のパラメタ数の上限 */
+#define VECDEPTH 8     /* ベクトル命令(-O)のベクトルレジスタの数 */
+#define SPAWNARGS 8    /* 仕事にする関数(--spawn)のパラメタ数の上限 */
+
 /* 命令語のコード */
 typedef enum codes {
 	lit, opr, lod, sto, cal, ret, ict, jmp, jpc,
-	loda, stoa, retp
+	loda, stoa, retp, cals, ents, rets, shl, shr, msk,
+	calm, entm, retm,
+	vlp, vlen, vld, vst, vbc, vop,
+	pfor, spn, syn,
+	end_of_OpCode
 } OpCode;
 
 /* 演算命令のコード */
 typedef enum ops {
 	neg, add, sub, mul, div, odd, eq, ls, gr,
-	neq, lseq, greq, wrt, wrl
+	neq, lseq, greq, wrt, wrl,
+	end_of_Operator
 } Operator;
 
+/* 命令語の型 */
+typedef struct inst {
+	OpCode  opCode;
+	union {
+		RelAddr addr;
+		int value;
+		Operator optr;
+	} u;
+} Inst;
+
+/* 仮想機械のインスタンス(--batch). 目的コードの写しと出力のバッファを持ち、実行する
+   あいだは実行時スタックと関数の値を覚えておく表も自分で持つ(ディスプレイは実行ループの
+   局所変数)ので、ほかのインスタンスと同時に別のスレッドで実行できる.
+   実行時の誤りはプロセスを終えずにstatusにする */
+typedef struct vm {
+	Inst *code;              /* 目的コードの写し */
+	int nCode;
+	int opNeed;              /* フレームの上に積むオペランドの数の最大値(verifyCodeが求めたもの) */
+	int *stack;              /* 実行時スタック(実行するあいだだけ) */
+	struct memo *memo;       /* 関数の値を覚えておく表(--memoのコード、実行するあいだだけ) */
+	char *out;               /* 出力のバッファ(outLen文字、終りの'\0'はない) */
+	int outLen, outMax;
+	int status;              /* 実行の結果(VmStatus) */
+	long stepMax;            /* 実行する命令語の数の上限(0なら制限しない) */
+	long steps;              /* 実行した命令語の数 */
+} Vm;
+
+/* インスタンスの実行の結果 */
+typedef enum vmStatus {
+	vmOk,            /* 最後まで実行した */
+	vmOverflow,      /* 実行時スタックが溢れた */
+	vmDivide,        /* 0で割った */
+	vmRange,         /* 配列の要素が実行時スタックの外 */
+	vmSteps,         /* 実行した命令語の数が上限を越えた */
+	vmNoMemory       /* 記憶が足りない */
+} VmStatus;
+
 int genCodeV(OpCode op, int v);     /* 命令語の生成、アドレス部にv */
-int genCodeT(OpCode op, int ti);    /* 命令語の生成、アドレスは名前表から */
+int genCodeA(OpCode op, RelAddr a);    /* 命令語の生成、アドレス部にa */
 int genCodeO(Operator p);           /* 命令語の生成、アドレス部に演算命令 */
-int genCodeR(int forProc);          /* ret命令語の生成 */
+int genCodeR(int forProc, int level, int pars);    /* ret命令語の生成 */
 void backPatch(int i);              /* 命令語のバックパッチ(次の番地を) */
+void setCodeLine(int line);         /* 以後に生成する命令語に対応するソースの行をセット */
 
 int nextCode();                     /* 次の命令語のアドレスを返す */
+Inst *codeAt(int i);                /* 番地iの命令語(最適化用) */
+void removeCode(char dead[], int newAddr[]);    /* dead[i]が真の命令語を取り除いて詰める */
+int copyCode(int from, int to);     /* from..to-1の命令語を後ろに写す(最適化用) */
+int evalCall(int entry, int level, int args[], int nArgs, long limit, int *result);    /* 関数の値を実行して求める(最適化用) */
+void verifyCode();                  /* 目的コードの検査(誤りがあればコンパイルを終える) */
 void listCode();                    /* 目的コード(命令語)のリスティング */
 void execute();                     /* 目的コード(命令語)の実行 */
+Vm *vmNew(Inst c[], int nCode, int need);    /* c[0..nCode-1]を写したインスタンス(cがNULLなら今の目的コード) */
+int vmExecute(Vm *v);               /* インスタンスの実行(状態を返す、ほかのスレッドと同時に呼んでよい) */
+char *vmMessage(int status);        /* 状態の説明 */
+void vmFree(Vm *v);
+void profileReport(int n);          /* 実行プロファイルの上位n個を出力 */
+void heatMap();                     /* 行ごとの実行回数を.htmlファイルに書き込む */
 
 #endif
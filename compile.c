@@ -2,46 +2,105 @@
 #include "getSource.h"
 #include "table.h"
 #include "codegen.h"
+#include "ast.h"
+#include "ir.h"
+#include "loop.h"
+#include "cse.h"
+#include "inline.h"
+#include "tail.h"
+#include "vector.h"
+#include "parfor.h"
+#include "spawn.h"
 
 #define MINERROR 3     /* エラーがこれ以下なら実行 */
 #define FIRSTADDR 2    /* 各ブロックの最初の変数のアドレス */
 
 static Token token;    /* 次のトークンを入れておく */
+static Node *curBlock; /* 主文をコンパイルしているブロック */
+static int parDepth;   /* コンパイルしている並列のforの入れ子の深さ */
+static int direct;     /* 構文木の上の最適化をしないので、構文木を作らずに解析しながらコードを生成するか */
 
-static void block(int pIndex);       /* ブロックのコンパイル (pIndexはこのブロックの関数名のインデックス) */
+static void block(Node *b);          /* ブロックのコンパイル (bはこのブロックの節点) */
 static void declaration();
 static void constDecl();             /* 定数宣言のコンパイル */
 static void varDecl();               /* 変数宣言のコンパイル */
 static void funcDecl();              /* 関数宣言のコンパイル */
 static void procDecl();              /* 手続き宣言のコンパイル */
-static void statement();             /* 文のコンパイル */
-static void expression();            /* 式のコンパイル */
-static void term();                  /* 式の項のコンパイル */
-static void factor();                /* 式の因子のコンパイル */
-static void condition();             /* 条件式のコンパイル */
+static Node *statement();            /* 文のコンパイル */
+static Node *forStatement();         /* for文のコンパイル */
+static Node *expression();           /* 式のコンパイル */
+static Node *term();                 /* 式の項のコンパイル */
+static Node *factor();               /* 式の因子のコンパイル */
+static Node *condition();            /* 条件式のコンパイル */
+static Node *callNode(NodeKind k, int tIndex);    /* 関数呼び出しの節点 */
 static int isStBeginKey(Token t);    /* トークンtは文の先頭のキーか? */
 
 int compile()
 {
 	int i;
+	Node *prog;
 	printf("; start compilation\n");
 	initSource();                         /* getSourceの初期設定 */
 	token = nextToken();                  /* 最初のトークン */
+	direct = !optMode && !spawnMode;
 	blockBegin(FIRSTADDR);                /* これ以後の宣言は新しいブロックのもの */
-	block(0);                             /* 0 はダミー(主ブロックの関数名はない) */
+	prog = newBlock();                    /* 主ブロック */
+	block(prog);
 	finalSource();
 	i = errorN();                         /* エラーメッセージの個数 */
 	if (i != 0)
 		printf("; %d errors\n", i);
+	if (optMode && i == 0) {
+		if (inlineMax > 0)
+			inlineCalls(prog);            /* 小さな関数の展開 */
+		optimizeCSE(prog);                /* 共通部分式の除去 */
+		vectorizeLoops(prog);             /* 要素ごとの配列のループのベクトル化 */
+		optimizeLoops(prog);              /* ループの最適化 */
+		tailCalls(prog);                  /* 末尾呼び出しの除去 */
+	}
+	if (spawnMode && i == 0)
+		spawnCalls(prog);                 /* 重い純粋な関数の呼び出しを仕事にする */
+	if (!direct)
+		genProgram(prog);                 /* 構文木から目的コードを生成(directなら解析しながら生成済み) */
+	astFree();                            /* 構文木はもう要らない */
+	summaryFree();
+	if (optMode && i == 0)
+		optimize();                       /* 目的コードの最適化 */
+	if (memoMode && i == 0)
+		memoize();                        /* 再帰的な純粋な関数の値を覚えておく */
+	if (i < MINERROR)
+		verifyCode();                     /* 目的コードの検査 */
 	// listCode();                        /* 目的コードのリスト(必要なら) */
 	return i < MINERROR;                  /* エラーメッセージの個数が少ないかどうかの判定 */
 }
 
-/* pIndex はこのブロックの関数名のインデックス */
-void block(int pIndex)
+/* 今の行の命令語の生成(directのとき、構文木の節点を作る代わりに) */
+static int emitV(OpCode op, int v)
+{
+	setCodeLine(sourceLine());
+	return genCodeV(op, v);
+}
+
+static int emitA(OpCode op, RelAddr a)
 {
-	int backP;
-	backP = genCodeV(jmp, 0);    /* 内部関数を飛び越す命令、後でバックパッチ */
+	setCodeLine(sourceLine());
+	return genCodeA(op, a);
+}
+
+static int emitO(Operator o)
+{
+	setCodeLine(sourceLine());
+	return genCodeO(o);
+}
+
+/* b はこのブロックの節点、内部の関数と手続きのブロックをその子にする */
+void block(Node *b)
+{
+	int mark = kidMark();
+	Node *outer;
+
+	if (direct)
+		genBlockStart(b);                /* 内部関数を飛び越すjmp */
 
 	/* 宣言部のコンパイルを繰り返す */
 	while (1) {
@@ -68,18 +127,31 @@ void block(int pIndex)
 		break;
 	}
 
-	backPatch(backP);               /* 内部関数を飛び越す命令にパッチ */
-	changeV(pIndex, nextCode());    /* この関数の開始番地を修正 */
-	genCodeV(ict, frameL());        /* このブロックの実行時の必要記憶域をとる命令 */
-	statement();                    /* このブロックの主文 */
-	genCodeR(inProcedureBlock());   /* ret命令 */
-	blockEnd();                     /* ブロックが終ったことをtableに連絡 */
+	endKids(b, mark);                    /* 内部の関数と手続き */
+	b->u.blk->started = 1;                /* これ以後の呼び出しは開始番地へ */
+	b->u.blk->frame = frameL();           /* このブロックの実行時の必要記憶域 */
+	b->u.blk->level = bLevel();
+	b->u.blk->isProc = inProcedureBlock();
+	b->u.blk->pars = fPars();
+	if (bLevel() > 0)                    /* 並列のforから呼ばれたときのための要約(主ブロックは呼ばれない) */
+		summaryBegin(b, bLevel());
+	if (direct)
+		genBlockEntry(b);                /* 開始番地のict */
+	outer = curBlock;
+	curBlock = b;
+	b->u.blk->body = statement();         /* このブロックの主文(directならNULL) */
+	curBlock = outer;
+	b->u.blk->endLine = sourceLine();
+	summaryEnd();
+	if (direct)
+		genBlockEnd(b);                  /* ret命令と、主文の中の並列のforの繰り返しの手続き */
+	blockEnd();                          /* ブロックが終ったことをtableに連絡 */
 }
 
 void declaration(KindT kind)
 {
 	Token temp;
-	int fIndex;
+	Node *b;
 
 	switch (kind) {
 	case constId:
@@ -141,8 +213,11 @@ void declaration(KindT kind)
 	default:
 		if (token.kind == Id) {
 			setIdKind(kind);                                  /* 印字のための情報のセット */
-			fIndex = kind == funcId ?
-				enterTfunc(token.u.id, nextCode()) : enterTproc(token.u.id, nextCode());
+			b = newBlock();                                   /* 名前表には番地の代わりにブロックの番号を入れる */
+			if (kind == funcId)
+				enterTfunc(token.u.id, b->u.blk->id);
+			else
+				enterTproc(token.u.id, b->u.blk->id);
 			token = checkGet(nextToken(), Lparen);
 			blockBegin(FIRSTADDR);                            /* パラメタ名のレベルは関数のブロックと同じ */
 			while(1) {
@@ -169,7 +244,8 @@ void declaration(KindT kind)
 				errorDelete();
 				token = nextToken();
 			}
-			block(fIndex);                                    /* ブロックのコンパイル、その関数名のインデックスを渡す */
+			block(b);                                         /* ブロックのコンパイル */
+			pushKid(b);                                       /* 外側のブロックの子にする */
 			token = checkGet(token, Semicolon);               /* 最後は";"のはず */
 		}
 		else
@@ -201,21 +277,20 @@ void procDecl()
 	declaration(procId);
 }
 
-/* 文のコンパイル */
-void statement()
+/* 文のコンパイル (directならコードを生成してNULLを返す) */
+Node *statement()
 {
-	int tIndex;
+	int tIndex, mark, arr, line, d;
+	int backP, backP2;                                    /* バックパッチ用 */
 	KindT k;
-	int backP, backP2;    /* バックパッチ用 */
-	int backP3, backP4;
+	RelAddr a;
+	Node *n, *c, *e;
 
 	while(1) {
-		OpCode op;
-
 		switch (token.kind) {
 		case Id:                                          /* 代入文のコンパイル */
-			op = sto;
-
+			e = NULL;
+			arr = 0;
 			tIndex = searchT(token.u.id, varId);          /* 左辺の変数のインデックス */
 			setIdKind(k = kindT(tIndex));                 /* 印字のための情報のセット */
 			if (k != varId && k != parId)                 /* 変数名かパラメタ名のはず */
@@ -223,55 +298,94 @@ void statement()
 
 			token = nextToken();
 			if (token.kind == Lbracket) {                 /* 配列だったら */
-				op = stoa;
+				arr = 1;
 				token = nextToken();
-				expression();
+				e = expression();                         /* 添字の式 */
 				token = checkGet(token, Rbracket);
 			}
 
 			token = checkGet(token, Assign);              /* ":="のはず */
-			expression();                                 /* 式のコンパイル */
-			genCodeT(op, tIndex);
-			return;
+			c = expression();                             /* 式のコンパイル */
+			a = relAddr(tIndex);
+			if (!arr)
+				summaryAssign(a);
+			if (direct) {
+				emitA(arr ? stoa : sto, a);
+				return NULL;
+			}
+			n = arr ? newNode2(AssignArrN, e, c) : newNode1(AssignN, c);
+			n->u.addr = a;
+			return n;
 		case If:                                          /* if文のコンパイル */
 			token = nextToken();
-			condition();                                  /* 条件式のコンパイル */
+			c = condition();                              /* 条件式のコンパイル */
 			token = checkGet(token, Then);                /* "then"のはず */
-			backP = genCodeV(jpc, 0);                     /* jpc命令 */
-			statement();                                  /* 文のコンパイル */
+			if (direct) {
+				line = sourceLine();
+				backP = emitV(jpc, 0);                    /* jpc命令 */
+				statement();                              /* 文のコンパイル */
+				if (token.kind == Else) {
+					token = nextToken();
+					setCodeLine(line);
+					backP2 = genCodeV(jmp, 0);
+					backPatch(backP);
+					statement();
+					backPatch(backP2);
+				}
+				else
+					backPatch(backP);
+				return NULL;
+			}
+			n = newNode(IfN, 3);
+			n->kid[0] = c;
+			n->kid[1] = statement();                      /* 文のコンパイル */
 			if (token.kind == Else) {
 				token = nextToken();
-				backP2 = genCodeV(jmp, 0);
-				backPatch(backP);
-				statement();
-				backPatch(backP2);
+				n->kid[2] = statement();
 			}
 			else
-				backPatch(backP);
-			return;
+				n->nKid = 2;                              /* else部はない */
+			return n;
 		case Unless:
 			token = nextToken();
-			condition();                                  /* 条件式のコンパイル */
-			backP = genCodeV(jpc, 0);                     /* jpc命令 */
-			backP2 = genCodeV(jmp, 0);                    /* jmp命令 */
+			c = condition();                              /* 条件式のコンパイル */
+			if (direct) {
+				backP = emitV(jpc, 0);                    /* jpc命令 */
+				backP2 = genCodeV(jmp, 0);                /* jmp命令 */
+				token = checkGet(token, Then);            /* "then"のはず */
+				backPatch(backP);                         /* 上のjpc命令にバックパッチ */
+				statement();                              /* 文のコンパイル */
+				backPatch(backP2);                        /* 上のjmp命令にバックパッチ */
+				return NULL;
+			}
+			n = newNode(UnlessN, 2);
 			token = checkGet(token, Then);                /* "then"のはず */
-			backPatch(backP);                             /* 上のjpc命令にバックパッチ */
-			statement();                                  /* 文のコンパイル */
-			backPatch(backP2);                            /* 上のjmp命令にバックパッチ */
-			return;
+			n->kid[0] = c;
+			n->kid[1] = statement();                      /* 文のコンパイル */
+			return n;
 		case Ret:                                         /* return文のコンパイル */
 			token = nextToken();
-			if ( inProcedureBlock() )
-				genCodeR(1);                              /* ret命令 */
-			else {
-				expression();                             /* 式のコンパイル */
-				genCodeR(0);                              /* ret命令 */
+			if ( inProcedureBlock() ) {
+				if (direct) {
+					setCodeLine(sourceLine());
+					genCodeR(1, bLevel(), fPars());       /* ret命令 */
+					return NULL;
+				}
+				return newNode(RetN, 0);
+			}
+			c = expression();                             /* 式のコンパイル */
+			if (direct) {
+				setCodeLine(sourceLine());
+				genCodeR(0, bLevel(), fPars());           /* ret命令 */
+				return NULL;
 			}
-			return;
+			return newNode1(RetN, c);
 		case Begin:                                       /* begin ... end文のコンパイル */
 			token = nextToken();
+			mark = kidMark();
 			while(1) {
-				statement();                              /* 文のコンパイル */
+				if ((c = statement()) != NULL)            /* 文のコンパイル */
+					pushKid(c);
 				while(1) {
 					if (token.kind == Semicolon) {        /* 次が";"なら文が続く */
 						token = nextToken();
@@ -279,7 +393,9 @@ void statement()
 					}
 					if (token.kind == End) {              /* 次がendなら終り */
 						token = nextToken();
-						return;
+						if (direct)
+							return NULL;
+						return endKids(newNode(BeginN, 0), mark);
 					}
 					if ( isStBeginKey(token) ) {          /* 次が文の先頭記号なら */
 						errorInsert(Semicolon);           /* ";"を忘れたことにする */
@@ -289,99 +405,99 @@ void statement()
 					token = nextToken();
 				}
 			}
-			return;
 		case While:                                       /* while文のコンパイル */
 			token = nextToken();
 			backP2 = nextCode();                          /* while文の最後のjmp命令の飛び先 */
-			condition();                                  /* 条件式のコンパイル */
+			c = condition();                              /* 条件式のコンパイル */
 			token = checkGet(token, Do);                  /* "do"のはず */
-			backP = genCodeV(jpc, 0);                     /* 条件式が偽のとき飛び出すjpc命令 */
-			statement();                                  /* 文のコンパイル */
-			genCodeV(jmp, backP2);                        /* while文の先頭へのジャンプ命令 */
-			backPatch(backP);                             /* 偽のとき飛び出すjpc命令へのバックパッチ */
-			return;
+			if (direct) {
+				line = sourceLine();
+				backP = emitV(jpc, 0);                    /* 条件式が偽のとき飛び出すjpc命令 */
+				statement();                              /* 文のコンパイル */
+				setCodeLine(line);
+				genCodeV(jmp, backP2);                    /* while文の先頭へのジャンプ命令 */
+				backPatch(backP);
+				return NULL;
+			}
+			n = newNode(WhileN, 2);
+			n->kid[0] = c;
+			n->kid[1] = statement();                      /* 文のコンパイル */
+			return n;
 		case Do:
 			token = nextToken();
 			backP = nextCode();
-			statement();
+			e = statement();
 			token = checkGet(token, While);
-			condition();
-			backP2 = genCodeV(jpc, 0);
-			genCodeV(jmp, backP);
-			backPatch(backP2);
-			return;
+			c = condition();
+			if (direct) {
+				backP2 = emitV(jpc, 0);
+				genCodeV(jmp, backP);
+				backPatch(backP2);
+				return NULL;
+			}
+			return newNode2(DoN, e, c);
 		case Repeat:
 			token = nextToken();
 			backP = nextCode();
-			statement();
+			e = statement();
 			token = checkGet(token, Until);
-			condition();
-			genCodeV(jpc, backP);
-			return;
+			c = condition();
+			if (direct) {
+				emitV(jpc, backP);
+				return NULL;
+			}
+			return newNode2(RepeatN, e, c);
 		case For:
 			token = nextToken();
-			statement();
-			token = checkGet(token, Semicolon);
-			backP4 = nextCode();
-			condition();
-			backP2 = genCodeV(jpc, 0);
-			token = checkGet(token, Semicolon);
-			backP = genCodeV(jmp, 0);
-			backP3 = nextCode();
-			statement();  // increment
-			genCodeV(jmp, backP4);
-			backPatch(backP);
-			token = checkGet(token, Do);
-			statement();
-			genCodeV(jmp, backP3);
-			backPatch(backP2);
-			return;
+			return forStatement();
+		case Parallel:                                    /* 並列のfor文のコンパイル */
+			token = checkGet(nextToken(), For);           /* "for"のはず */
+			d = direct;
+			direct = 0;                                   /* 並列のforは構文木を作って調べる */
+			parDepth++;
+			n = forStatement();
+			parDepth--;
+			direct = d;
+			if (parDepth > 0) {                           /* 並列のforの中では普通のfor文 */
+				noteMessage("nested parallel for");
+				return n;
+			}
+			n = parallelFor(n, curBlock, bLevel());
+			if (direct) {
+				genNode(n);
+				return NULL;
+			}
+			return n;
 		case Call:
 			token = nextToken();
 			tIndex = searchT(token.u.id, procId);
 			setIdKind(k = kindT(tIndex));                 /* 印字のための情報のセット */
 			if (k == procId) {
 				token = nextToken();
-				if (token.kind == Lparen) {
-					int i = 0;                            /* iは実引数の個数 */
-					token = nextToken();
-					if (token.kind != Rparen) {
-						for (; ; ) {
-							expression(); i++;            /* 実引数のコンパイル */
-							if (token.kind == Comma) {    /* 次がコンマなら実引数が続く */
-								token = nextToken();
-								continue;
-							}
-							token = checkGet(token, Rparen);
-							break;
-						}
-					}
-					else
-						token = nextToken();
-					if (pars(tIndex) != i)
-						errorMessage("\\#par");           /* pars(tIndex)は仮引数の個数 */
-				}
-				else {
-					errorInsert(Lparen);
-					errorInsert(Rparen);
-				}
-				genCodeT(cal, tIndex);                    /* call命令 */
+				return callNode(CallStN, tIndex);
 			}
-			else
-				errorType("proc");
-			return;
+			errorType("proc");
+			return NULL;
 		case Write:                                       /* write文のコンパイル */
 			token = nextToken();
-			expression();                                 /* 式のコンパイル */
-			genCodeO(wrt);                                /* その値を出力するwrt命令 */
-			return;
+			c = expression();                             /* 式のコンパイル */
+			summaryWrite();
+			if (direct) {
+				emitO(wrt);                               /* その値を出力するwrt命令 */
+				return NULL;
+			}
+			return newNode1(WriteN, c);
 		case WriteLn:                                     /* writeln文のコンパイル */
 			token = nextToken();
-			genCodeO(wrl);                                /* 改行を出力するwrl命令 */
-			return;
+			summaryWrite();
+			if (direct) {
+				emitO(wrl);                               /* 改行を出力するwrl命令 */
+				return NULL;
+			}
+			return newNode(WriteLnN, 0);
 		case End:
 		case Semicolon:                                   /* 空文を読んだことにして終り */
-			return;
+			return NULL;
 		default:                                          /* 文の先頭のキーまで読み捨てる */
 			errorDelete();                                /* 今読んだトークンを読み捨てる */
 			token = nextToken();
@@ -390,6 +506,90 @@ void statement()
 	}
 }
 
+/* for文のコンパイル ("for"の次のトークンから) */
+Node *forStatement()
+{
+	int line, backP, backP2, backP3, backP4;    /* バックパッチ用 */
+	Node *n, *e, *c;
+	e = statement();                              /* 初期化 */
+	token = checkGet(token, Semicolon);
+	backP4 = nextCode();
+	c = condition();
+	if (direct) {
+		line = sourceLine();
+		backP2 = emitV(jpc, 0);
+		backP = genCodeV(jmp, 0);
+		token = checkGet(token, Semicolon);
+		backP3 = nextCode();
+		statement();                              /* 増分 */
+		setCodeLine(line);
+		genCodeV(jmp, backP4);
+		backPatch(backP);
+		token = checkGet(token, Do);
+		statement();
+		setCodeLine(line);
+		genCodeV(jmp, backP3);
+		backPatch(backP2);
+		return NULL;
+	}
+	n = newNode(ForN, 4);
+	n->kid[0] = e;
+	n->kid[1] = c;
+	token = checkGet(token, Semicolon);
+	n->kid[2] = statement();                      /* 増分 */
+	token = checkGet(token, Do);
+	n->kid[3] = statement();
+	return n;
+}
+
+/* 関数呼び出しの節点 (関数名の次のトークンから実引数の並びをコンパイル、
+   directならcal命令を生成してNULLを返す) */
+Node *callNode(NodeKind kind, int tIndex)
+{
+	int i = 0, toEntry, mark = kidMark();         /* iは実引数の個数 */
+	RelAddr a;
+	Node *n, *b, *e;
+
+	if (token.kind == Lparen) {
+		token = nextToken();
+		if (token.kind != Rparen) {
+			for (; ; ) {
+				e = expression(); i++;            /* 実引数のコンパイル */
+				if (!direct)
+					pushKid(e);
+				if (token.kind == Comma) {        /* 次がコンマなら実引数が続く */
+					token = nextToken();
+					continue;
+				}
+				token = checkGet(token, Rparen);
+				break;
+			}
+		}
+		else
+			token = nextToken();
+		if (pars(tIndex) != i)
+			errorMessage("\\#par");               /* pars(tIndex)は仮引数の個数 */
+	}
+	else {
+		errorInsert(Lparen);
+		errorInsert(Rparen);
+	}
+	a = relAddr(tIndex);                          /* 名前表のアドレスはブロックの番号 */
+	b = blockOf(a.addr);
+	summaryCall(b);
+	/* 主文の解析を始めたブロックは開始番地を、まだならブロックの先頭を呼ぶ */
+	toEntry = b != NULL && b->u.blk->started;
+	if (direct) {
+		emitA(cal, callAddr(b, a.level, toEntry));    /* call命令 */
+		return NULL;
+	}
+	n = endKids(newNode(kind, 0), mark);
+	n->u.call.level = a.level;
+	n->u.call.blk = b;
+	n->u.call.toEntry = toEntry;
+	return n;
+}
+
 /* トークンtは文の先頭のキーか? */
 int isStBeginKey(Token t)
 {
@@ -398,6 +598,7 @@ int isStBeginKey(Token t)
 	case Call:
 	case Do:
 	case For:
+	case Parallel:
 	case Id:
 	case If:
 	case Repeat:
@@ -412,110 +613,146 @@ int isStBeginKey(Token t)
 	}
 }
 
+/* 演算子のない並び (エラー回復で生じる) */
+static Node *seqNode(Node *a, Node *b)
+{
+	if (direct)
+		return NULL;
+	if (a == NULL)
+		return b;
+	if (b == NULL)
+		return a;
+	return newNode2(SeqN, a, b);
+}
+
+/* 二項演算の節点 (オペランドのあとで呼ぶ、directなら演算命令を生成してNULLを返す) */
+static Node *binNode(Operator o, Node *a, Node *b)
+{
+	Node *n;
+	if (direct) {
+		emitO(o);
+		return NULL;
+	}
+	n = newNode2(BinN, a, b);
+	n->u.optr = o;
+	return n;
+}
+
+/* 単項演算の節点 (同じく) */
+static Node *unNode(Operator o, Node *a)
+{
+	Node *n;
+	if (direct) {
+		emitO(o);
+		return NULL;
+	}
+	n = newNode1(UnN, a);
+	n->u.optr = o;
+	return n;
+}
+
+/* 定数の節点 (directならlit命令を生成してNULLを返す) */
+static Node *numNode(int v)
+{
+	Node *n;
+	if (direct) {
+		emitV(lit, v);
+		return NULL;
+	}
+	n = newNode(NumN, 0);
+	n->u.value = v;
+	return n;
+}
+
 /* 式のコンパイル */
-void expression()
+Node *expression()
 {
 	KeyId k;
+	Node *n;
 	k = token.kind;
 	if (k == Plus || k == Minus) {
 		token = nextToken();
-		term();
+		n = term();
 		if (k == Minus)
-			genCodeO(neg);
+			n = unNode(neg, n);
 	}
 	else
-		term();
+		n = term();
 	k = token.kind;
 	while (k == Plus || k == Minus) {
 		token = nextToken();
-		term();
-		if (k == Minus)
-			genCodeO(sub);
-		else
-			genCodeO(add);
+		n = binNode(k == Minus ? sub : add, n, term());
 		k = token.kind;
 	}
+	return n;
 }
 
 /* 式の項のコンパイル */
-void term()
+Node *term()
 {
 	KeyId k;
-	factor();
+	Node *n;
+	n = factor();
 	k = token.kind;
 	while (k == Mult || k == Div) {
 		token = nextToken();
-		factor();
-		if (k == Mult)
-			genCodeO(mul);
-		else
-			genCodeO(div);
+		n = binNode(k == Mult ? mul : div, n, factor());
 		k = token.kind;
 	}
+	return n;
 }
 
 /* 式の因子のコンパイル */
-void factor()
+Node *factor()
 {
-	int tIndex, i;
+	int tIndex;
 	KeyId k;
+	RelAddr a;
+	Node *n = NULL;
 	if (token.kind == Id) {
 		tIndex = searchT(token.u.id, varId);
 		setIdKind(k = kindT(tIndex));                 /* 印字のための情報のセット */
 		switch ( k ) {
 		case varId:
 		case parId:                                   /* 変数名かパラメタ名 */
-			genCodeT(lod, tIndex);
 			token = nextToken();
+			a = relAddr(tIndex);
 			if (token.kind == Lbracket) {             /* 配列だったら */
 				token = nextToken();
-				expression();
-				genCodeT(loda, tIndex);
+				n = expression();                     /* 添字の式、loda命令がそれを要素の値に置き換える */
+				if (direct)
+					emitA(loda, a);
+				else
+					(n = newNode1(ArrN, n))->u.addr = a;
 				token = checkGet(token, Rbracket);
 			}
+			else {
+				summaryVar(a);
+				if (direct)
+					emitA(lod, a);
+				else
+					(n = newNode(VarN, 0))->u.addr = a;
+			}
 			break;
 		case constId:                                 /* 定数名 */
-			genCodeV(lit, val(tIndex));
+			n = numNode(val(tIndex));
 			token = nextToken();
 			break;
 		case funcId:                                  /* 関数呼び出し */
 			token = nextToken();
-			if (token.kind == Lparen) {
-				i = 0;                                /* iは実引数の個数 */
-				token = nextToken();
-				if (token.kind != Rparen) {
-					for (; ; ) {
-						expression(); i++;            /* 実引数のコンパイル */
-						if (token.kind == Comma) {    /* 次がコンマなら実引数が続く */
-							token = nextToken();
-							continue;
-						}
-						token = checkGet(token, Rparen);
-						break;
-					}
-				}
-				else
-					token = nextToken();
-				if (pars(tIndex) != i)
-					errorMessage("\\#par");           /* pars(tIndex)は仮引数の個数 */
-			}
-			else {
-				errorInsert(Lparen);
-				errorInsert(Rparen);
-			}
-			genCodeT(cal, tIndex);                    /* call命令 */
+			n = callNode(CallN, tIndex);
 			break;
 		}
 	}
 	/* 定数 */
 	else if (token.kind == Num) {
-		genCodeV(lit, token.u.value);
+		n = numNode(token.u.value);
 		token = nextToken();
 	}
 	/* 「(」「因子」「)」 */
 	else if (token.kind == Lparen) {
 		token = nextToken();
-		expression();
+		n = expression();
 		token = checkGet(token, Rparen);
 	}
 
@@ -525,57 +762,51 @@ void factor()
 	case Num:
 	case Lparen:
 		errorMissingOp();
-		factor();
+		return seqNode(n, factor());
 	default:
-		return;
+		return n;
 	}
 }
 
 /* 条件式のコンパイル */
-void condition()
+Node *condition()
 {
 	KeyId k;
+	Node *n;
 	if (token.kind == Odd) {
 		token = nextToken();
-		expression();
-		genCodeO(odd);
+		n = expression();
+		return unNode(odd, n);
 	}
-	else {
-		expression();
-		k = token.kind;
-		switch ( k ) {
-		case Equal:
-		case Lss:
-		case Gtr:
-		case NotEq:
-		case LssEq:
-		case GtrEq:
-			break;
-		default:
-			errorType("rel-op");
-			break;
-		}
-		token = nextToken();
-		expression();
-		switch ( k ) {
-		case Equal:
-			genCodeO(eq);
-			break;
-		case Lss:
-			genCodeO(ls);
-			break;
-		case Gtr:
-			genCodeO(gr);
-			break;
-		case NotEq:
-			genCodeO(neq);
-			break;
-		case LssEq:
-			genCodeO(lseq);
-			break;
-		case GtrEq:
-			genCodeO(greq);
-			break;
-		}
+	n = expression();
+	k = token.kind;
+	switch ( k ) {
+	case Equal:
+	case Lss:
+	case Gtr:
+	case NotEq:
+	case LssEq:
+	case GtrEq:
+		break;
+	default:
+		errorType("rel-op");
+		break;
+	}
+	token = nextToken();
+	switch ( k ) {
+	case Equal:
+		return binNode(eq, n, expression());
+	case Lss:
+		return binNode(ls, n, expression());
+	case Gtr:
+		return binNode(gr, n, expression());
+	case NotEq:
+		return binNode(neq, n, expression());
+	case LssEq:
+		return binNode(lseq, n, expression());
+	case GtrEq:
+		return binNode(greq, n, expression());
+	default:                                          /* 比較演算子がなければ並べるだけ */
+		return seqNode(n, expression());
 	}
 }
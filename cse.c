@@ -0,0 +1,496 @@
+/********** cse.c **********/
+/*
+ * 構文木の上での共通部分式の除去(-O)
+ *
+ * 基本ブロック(代入文、call文、write文、writeln文、return文の並び)ごとに
+ * 評価の順に局所値番号付けをして、同じ値になる式(演算と配列の要素)を
+ * 見つける. 二度以上現れて命令語が減るなら、最初に現れる文の前で一時変数に
+ * 計算しておき、どの場所でもその一時変数を読む. 一時変数はそのブロックの
+ * 局所変数として新しく割り当てる(ict命令の値が増える).
+ *   - 変数への代入(sto)はその変数を、配列の要素への代入(stoa)はその配列を
+ *     読む値を無効にする
+ *   - ブロックの外の変数に代入しうる関数や手続きの呼び出し(cal)は、内部の
+ *     ブロックから参照されないそのブロックの局所変数とパラメタ以外を読む値を
+ *     無効にする
+ *   - 呼び出しを含む式、定数だけの式(定数伝播に任せる)は対象にしない.
+ *     文の中で呼び出しより後に初めて現れる式も、文の前に移すと呼び出しを
+ *     追い越すので対象にしない
+ * スタック機械の目的コードでは値を取っておくには変数に入れるしかないので、
+ * 一時変数を作りやすい構文木の上で行う.
+ */
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include "ast.h"
+#include "cse.h"
+#include "stats.h"
+
+/* stdlib.hはOperatorのdivと衝突するので読まない */
+extern void *calloc(size_t n, size_t size);
+extern void *realloc(void *p, size_t size);
+extern void free(void *p);
+
+#define HASHSIZE 1024       /* 値の表のハッシュ表の大きさ */
+
+/* 値の形(同じ形の式は同じ値) */
+typedef struct vkey {
+	NodeKind kind;
+	int op;                 /* UnN, BinNの演算子、ArrNの添字の値番号 */
+	int a, b, c;            /* VarN, ArrNは変数のレベル、番地、版. UnN, BinNは引数の値番号 */
+} VKey;
+
+/* 対象になる式が現れた場所 */
+typedef struct occ {
+	int vn;                 /* 値番号 */
+	Node **np;              /* 式を指す場所 */
+	int stmt;               /* 基本ブロックの中の文の位置 */
+	int afterCall;          /* 文の中で呼び出しより後か */
+	int cost;               /* 式の命令語の数 */
+} Occ;
+
+/* 変数の版(代入のたびに新しい番号にする) */
+typedef struct ver {
+	RelAddr a;
+	int v;
+} Ver;
+
+static Node *blk;           /* 最適化中のブロック */
+static int nPars;           /* そのパラメタ数(主ブロックは0) */
+static char *shared;        /* shared[addr+pars]が真の変数は内部のブロックから参照される */
+static int nShared;
+static char *writes;        /* writes[id]が真のブロックはブロックの外の変数に代入しうる */
+static int nBlks;
+
+static VKey *vals;          /* 値番号iの形はvals[i] */
+static int nVal, maxVal;
+static int hashHead[HASHSIZE], *hashNext;
+static Occ *occs;
+static int nOcc, maxOcc;
+static Ver *vers;
+static int nVer, maxVer;
+static int stamp;           /* 版の番号 */
+static int epoch;           /* 最後に呼び出しで無効にした版の番号 */
+static int nCalls, nRefs;   /* 評価した呼び出し、変数の参照の数 */
+static int stmtCalls;       /* 文の評価を始めたときのnCalls */
+
+static Node **reg;          /* 基本ブロックの文の並び */
+static int nReg, maxReg;
+static int *uses, *firstOcc;
+
+/* 内部のブロックから参照されるこのブロックの変数に印をつける */
+static void markShared(Node *n)
+{
+	int i, k;
+	if (n == NULL)
+		return;
+	switch (n->kind) {
+	case VarN:
+	case ArrN:
+	case AssignN:
+	case AssignArrN:
+		k = n->u.addr.addr + nPars;
+		if (n->u.addr.level == blk->u.blk->level && 0 <= k && k < nShared)
+			shared[k] = 1;
+		break;
+	case BlockN:
+		markShared(n->u.blk->body);
+		break;
+	default:
+		break;
+	}
+	for (i = 0; i < n->nKid; i++)
+		markShared(n->kid[i]);
+}
+
+/* 文や式nがブロックbの外の変数に代入するか、そうしうる関数を呼ぶか */
+static int writesOuter(Node *n, Node *b)
+{
+	int i;
+	if (n == NULL)
+		return 0;
+	switch (n->kind) {
+	case AssignN:
+	case AssignArrN:
+		if (n->u.addr.level != b->u.blk->level)
+			return 1;
+		break;
+	case CallN:
+	case CallStN:
+	case ParForN:
+		if (writes[n->u.call.blk->u.blk->id])
+			return 1;
+		break;
+	default:
+		break;
+	}
+	for (i = 0; i < n->nKid; i++)
+		if (writesOuter(n->kid[i], b))
+			return 1;
+	return 0;
+}
+
+/* 各ブロックがブロックの外の変数に代入しうるかを、呼び出しをたどって求める */
+static int findWrites()
+{
+	int id, changed;
+	Node *b;
+	for (nBlks = 0; blockOf(nBlks) != NULL; nBlks++)
+		;
+	if ((writes = calloc(nBlks > 0 ? nBlks : 1, 1)) == NULL)
+		return 0;
+	do {
+		changed = 0;
+		for (id = 0; id < nBlks; id++) {
+			b = blockOf(id);
+			if (!writes[id] && writesOuter(b->u.blk->body, b)) {
+				writes[id] = 1;
+				changed = 1;
+			}
+		}
+	} while (changed);
+	return 1;
+}
+
+/* 変数aが内部のブロックからも呼び出し先からも見えないこのブロックの変数か */
+static int private(RelAddr a)
+{
+	int k = a.addr + nPars;
+	return a.level == blk->u.blk->level && !(0 <= k && k < nShared && shared[k]);
+}
+
+/* 変数aの今の版 */
+static int version(RelAddr a)
+{
+	int i, v = 0;
+	for (i = 0; i < nVer; i++)
+		if (vers[i].a.level == a.level && vers[i].a.addr == a.addr) {
+			v = vers[i].v;
+			break;
+		}
+	if (!private(a) && v < epoch)
+		v = epoch;                  /* 呼び出しで変わったかもしれない */
+	return v;
+}
+
+/* 変数aへの代入 */
+static void assign(RelAddr a)
+{
+	int i;
+	for (i = 0; i < nVer; i++)
+		if (vers[i].a.level == a.level && vers[i].a.addr == a.addr)
+			break;
+	if (i == nVer) {
+		if (nVer == maxVer) {
+			maxVer = maxVer ? maxVer * 2 : 64;
+			vers = realloc(vers, maxVer * sizeof(Ver));
+		}
+		vers[nVer++].a = a;
+	}
+	vers[i].v = ++stamp;
+}
+
+/* 形kの値の値番号(なければ新しく付ける) */
+static int valueOf(VKey *k)
+{
+	unsigned h = ((unsigned)k->kind * 31 + k->op) * 31;
+	int i;
+	h = ((h + k->a) * 31 + k->b) * 31 + k->c;
+	h %= HASHSIZE;
+	for (i = hashHead[h]; i >= 0; i = hashNext[i])
+		if (memcmp(&vals[i], k, sizeof(VKey)) == 0)
+			return i;
+	if (nVal == maxVal) {
+		maxVal = maxVal ? maxVal * 2 : 256;
+		vals = realloc(vals, maxVal * sizeof(VKey));
+		hashNext = realloc(hashNext, maxVal * sizeof(int));
+	}
+	vals[nVal] = *k;
+	hashNext[nVal] = hashHead[h];
+	hashHead[h] = nVal;
+	return nVal++;
+}
+
+/* 呼び出しがあれば、呼び出し先がブロックの外の変数に代入しうるならその値を無効にする */
+static void call(Node *n)
+{
+	nCalls++;
+	if (writes[n->u.call.blk->u.blk->id])
+		epoch = ++stamp;
+}
+
+/* 式*npを評価の順にたどって値番号を付ける(*costに式の命令語の数を返す) */
+static int walk(Node **np, int stmt, int *cost)
+{
+	Node *n = *np;
+	VKey k;
+	int i, c0, c1, calls = nCalls, refs = nRefs, t;
+
+	memset(&k, 0, sizeof(k));
+	*cost = 1;
+	if (n == NULL) {
+		k.kind = SeqN;
+		k.a = ++stamp;
+		return valueOf(&k);
+	}
+	k.kind = n->kind;
+	switch (n->kind) {
+	case NumN:
+		k.a = n->u.value;
+		return valueOf(&k);
+	case VarN:
+		nRefs++;
+		k.a = n->u.addr.level;
+		k.b = n->u.addr.addr;
+		k.c = version(n->u.addr);
+		return valueOf(&k);
+	case ArrN:
+		k.op = walk(&n->kid[0], stmt, &c0);
+		nRefs++;
+		k.a = n->u.addr.level;
+		k.b = n->u.addr.addr;
+		k.c = version(n->u.addr);
+		*cost = c0 + 1;
+		break;
+	case UnN:
+		k.op = n->u.optr;
+		k.a = walk(&n->kid[0], stmt, &c0);
+		*cost = c0 + 1;
+		break;
+	case BinN:
+		k.op = n->u.optr;
+		k.a = walk(&n->kid[0], stmt, &c0);
+		k.b = walk(&n->kid[1], stmt, &c1);
+		if ((n->u.optr == add || n->u.optr == mul) && k.a > k.b) {
+			t = k.a;                    /* 交換できる演算は引数の順を揃える */
+			k.a = k.b;
+			k.b = t;
+		}
+		*cost = c0 + c1 + 1;
+		break;
+	case CallN:
+		for (i = 0; i < n->nKid; i++)
+			walk(&n->kid[i], stmt, &c0);
+		call(n);
+		k.a = ++stamp;                  /* 呼び出しの値はいつも別の値 */
+		return valueOf(&k);
+	default:
+		for (i = 0; i < n->nKid; i++)
+			walk(&n->kid[i], stmt, &c0);
+		k.a = ++stamp;
+		return valueOf(&k);
+	}
+	i = valueOf(&k);
+	if (nCalls == calls && nRefs > refs) {    /* 呼び出しを含まず、定数だけでもない */
+		if (nOcc == maxOcc) {
+			maxOcc = maxOcc ? maxOcc * 2 : 256;
+			occs = realloc(occs, maxOcc * sizeof(Occ));
+		}
+		occs[nOcc].vn = i;
+		occs[nOcc].np = np;
+		occs[nOcc].stmt = stmt;
+		occs[nOcc].afterCall = nCalls > stmtCalls;
+		occs[nOcc].cost = *cost;
+		nOcc++;
+	}
+	return i;
+}
+
+/* 文sを評価の順にたどる */
+static void walkStmt(Node *s, int stmt)
+{
+	int i, c;
+	stmtCalls = nCalls;
+	switch (s->kind) {
+	case AssignN:
+		walk(&s->kid[0], stmt, &c);
+		assign(s->u.addr);
+		break;
+	case AssignArrN:
+		walk(&s->kid[0], stmt, &c);
+		walk(&s->kid[1], stmt, &c);
+		assign(s->u.addr);
+		break;
+	case CallStN:
+		for (i = 0; i < s->nKid; i++)
+			walk(&s->kid[i], stmt, &c);
+		call(s);
+		break;
+	case WriteN:
+	case RetN:
+		if (s->nKid > 0)
+			walk(&s->kid[0], stmt, &c);
+		break;
+	default:
+		break;
+	}
+}
+
+/* 基本ブロックregの共通部分式を一つ除く(除いたら1を返す) */
+static int cseOnce()
+{
+	int i, v, s, save, best = -1, bestSave = 0;
+	Node *a, *x;
+	RelAddr t;
+
+	nVal = nOcc = nVer = nCalls = nRefs = 0;
+	stamp = epoch = 0;
+	for (i = 0; i < HASHSIZE; i++)
+		hashHead[i] = -1;
+	for (s = 0; s < nReg; s++)
+		walkStmt(reg[s], s);
+	if (nOcc < 2)
+		return 0;
+	uses = realloc(uses, nVal * sizeof(int));
+	firstOcc = realloc(firstOcc, nVal * sizeof(int));
+	for (v = 0; v < nVal; v++)
+		uses[v] = 0;
+	for (i = 0; i < nOcc; i++)
+		if (uses[v = occs[i].vn]++ == 0)
+			firstOcc[v] = i;
+	/* 命令語の数は uses*cost から cost+1(計算と代入) + uses(読み出し) になる */
+	for (v = 0; v < nVal; v++) {
+		if (uses[v] < 2 || occs[firstOcc[v]].afterCall)
+			continue;
+		i = occs[firstOcc[v]].cost;
+		save = uses[v] * i - i - 1 - uses[v];
+		if (save > bestSave) {
+			best = v;
+			bestSave = save;
+		}
+	}
+	if (best < 0)
+		return 0;
+
+	t.level = blk->u.blk->level;
+	t.addr = blk->u.blk->frame++;            /* 一時変数 */
+	i = firstOcc[best];
+	s = occs[i].stmt;
+	a = newNode1(AssignN, *occs[i].np);
+	a->u.addr = t;
+	a->line = reg[s]->line;
+	for (; i < nOcc; i++)
+		if (occs[i].vn == best) {
+			x = newNode(VarN, 0);
+			x->u.addr = t;
+			x->line = (*occs[i].np)->line;
+			*occs[i].np = x;
+		}
+	if (nReg == maxReg) {
+		maxReg = maxReg * 2;
+		reg = realloc(reg, maxReg * sizeof(Node *));
+	}
+	memmove(reg + s + 1, reg + s, (nReg - s) * sizeof(Node *));
+	reg[s] = a;                             /* 最初に現れる文の前で計算する */
+	nReg++;
+	return 1;
+}
+
+/* 基本ブロックregの共通部分式を除き、文を子として集める */
+static void flush()
+{
+	int i;
+	while (cseOnce())
+		;
+	for (i = 0; i < nReg; i++)
+		pushKid(reg[i]);
+	nReg = 0;
+}
+
+/* 基本ブロックに入る文か */
+static int simple(Node *n)
+{
+	switch (n->kind) {
+	case AssignN:
+	case AssignArrN:
+	case CallStN:
+	case WriteN:
+	case WriteLnN:
+	case RetN:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* 基本ブロックに文nを加える */
+static void addReg(Node *n)
+{
+	if (nReg == maxReg) {
+		maxReg = maxReg ? maxReg * 2 : 64;
+		reg = realloc(reg, maxReg * sizeof(Node *));
+	}
+	reg[nReg++] = n;
+}
+
+/* 文*npの中の基本ブロックの共通部分式を除く */
+static void optStmt(Node **np)
+{
+	Node *n = *np;
+	int i, mark;
+	if (n == NULL || n->kind < AssignN || n->kind == BlockN)
+		return;
+	if (simple(n)) {                        /* if文やループの中の文一つ */
+		addReg(n);
+		while (cseOnce())
+			;
+		if (nReg > 1) {
+			mark = kidMark();
+			flush();
+			*np = endKids(newNode(BeginN, 0), mark);
+			(*np)->line = n->line;
+		}
+		nReg = 0;
+		return;
+	}
+	if (n->kind != BeginN) {
+		for (i = 0; i < n->nKid; i++)
+			optStmt(&n->kid[i]);
+		return;
+	}
+	mark = kidMark();
+	for (i = 0; i < n->nKid; i++) {
+		if (n->kid[i] != NULL && simple(n->kid[i])) {
+			addReg(n->kid[i]);
+			continue;
+		}
+		flush();
+		optStmt(&n->kid[i]);
+		pushKid(n->kid[i]);
+	}
+	flush();
+	endKids(n, mark);
+}
+
+/* ブロックbとその内部のブロックの共通部分式の除去 */
+static void optBlock(Node *b)
+{
+	int i;
+	for (i = 0; i < b->nKid; i++)
+		optBlock(b->kid[i]);
+	blk = b;
+	nPars = b->u.blk->level == 0 ? 0 : b->u.blk->pars;
+	nShared = nPars + b->u.blk->frame;
+	if ((shared = calloc(nShared > 0 ? nShared : 1, 1)) == NULL)
+		return;
+	for (i = 0; i < b->nKid; i++)
+		markShared(b->kid[i]);
+	optStmt(&b->u.blk->body);
+	free(shared);
+}
+
+/* 構文木の上での共通部分式の除去 */
+void optimizeCSE(Node *prog)
+{
+	double t = statsMode ? statsClock() : 0;
+	if (findWrites())
+		optBlock(prog);
+	free(writes);
+	free(vals); free(hashNext); free(occs); free(vers);
+	free(reg); free(uses); free(firstOcc);
+	writes = NULL;
+	vals = NULL; hashNext = NULL; occs = NULL; vers = NULL;
+	reg = NULL; uses = firstOcc = NULL;
+	maxVal = maxOcc = maxVer = maxReg = 0;
+	if (statsMode)
+		stats.time[optPh] += statsClock() - t;
+}
@@ -0,0 +1,9 @@
+/********** cse.h **********/
+#ifndef CSE_H_
+#define CSE_H_
+
+#include "ast.h"
+
+void optimizeCSE(Node *prog);    /* 構文木の上での共通部分式の除去 */
+
+#endif
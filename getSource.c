@@ -3,19 +3,28 @@
 #include <stdlib.h>
 #include <string.h>
 #include "getSource.h"
+#include "stats.h"
 
+#ifndef MAXLINE
 #define MAXLINE  120          /* １行の最大文字数 */
+#endif
 #define MAXERROR 30           /* これ以上のエラーがあったら終り */
 #define MAXNUM   14           /* 定数の最大桁数 */
 #define TAB      5            /* タブのスペース */
 #define INSERT_C "#0000FF"    /* 挿入文字の色 */
 #define DELETE_C "#FF0000"    /* 削除文字の色 */
 #define TYPE_C   "#00FF00"    /* タイプエラー文字の色 */
+#define NOTE_C   "#808080"    /* 注意書きの色 */
+#define HEATW    10           /* ヒートマップの実行回数の欄の幅 */
 
 static FILE *fpi;                /* ソースファイル */
 static FILE *fptex;              /* LaTeX出力ファイル */
+static char fileNameO[FILENAME_MAX];    /* .html(または.tex)ファイルの名前 */
 static char line[MAXLINE];       /* １行分の入力バッファー */
 static int lineIndex;            /* 次に読む文字の位置 */
+static int lineNo;               /* 読んでいる行の番号 */
+static int tokenLine;            /* 最後に読んだトークンの行番号 */
+static int prevLine;             /* その一つ前のトークンの行番号 */
 static char ch;                  /* 最後に読んだ文字 */
 
 static Token cToken;             /* 最後に読んだトークン */
@@ -26,6 +35,7 @@ static int printed;              /* トークンは印字済みか */
 
 static int errorNo = 0;          /* 出力したエラーの数 */
 static char nextChar();          /* 次の文字を読む関数 */
+static Token readToken();        /* 次のトークンを読む関数 */
 static int isKeySym(KeyId k);    /* tは記号か? */
 static int isKeyWd(KeyId k);     /* tは予約語か? */
 static void printSpaces();       /* トークンの前のスペースの印字 */
@@ -50,6 +60,7 @@ static struct keyWd KeyWdT[] = {
 	{ "repeat", Repeat },
 	{ "until", Until },
 	{ "for", For },
+	{ "parallel", Parallel },
 	{ "function", Func },
 	{ "procedure", Proc },
 	{ "call", Call },
@@ -125,7 +136,10 @@ static void initCharClassT()
 /* ソースファイルのopen */
 int openSource(char fileName[])
 {
-	char fileNameO[30];
+	if (strlen(fileName) + sizeof(".html") > sizeof(fileNameO)) {
+		printf("too long file name %s\n", fileName);
+		return 0;
+	}
 	if ((fpi = fopen(fileName,"r")) == NULL) {
 		printf("can't open %s\n", fileName);
 		return 0;
@@ -141,6 +155,7 @@ int openSource(char fileName[])
 	/* .html(または.tex)ファイルを作る */
 	if ((fptex = fopen(fileNameO, "w")) == NULL) {
 		printf("can't open %s\n", fileNameO);
+		fclose(fpi);
 		return 0;
 	}
 	return 1;
@@ -156,6 +171,7 @@ void closeSource()
 void initSource()
 {
 	lineIndex = -1;    /* 初期設定 */
+	lineNo = 0;  tokenLine = 0;  prevLine = 0;
 	ch = '\n';
 	printed = 1;
 	initCharClassT();
@@ -390,6 +406,17 @@ void errorMessage(char *m)
 	errorNoCheck();
 }
 
+/* エラーでない注意書き(最適化をしなかった理由など)を.html(または.tex)ファイルに出力.
+   エラーの個数には数えない */
+void noteMessage(char *m)
+{
+#if defined(LATEX)
+	fprintf(fptex, "$^{\\it %s}$", m);
+#else
+	fprintf(fptex, "<FONT COLOR=%s>%s</FONT>", NOTE_C, m);
+#endif
+}
+
 /* エラーメッセージを出力し、コンパイル終了 */
 void errorF(char *m)
 {
@@ -421,6 +448,7 @@ char nextChar()
 		if (fgets(line, MAXLINE, fpi) != NULL) {
 			// puts(line);                     /* 通常のエラーメッセージの出力の場合(参考まで) */
 			lineIndex = 0;
+			lineNo++;
 		} else {
 			errorF("end of file\n");           /* end of fileならコンパイル終了 */
 		}
@@ -434,13 +462,31 @@ char nextChar()
 
 /* 次のトークンを読んで返す関数 */
 Token nextToken()
+{
+	Token temp;
+	double t0, t1;
+	stats.tokens++;
+	if (statsMode == noStats) {
+		printcToken();          /* 前のトークンを印字 */
+		return readToken();
+	}
+	t0 = statsClock();          /* 印字と字句解析の時間を分けて計る */
+	printcToken();
+	t1 = statsClock();
+	temp = readToken();
+	stats.time[listPh] += t1 - t0;
+	stats.time[lexPh] += statsClock() - t1;
+	return temp;
+}
+
+/* 次のトークンを読む関数(前のトークンは印字済み) */
+Token readToken()
 {
 	int i = 0;
 	int num;
 	KeyId cc;
 	Token temp;
 	char ident[MAXNAME];
-	printcToken();          /* 前のトークンを印字 */
 	spaces = 0; CR = 0;
 	while (1) {             /* 次のトークンまでの空白や改行をカウント */
 		if (ch == ' ')
@@ -453,6 +499,8 @@ Token nextToken()
 		else break;
 		ch = nextChar();
 	}
+	prevLine = tokenLine;   /* トークンの始まりの行を覚えておく */
+	tokenLine = lineNo;
 	switch (cc = charClassT[ch]) {
 	case letter:  /* identifier */
 		do {
@@ -688,3 +736,88 @@ void setIdKind(KindT k)
 {
 	idKind = k;
 }
+
+/* 今生成している命令語に対応するソースの行(直前に読み終えたトークンの行) */
+int sourceLine()
+{
+	return prevLine;
+}
+
+/* ソースの行数 */
+int sourceLines()
+{
+	return lineNo;
+}
+
+/*
+ * 実行後に.htmlファイルの各行に実行回数を付け、回数に応じて背景に色を付ける
+ * count[i]はi行目の実行回数(0 <= i <= n). closeSource()の後で呼ぶ.
+ * .htmlのPRE部分は1行目が空行で、その後はソースの行と1対1に対応している.
+ */
+void heatSource(long count[], int n)
+{
+#if defined(LATEX)
+	printf("; heat map is not supported for .tex\n");
+#else
+	FILE *fp;
+	char *buf, *s, *e;
+	long size, max = 0, c;
+	int i, ln = -1, level, bits, maxBits;
+
+	if ((fp = fopen(fileNameO, "r")) == NULL)
+		return;
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	rewind(fp);
+	if ((buf = malloc(size + 1)) == NULL) {
+		fclose(fp);
+		return;
+	}
+	size = fread(buf, 1, size, fp);
+	buf[size] = '\0';
+	fclose(fp);
+	if ((fp = fopen(fileNameO, "w")) == NULL) {
+		free(buf);
+		return;
+	}
+	for (i = 0; i <= n; i++)
+		if (count[i] > max)
+			max = count[i];
+	for (maxBits = 0; max >> maxBits; maxBits++)
+		;
+
+	for (s = buf; *s; s = e) {
+		if ((e = strchr(s, '\n')) != NULL)
+			e++;
+		else
+			e = s + strlen(s);
+		if (ln < 0) {                                     /* PRE部分の前はそのまま */
+			fwrite(s, 1, e - s, fp);
+			if (strncmp(s, "<PRE>", 5) == 0)
+				ln = 0;
+			continue;
+		}
+		if (strncmp(s, "</PRE>", 6) == 0) {               /* PRE部分の後もそのまま */
+			fputs(s, fp);
+			break;
+		}
+		if (ln >= 1 && ln <= n && count[ln] > 0) {
+			/* 回数のおよその対数(ビット数)で白(1回)から赤(最大)までの色を付ける */
+			for (bits = 0, c = count[ln]; c >> bits; bits++)
+				;
+			level = maxBits > 1 ? 255 * (bits - 1) / (maxBits - 1) : 255;
+			fprintf(fp, "<SPAN STYLE=\"background-color:#FF%02X%02X\">%*ld | ",
+				255 - level, 255 - level, HEATW, count[ln]);
+			fwrite(s, 1, e - s - (e[-1] == '\n'), fp);
+			fprintf(fp, "</SPAN>%s", e[-1] == '\n' ? "\n" : "");
+		}
+		else {
+			fprintf(fp, "%*s | ", HEATW, "");
+			fwrite(s, 1, e - s, fp);
+		}
+		ln++;
+	}
+	fclose(fp);
+	free(buf);
+#endif
+}
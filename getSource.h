@@ -16,6 +16,7 @@ typedef enum keys {
 	While, Do,
 	Repeat, Until,
 	For,
+	Parallel,
 	Func,
 	Proc,
 	Call,
@@ -68,9 +69,14 @@ void errorMissingId();              /* 名前がないとのメッセージを.t
 void errorMissingOp();              /* 演算子がないとのメッセージを.texファイルに挿入 */
 void errorDelete();                 /* 今読んだトークンを読み捨て(.texファイルに出力)*/
 void errorMessage(char *m);         /* エラーメッセージを.texファイルに出力 */
+void noteMessage(char *m);          /* エラーでない注意書きを.texファイルに出力(エラーの個数に数えない) */
 void errorF(char *m);               /* エラーメッセージを出力し、コンパイル終了 */
 int errorN();                       /* エラーの個数を返す */
 
+int sourceLine();                   /* 今生成している命令語に対応するソースの行 */
+int sourceLines();                  /* ソースの行数 */
+void heatSource(long count[], int n);    /* 行ごとの実行回数を.htmlファイルに書き込む(closeSourceの後) */
+
 void setIdKind(KindT k);            /* 現トークン(Id)の種類をセット(.texファイル出力のため)*/
 
 #endif
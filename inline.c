@@ -0,0 +1,373 @@
+/********** inline.c **********/
+/*
+ * 関数と手続きのインライン展開(-O)
+ *
+ * 再帰しない小さな関数と手続きの呼び出しを、構文木の上で呼び出し先の主文の
+ * 複製に置き換える. 呼び出し先から先に展開するので、展開した主文の中の
+ * 呼び出しも展開済みになる.
+ *   - 式の中の関数呼び出しは、主文が return 式 だけで、その式に呼び出しが
+ *     なければ、パラメタを実引数に置き換えた式にする. 二度以上使うパラメタの
+ *     実引数は定数か変数に限る
+ *   - call文、x := f(...), write f(...), return f(...) は、実引数を一時変数に
+ *     代入する文、主文(最後のreturn文を除く)、最後のreturn文の式を使う元の文の
+ *     並びにする. return文が最後以外にある関数と手続きは展開しない
+ * 呼び出し先のパラメタと局所変数は、呼び出し元のブロックの新しい局所変数に
+ * 付け替える(局所変数の並びはそのまま移すので配列もそのまま使える). それより
+ * 外のレベルの変数は、呼び出し元が呼び出し先の外側のブロックの中にあれば
+ * ディスプレイが同じなので番地を変えずに使える. 内部に関数を持つ関数は
+ * 展開しない.
+ * 大きさは主文の節点の数で測り、inlineMax(--inline=n)を超えるものは展開しない.
+ */
+#include <stdio.h>
+#include <stddef.h>
+#include "ast.h"
+#include "inline.h"
+#include "stats.h"
+
+/* stdlib.hはOperatorのdivと衝突するので読まない */
+extern void *calloc(size_t n, size_t size);
+extern void free(void *p);
+
+#define FIRSTADDR 2         /* 各ブロックの最初の変数のアドレス(compile.cと同じ) */
+
+int inlineMax = 30;
+
+static int nBlks;
+static Node **parent;       /* parent[id]は外側のブロック */
+static char *state;         /* 0:未処理、1:処理中、2:処理済み */
+static char *recursive;     /* 自分を呼び出しうるブロックか */
+static int *num, *low;      /* 強連結成分を求めるための訪問順と、たどれる最小の訪問順 */
+static Node **stk;          /* 強連結成分を求めるためのスタック */
+static int nStk, nNum;
+
+static Node *blk;           /* 展開先のブロック */
+
+/* 付け替えの情報 */
+static Node *callee;        /* 呼び出し先 */
+static Node **args;         /* 式の展開で置き換える実引数(文の展開ではNULL) */
+static int parBase;         /* パラメタを移す番地 */
+static int locBase;         /* 局所変数を移す番地 */
+
+/* 外側のブロックを記録する */
+static void findParents(Node *b)
+{
+	int i;
+	for (i = 0; i < b->nKid; i++) {
+		parent[b->kid[i]->u.blk->id] = b;
+		findParents(b->kid[i]);
+	}
+}
+
+static void strong(Node *b);
+
+/* ブロックbの主文nの中の呼び出しをたどる */
+static void strongCalls(Node *n, Node *b)
+{
+	int i, id = b->u.blk->id, c;
+	if (n == NULL)
+		return;
+	if (n->kind == CallN || n->kind == CallStN) {
+		c = n->u.call.blk->u.blk->id;
+		if (c == id)
+			recursive[id] = 1;      /* 自分を直接呼ぶ */
+		else if (num[c] == 0) {
+			strong(n->u.call.blk);
+			if (low[c] < low[id])
+				low[id] = low[c];
+		}
+		else if (num[c] > 0 && num[c] < low[id])    /* スタックにある(num[c] < 0 は処理済み) */
+			low[id] = num[c];
+	}
+	for (i = 0; i < n->nKid; i++)
+		strongCalls(n->kid[i], b);
+}
+
+/* 呼び出しの強連結成分(Tarjanの方法)で、二つ以上のブロックの成分を再帰とする */
+static void strong(Node *b)
+{
+	int id = b->u.blk->id, k;
+	Node *x;
+	num[id] = low[id] = ++nNum;
+	stk[nStk++] = b;
+	strongCalls(b->u.blk->body, b);
+	if (low[id] != num[id])
+		return;
+	k = nStk;
+	do {
+		x = stk[--nStk];
+		num[x->u.blk->id] = -1;
+		if (stk[k - 1] != b)
+			recursive[x->u.blk->id] = 1;
+	} while (x != b);
+}
+
+/* 節点の数 */
+static int size(Node *n)
+{
+	int i, s = 1;
+	if (n == NULL)
+		return 0;
+	for (i = 0; i < n->nKid; i++)
+		s += size(n->kid[i]);
+	return s;
+}
+
+/* nの中に呼び出しがあるか */
+static int hasCall(Node *n)
+{
+	int i;
+	if (n == NULL)
+		return 0;
+	if (n->kind == CallN || n->kind == CallStN)
+		return 1;
+	for (i = 0; i < n->nKid; i++)
+		if (hasCall(n->kid[i]))
+			return 1;
+	return 0;
+}
+
+/* nの中のreturn文の数 */
+static int countRet(Node *n)
+{
+	int i, r;
+	if (n == NULL)
+		return 0;
+	r = n->kind == RetN;
+	for (i = 0; i < n->nKid; i++)
+		r += countRet(n->kid[i]);
+	return r;
+}
+
+/* nの中で変数(level, addr)を参照する数 */
+static int uses(Node *n, int level, int addr)
+{
+	int i, u = 0;
+	if (n == NULL)
+		return 0;
+	if ((n->kind == VarN || n->kind == ArrN) && n->u.addr.level == level && n->u.addr.addr == addr)
+		u = 1;
+	for (i = 0; i < n->nKid; i++)
+		u += uses(n->kid[i], level, addr);
+	return u;
+}
+
+/* ブロックcの呼び出しを展開先のブロックで展開できるか */
+static int inlinable(Node *c)
+{
+	Node *b;
+	if (c->nKid > 0 || recursive[c->u.blk->id] || size(c->u.blk->body) > inlineMax)
+		return 0;
+	for (b = blk; b != NULL; b = parent[b->u.blk->id])
+		if (b == parent[c->u.blk->id])
+			return 1;               /* 展開先が呼び出し先の外側のブロックの中にある */
+	return 0;
+}
+
+/* 主文の最後の文 */
+static Node *lastStmt(Node *body)
+{
+	if (body != NULL && body->kind == BeginN)
+		return body->nKid > 0 ? body->kid[body->nKid - 1] : NULL;
+	return body;
+}
+
+/* 呼び出し先の節点nを展開先に移した複製 */
+static Node *remap(Node *n)
+{
+	Node *c;
+	int i, pars = callee->u.blk->pars;
+	if (n == NULL)
+		return NULL;
+	if (n->kind == VarN && args != NULL && n->u.addr.level == callee->u.blk->level && n->u.addr.addr < 0)
+		return copyNode(args[n->u.addr.addr + pars]);    /* パラメタを実引数に置き換える */
+	c = newNode(n->kind, n->nKid);
+	c->line = n->line;
+	c->u = n->u;
+	switch (n->kind) {
+	case VarN:
+	case ArrN:
+	case AssignN:
+	case AssignArrN:
+		if (n->u.addr.level != callee->u.blk->level)
+			break;
+		c->u.addr.level = blk->u.blk->level;
+		if (n->u.addr.addr < 0)
+			c->u.addr.addr = parBase + n->u.addr.addr + pars;
+		else
+			c->u.addr.addr = locBase + n->u.addr.addr - FIRSTADDR;
+		break;
+	default:
+		break;
+	}
+	for (i = 0; i < n->nKid; i++)
+		c->kid[i] = remap(n->kid[i]);
+	return c;
+}
+
+/* 関数呼び出しnを式に展開できればその式を返す */
+static Node *inlineExpr(Node *n)
+{
+	Node *c = n->u.call.blk, *r = c->u.blk->body, *e;
+	int i, u, level = c->u.blk->level, pars = c->u.blk->pars;
+
+	while (r != NULL && r->kind == BeginN && r->nKid == 1)
+		r = r->kid[0];
+	if (r == NULL || r->kind != RetN || r->nKid != 1 || r->kid[0] == NULL || !inlinable(c))
+		return NULL;
+	e = r->kid[0];
+	if (hasCall(e))
+		return NULL;
+	for (i = FIRSTADDR; i < c->u.blk->frame; i++)
+		if (uses(e, level, i))
+			return NULL;            /* 初期化されていない局所変数を読む */
+	for (i = 0; i < pars; i++) {
+		if (hasCall(n->kid[i]))
+			return NULL;
+		u = uses(e, level, i - pars);
+		if (u > 1 && n->kid[i]->kind != NumN && n->kid[i]->kind != VarN)
+			return NULL;
+	}
+	callee = c;
+	args = n->kid;
+	return remap(e);
+}
+
+/* 文*npの呼び出し(callは呼び出しの節点)を文の並びに展開する */
+static void inlineStmt(Node **np, Node *call)
+{
+	Node *s = *np, *c = call->u.call.blk, *body = c->u.blk->body, *last = lastStmt(body), *a;
+	int i, mark, nRet = countRet(body);
+
+	if (!inlinable(c))
+		return;
+	if (c->u.blk->isProc ? nRet > 1 || (nRet == 1 && (last == NULL || last->kind != RetN))
+			: nRet != 1 || last->kind != RetN || last->nKid != 1 || last->kid[0] == NULL)
+		return;
+	callee = c;
+	args = NULL;
+	parBase = blk->u.blk->frame;
+	locBase = parBase + c->u.blk->pars;
+	blk->u.blk->frame = locBase + c->u.blk->frame - FIRSTADDR;
+	mark = kidMark();
+	for (i = 0; i < call->nKid; i++) {      /* 実引数をパラメタを移した変数に代入する */
+		a = newNode1(AssignN, call->kid[i]);
+		a->u.addr.level = blk->u.blk->level;
+		a->u.addr.addr = parBase + i;
+		a->line = s->line;
+		pushKid(a);
+	}
+	if (body != NULL && body->kind == BeginN) {
+		for (i = 0; i < body->nKid; i++)
+			if (body->kid[i] != last || last->kind != RetN)
+				pushKid(remap(body->kid[i]));
+	}
+	else if (body != NULL && body->kind != RetN)
+		pushKid(remap(body));
+	if (s->kind != CallStN) {               /* 最後のreturn文の式を元の文で使う */
+		s->kid[0] = remap(last->kid[0]);
+		pushKid(s);
+	}
+	*np = endKids(newNode(BeginN, 0), mark);
+	(*np)->line = s->line;
+}
+
+/* 式*npの中の関数呼び出しを展開する */
+static void walkExpr(Node **np)
+{
+	Node *n = *np, *e;
+	int i;
+	if (n == NULL)
+		return;
+	for (i = 0; i < n->nKid; i++)
+		walkExpr(&n->kid[i]);
+	if (n->kind == CallN && (e = inlineExpr(n)) != NULL)
+		*np = e;
+}
+
+/* 文*npの中の呼び出しを展開する */
+static void walkStmt(Node **np)
+{
+	Node *n = *np;
+	int i;
+	if (n == NULL || n->kind == BlockN)
+		return;
+	for (i = 0; i < n->nKid; i++) {
+		if (n->kid[i] != NULL && n->kid[i]->kind < AssignN)
+			walkExpr(&n->kid[i]);
+		else
+			walkStmt(&n->kid[i]);
+	}
+	switch (n->kind) {
+	case CallStN:
+		inlineStmt(np, n);
+		break;
+	case AssignN:
+	case WriteN:
+	case RetN:
+		if (n->nKid == 1 && n->kid[0] != NULL && n->kid[0]->kind == CallN)
+			inlineStmt(np, n->kid[0]);
+		break;
+	default:
+		break;
+	}
+}
+
+/* nの中で呼び出されるブロックを先に処理する */
+static void visitCallees(Node *n);
+
+/* ブロックbの呼び出しを展開する(呼び出し先を先に展開する) */
+static void visit(Node *b)
+{
+	int id = b->u.blk->id;
+	if (state[id] != 0)
+		return;
+	state[id] = 1;
+	visitCallees(b->u.blk->body);
+	blk = b;
+	walkStmt(&b->u.blk->body);
+	state[id] = 2;
+}
+
+static void visitCallees(Node *n)
+{
+	int i;
+	if (n == NULL)
+		return;
+	if (n->kind == CallN || n->kind == CallStN)
+		visit(n->u.call.blk);
+	for (i = 0; i < n->nKid; i++)
+		visitCallees(n->kid[i]);
+}
+
+/* 小さな関数と手続きの呼び出しをその場に展開する */
+void inlineCalls(Node *prog)
+{
+	double t = statsMode ? statsClock() : 0;
+	int id;
+
+	for (nBlks = 0; blockOf(nBlks) != NULL; nBlks++)
+		;
+	parent = calloc(nBlks, sizeof(Node *));
+	state = calloc(nBlks, 1);
+	recursive = calloc(nBlks, 1);
+	num = calloc(nBlks, sizeof(int));
+	low = calloc(nBlks, sizeof(int));
+	stk = calloc(nBlks, sizeof(Node *));
+	if (parent && state && recursive && num && low && stk) {
+		findParents(prog);
+		nStk = nNum = 0;
+		for (id = 0; id < nBlks; id++)
+			if (num[id] == 0)
+				strong(blockOf(id));
+		for (id = 0; id < nBlks; id++)
+			visit(blockOf(id));
+	}
+	free(parent);
+	free(state);
+	free(recursive);
+	free(num);
+	free(low);
+	free(stk);
+	if (statsMode)
+		stats.time[optPh] += statsClock() - t;
+}
@@ -0,0 +1,11 @@
+/********** inline.h **********/
+#ifndef INLINE_H_
+#define INLINE_H_
+
+#include "ast.h"
+
+extern int inlineMax;    /* 展開する関数の主文の節点の数の上限(0なら展開しない) */
+
+void inlineCalls(Node *prog);    /* 小さな関数と手続きの呼び出しをその場に展開する */
+
+#endif
@@ -0,0 +1,2060 @@
+/********** ir.c **********/
+/*
+ * 目的コードの中間表現と最適化(-O)
+ *
+ * 最初に、値がパラメタだけで決まる純粋な関数をすべて定数の実引数で呼ぶところを
+ * コンパイル時に仮想機械で実行して、その値のlitにする(純粋な関数の評価).
+ *
+ * 関数ごとに主文の目的コード(ictから最後のretまで)を基本ブロックに分けて
+ * 制御フローグラフを作り、その関数の局所変数とパラメタをSSA形式にする.
+ * スタックに積まれる値は命令語ごとに一度だけ使われるので、値を作った命令語の
+ * 位置をそのまま値の名前にする. 変数の値はその値の名前かφ関数で表す.
+ *   - 疎な条件付き定数伝播(SCCP): 定数になる式をlitに置き換え、向きの決まった
+ *     jpcをjmpにするか取り除き、実行されないブロックを取り除く
+ *   - コピー伝播: x := y のあとのxの参照を、yが変わっていなければyの参照にする
+ *   - 代数的な簡約: x+0, x*1, x*0, -(-x)などを簡単にし、2のべき乗の乗除算と
+ *     oddをシフトとマスクの命令(shl, shr, msk)にする
+ *   - 不要な代入の除去: 値が使われない代入を、式に副作用がなければ式ごと取り除く
+ * そのあとプログラム全体について
+ *   - 手続きの間の定数伝播: 同じ定数の実引数で呼ばれる関数について、パラメタを
+ *     その定数にした複製を作って最適化し、短くなれば呼び出しをそちらへ付け替える
+ *   - 番地0からjmp, jpcの飛び先とcal, pfor, spnの呼び出し先をたどって、実行されない命令語
+ *     (呼ばれない関数と手続き、ret, jmpのあとの命令語)を取り除く
+ *   - jmpへのjmp, jpcは最後の飛び先へ直接飛ばし、次の命令語へのjmpは取り除く
+ * 最後に取り除いた命令語を詰めて飛び先を付け替える(codegen.cのremoveCode).
+ * 詰めたあと関数ごとに局所変数の生きている範囲を求め、範囲の重ならない変数に
+ * 同じ番地を割り当ててictのフレームを小さくする. それから呼び出しグラフをつくり、
+ * 再帰的に呼ばれず内部のブロックを持たない関数と手続き(葉の関数はすべてこれに
+ * あたる)のフレームを主ブロックのフレームの後ろに静的にとって、軽い呼び出し命令
+ * (cals, ents, rets)を使う. 並列のfor(pfor命令)の繰り返しの手続き、仕事にした呼び出し
+ * (spn命令)の関数とそこから呼ばれるブロックは、スレッドごとにフレームが要るので静的にしない.
+ * 内部の関数から参照される変数、配列の先頭の変数はSSA形式にしない.
+ * 取り除くことにした命令語(複製に写したもの)は無いものとして扱う.
+ * 配列の添字は配列の範囲内にあるものとする. ベクトル命令のvld, vstはloda, stoaと同じく
+ * 配列の先頭の変数を参照する命令語として扱う.
+ *
+ * --memoのときは(-Oならそのあとに)再帰的に呼ばれる純粋な関数の呼び出しをcalmにして、
+ * 仮想機械が実引数の組ごとに値を覚えておく.
+ */
+#include <stdio.h>
+#include <stddef.h>
+#include "codegen.h"
+#include "ir.h"
+#include "stats.h"
+
+/* stdlib.hはOperatorのdivと衝突するので読まない */
+extern void *malloc(size_t size);
+extern void *calloc(size_t n, size_t size);
+extern void *realloc(void *p, size_t size);
+extern void free(void *p);
+
+#define EVALSTEPS 100000    /* コンパイル時に実行する呼び出し一つの命令語の数の上限 */
+
+int optMode = 0;
+int memoMode = 0;
+
+/* ブロック(主ブロック、関数、手続き)の目的コードの位置 */
+typedef struct proc {
+	int start;          /* 内部関数を飛び越すjmpの番地 */
+	int entry;          /* 開始番地(ict命令) */
+	int end;            /* 主文の目的コードの終りの次の番地 */
+	int level;          /* ブロックのレベル */
+	int pars;           /* パラメタ数 */
+	int isProc;         /* 手続きか(値を返さない) */
+	int parent;         /* 外側のブロック(主ブロックは-1) */
+} Proc;
+
+static Proc *procs = NULL;
+static int nProcs, maxProcs;
+static int *procAt;     /* procAt[番地]-1はその番地を呼び出し先とするブロック */
+static char *dead;      /* dead[番地]が真の命令語は取り除く */
+static int nCode;       /* 複製を足したあとのdead, procAtの最後の番地 */
+
+/* 定数伝播の格子の値 */
+typedef enum lattices {
+	topL,               /* まだ分からない */
+	constL,             /* 定数 */
+	botL                /* 定数でない */
+} LatKind;
+
+typedef struct lat {
+	LatKind kind;
+	int value;
+} Lat;
+
+/* 基本ブロック */
+typedef struct bblock {
+	int first, last;    /* 最初と最後の命令語の主文の中での位置 */
+	int nSucc;          /* 後続ブロックの数 */
+	int succ[2];        /* 後続ブロック(jpcならsucc[0]は飛ばないほう、succ[1]は飛ぶほう) */
+	int exec[2];        /* succ[]への辺を実行しうるか(SCCP) */
+	int nPred;          /* 先行ブロックの数 */
+	int *pred;          /* 先行ブロック(同じブロックが二度現れることもある) */
+	int rpo;            /* 逆後順の番号(入口から到達しなければ-1) */
+	int idom;           /* 直接支配するブロック */
+	int child, sibling; /* 支配木の最初の子と次の兄弟 */
+	int phi;            /* このブロックの最初のφ関数(なければ-1) */
+	int reach;          /* 実行しうるか(SCCP) */
+} BBlock;
+
+/* 最適化中の関数 */
+static Proc *cur;       /* その関数 */
+static Inst *cd;        /* 主文の目的コード(cd[p]は番地entry+pの命令語) */
+static int n;           /* 主文の命令語の数 */
+static int nSlot;       /* 変数の数(パラメタと局所変数、番地は-pars..ict-1) */
+static char *ssa;       /* ssa[s]が真の変数をSSA形式にする */
+
+static BBlock *bb;      /* 基本ブロック */
+static int nb;
+static int *bOf;        /* bOf[p]は命令語pを含むブロック */
+static int *order;      /* 逆後順に並べたブロック */
+static int nOrder;
+static int *opA, *opB;  /* 命令語pがスタックから取り出す値(なければ-1)、二項演算はopAが左 */
+static int *first;      /* 命令語pの値を計算する式の最初の命令語 */
+static int *src;        /* SSA形式の変数のlodが読む値 */
+static int *stk;        /* スタックの模擬 */
+
+/* 値の名前は 0..n-1 が命令語、n..n+nSlot-1 が変数の入口の値、それ以後がφ関数 */
+static int nPhi, maxPhi;
+static int *phiSlot, *phiBlock, *phiNext, *phiArg;    /* φ関数の変数、ブロック、次のφ関数、引数の位置 */
+static int *argPool;    /* φ関数の引数(ブロックの先行ブロックの順) */
+static int nArg, maxArg;
+static Lat *lat;        /* 値の格子の値 */
+static char *live;      /* 値が使われるか */
+static int *cur_;       /* 名前替えの時の各変数の現在の値 */
+static int *logSlot, *logVal, nLog;    /* 名前替えを元に戻すための記録 */
+
+static void *allocI(int m, int size)
+{
+	void *p = calloc(m > 0 ? m : 1, size);
+	if (p == NULL) {
+		fprintf(stderr, "optimize: out of memory\n");
+		return NULL;
+	}
+	return p;
+}
+
+/* ブロックの目的コードの位置を登録 */
+void enterProc(int start, int entry, int end, int level, int pars, int isProc)
+{
+	if (nProcs == maxProcs) {
+		maxProcs = maxProcs ? maxProcs * 2 : 64;
+		procs = realloc(procs, maxProcs * sizeof(Proc));
+	}
+	procs[nProcs].start = start;
+	procs[nProcs].entry = entry;
+	procs[nProcs].end = end;
+	procs[nProcs].level = level;
+	procs[nProcs].pars = level == 0 ? 0 : pars;    /* 主ブロックのパラメタ数は意味を持たない */
+	procs[nProcs].isProc = isProc;
+	procs[nProcs].parent = -1;
+	nProcs++;
+}
+
+/* 命令語pが読み書きするSSA形式の変数(なければ-1) */
+static int slotOf(int p)
+{
+	int s;
+	if ((cd[p].opCode != lod && cd[p].opCode != sto) || cd[p].u.addr.level != cur->level)
+		return -1;
+	s = cd[p].u.addr.addr + cur->pars;
+	return 0 <= s && s < nSlot && ssa[s] ? s : -1;
+}
+
+/* 変数にできる番地(level, addr)をSSA形式にしないことにする */
+static void escape(int addr)
+{
+	int s = addr + cur->pars;
+	if (0 <= s && s < nSlot)
+		ssa[s] = 0;
+}
+
+/* SSA形式にする変数を決める */
+static void findSlots()
+{
+	int i, s;
+	Inst *c;
+	for (s = 0; s < nSlot; s++)
+		ssa[s] = 1;
+	escape(0);                       /* ディスプレイの退避場所 */
+	escape(1);                       /* 戻り番地 */
+	/* 内部の関数(startからentryまで)から参照される変数、配列の先頭 */
+	for (i = cur->start; i < cur->end; i++) {
+		c = codeAt(i);
+		switch (c->opCode) {
+		case lod:
+		case sto:
+			if (i < cur->entry && c->u.addr.level == cur->level)
+				escape(c->u.addr.addr);
+			break;
+		case loda:
+		case stoa:
+		case vld:
+		case vst:
+			if (c->u.addr.level == cur->level)
+				escape(c->u.addr.addr);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/* 基本ブロックに分けて制御フローグラフを作る(主文の外へ出る飛び越しがあれば0を返す) */
+static int buildCFG()
+{
+	char *leader = allocI(n + 1, 1);
+	int p, b, t, k;
+
+	if (leader == NULL)
+		return 0;
+	leader[0] = 1;
+	for (p = 0; p < n; p++) {
+		if (dead[cur->entry + p])
+			continue;
+		switch (cd[p].opCode) {
+		case jmp:
+		case jpc:
+			t = cd[p].u.value - cur->entry;
+			if (t < 0 || t >= n) {
+				free(leader);
+				return 0;
+			}
+			leader[t] = 1;
+			leader[p + 1] = 1;
+			break;
+		case ret:
+		case retp:
+			leader[p + 1] = 1;
+			break;
+		default:
+			break;
+		}
+	}
+	for (nb = 0, p = 0; p < n; p++)
+		if (leader[p])
+			nb++;
+	bb = allocI(nb, sizeof(BBlock));
+	if (bb == NULL) {
+		free(leader);
+		return 0;
+	}
+	for (b = -1, p = 0; p < n; p++) {
+		if (leader[p]) {
+			bb[++b].first = p;
+			bb[b].phi = -1;
+			bb[b].rpo = -1;
+			bb[b].idom = -1;
+			bb[b].child = bb[b].sibling = -1;
+		}
+		bb[b].last = p;
+		bOf[p] = b;
+	}
+	free(leader);
+	for (b = 0; b < nb; b++) {
+		p = bb[b].last;
+		switch (dead[cur->entry + p] ? end_of_OpCode : cd[p].opCode) {
+		case jmp:
+			bb[b].nSucc = 1;
+			bb[b].succ[0] = bOf[cd[p].u.value - cur->entry];
+			break;
+		case jpc:
+			if (p + 1 >= n)
+				return 0;
+			bb[b].nSucc = 2;
+			bb[b].succ[0] = bOf[p + 1];
+			bb[b].succ[1] = bOf[cd[p].u.value - cur->entry];
+			break;
+		case ret:
+		case retp:
+			bb[b].nSucc = 0;
+			break;
+		default:
+			if (p + 1 >= n)          /* 主文の終りを越えて実行が続く */
+				return 0;
+			bb[b].nSucc = 1;
+			bb[b].succ[0] = bOf[p + 1];
+			break;
+		}
+	}
+	for (b = 0; b < nb; b++)
+		for (k = 0; k < bb[b].nSucc; k++)
+			bb[bb[b].succ[k]].nPred++;
+	for (b = 0; b < nb; b++) {
+		bb[b].pred = allocI(bb[b].nPred, sizeof(int));
+		if (bb[b].pred == NULL)
+			return 0;
+		bb[b].nPred = 0;
+	}
+	for (b = 0; b < nb; b++)
+		for (k = 0; k < bb[b].nSucc; k++) {
+			t = bb[b].succ[k];
+			bb[t].pred[bb[t].nPred++] = b;
+		}
+	return 1;
+}
+
+/* 逆後順と支配木(Cooper, Harvey, Kennedyの方法)を求める */
+static void dominators()
+{
+	int *st = allocI(nb, sizeof(int)), *nxt = allocI(nb, sizeof(int));
+	char *seen = allocI(nb, 1);
+	int sp = 0, b, i, k, a, changed, newIdom, post = nb;
+
+	/* 深さ優先で後順を求め、後ろから詰めて逆後順にする */
+	st[sp++] = 0;
+	seen[0] = 1;
+	while (sp > 0) {
+		b = st[sp - 1];
+		if (nxt[b] < bb[b].nSucc) {
+			k = bb[b].succ[nxt[b]++];
+			if (!seen[k]) {
+				seen[k] = 1;
+				st[sp++] = k;
+			}
+			continue;
+		}
+		order[--post] = b;
+		sp--;
+	}
+	nOrder = nb - post;
+	for (i = 0; i < nOrder; i++) {
+		order[i] = order[post + i];
+		bb[order[i]].rpo = i;
+	}
+	free(st);
+	free(nxt);
+	free(seen);
+
+	bb[0].idom = 0;
+	do {
+		changed = 0;
+		for (i = 1; i < nOrder; i++) {
+			b = order[i];
+			newIdom = -1;
+			for (k = 0; k < bb[b].nPred; k++) {
+				a = bb[b].pred[k];
+				if (bb[a].idom < 0)
+					continue;
+				if (newIdom < 0) {
+					newIdom = a;
+					continue;
+				}
+				while (a != newIdom) {
+					while (bb[a].rpo > bb[newIdom].rpo)
+						a = bb[a].idom;
+					while (bb[newIdom].rpo > bb[a].rpo)
+						newIdom = bb[newIdom].idom;
+				}
+			}
+			if (bb[b].idom != newIdom) {
+				bb[b].idom = newIdom;
+				changed = 1;
+			}
+		}
+	} while (changed);
+	for (i = nOrder - 1; i > 0; i--) {
+		b = order[i];
+		bb[b].sibling = bb[bb[b].idom].child;
+		bb[bb[b].idom].child = b;
+	}
+}
+
+/* ブロックbのスタックを模擬して、各命令語が取り出す値を求める(スタックが合わなければ0を返す) */
+static int simulate(int b)
+{
+	int sp = 0, p, k;
+	Proc *q;
+
+	for (p = bb[b].first; p <= bb[b].last; p++) {
+		opA[p] = opB[p] = -1;
+		first[p] = p;
+		if (dead[cur->entry + p])
+			continue;
+		switch (cd[p].opCode) {
+		case lit:
+		case lod:
+			stk[sp++] = p;
+			break;
+		case loda:
+		case shl:
+		case shr:
+		case msk:
+			if (sp < 1)
+				return 0;
+			opA[p] = stk[sp - 1];
+			first[p] = first[opA[p]];
+			stk[sp - 1] = p;
+			break;
+		case sto:
+		case jpc:
+		case vld:
+		case vst:
+		case vbc:
+			if (sp < 1)
+				return 0;
+			opA[p] = stk[--sp];
+			break;
+		case vlen:
+			stk[sp++] = p;
+			break;
+		case vlp:
+			if (sp < 2)
+				return 0;
+			opB[p] = stk[--sp];
+			opA[p] = stk[sp - 1];
+			first[p] = first[opA[p]];
+			stk[sp - 1] = p;
+			break;
+		case stoa:
+			if (sp < 2)
+				return 0;
+			opB[p] = stk[--sp];
+			opA[p] = stk[--sp];
+			break;
+		case opr:
+			switch (cd[p].u.optr) {
+			case neg:
+			case odd:
+				if (sp < 1)
+					return 0;
+				opA[p] = stk[sp - 1];
+				first[p] = first[opA[p]];
+				stk[sp - 1] = p;
+				break;
+			case wrt:
+				if (sp < 1)
+					return 0;
+				opA[p] = stk[--sp];
+				break;
+			case wrl:
+				break;
+			default:
+				if (sp < 2)
+					return 0;
+				opB[p] = stk[--sp];
+				opA[p] = stk[sp - 1];
+				first[p] = first[opA[p]];
+				stk[sp - 1] = p;
+				break;
+			}
+			break;
+		case cal:
+		case spn:
+			if ((k = procAt[cd[p].u.addr.addr]) == 0)
+				return 0;
+			q = &procs[k - 1];
+			if (sp < q->pars)
+				return 0;
+			sp -= q->pars;
+			if (q->pars > 0)
+				first[p] = first[stk[sp]];
+			if (!q->isProc)
+				stk[sp++] = p;
+			break;
+		case pfor:                   /* 初めの値、終りの値、増分からループ変数の最後の値 */
+			if (sp < 3)
+				return 0;
+			sp -= 3;
+			first[p] = first[stk[sp]];
+			stk[sp++] = p;
+			break;
+		case ret:                    /* 主ブロックのretは空のスタックから取り出す */
+			if (sp > 0)
+				opA[p] = stk[--sp];
+			break;
+		case ict:
+			if (p != 0)
+				return 0;
+			break;
+		default:
+			break;
+		}
+	}
+	return sp == 0;
+}
+
+/* ブロックbにslotのφ関数を置く */
+static int addPhi(int b, int s)
+{
+	int k = nPhi, i;
+	if (nPhi == maxPhi) {
+		maxPhi = maxPhi ? maxPhi * 2 : 64;
+		phiSlot = realloc(phiSlot, maxPhi * sizeof(int));
+		phiBlock = realloc(phiBlock, maxPhi * sizeof(int));
+		phiNext = realloc(phiNext, maxPhi * sizeof(int));
+		phiArg = realloc(phiArg, maxPhi * sizeof(int));
+		if (!phiSlot || !phiBlock || !phiNext || !phiArg)
+			return 0;
+	}
+	while (nArg + bb[b].nPred > maxArg) {
+		maxArg = maxArg ? maxArg * 2 : 256;
+		if ((argPool = realloc(argPool, maxArg * sizeof(int))) == NULL)
+			return 0;
+	}
+	phiSlot[k] = s;
+	phiBlock[k] = b;
+	phiArg[k] = nArg;
+	for (i = 0; i < bb[b].nPred; i++)
+		argPool[nArg + i] = n + s;
+	nArg += bb[b].nPred;
+	phiNext[k] = bb[b].phi;
+	bb[b].phi = k;
+	nPhi++;
+	return 1;
+}
+
+/* 代入のあるブロックの反復支配辺境にφ関数を置く */
+static int placePhis()
+{
+	int *dfHead = allocI(nb, sizeof(int)), *dfNext = NULL, *dfBlock = NULL, nDf = 0, maxDf = 0;
+	int *defHead = allocI(nSlot, sizeof(int)), *defNext = allocI(n, sizeof(int));
+	int *placed = allocI(nb, sizeof(int)), *inWork = allocI(nb, sizeof(int)), *work = allocI(nb, sizeof(int));
+	int b, i, k, r, s, p, nWork, d, ok = 1;
+
+	if (!dfHead || !defHead || !defNext || !placed || !inWork || !work)
+		ok = 0;
+	/* 支配辺境 */
+	for (b = 0; ok && b < nb; b++)
+		dfHead[b] = -1;
+	for (i = 0; ok && i < nOrder; i++) {
+		b = order[i];
+		if (bb[b].nPred < 2)
+			continue;
+		for (k = 0; k < bb[b].nPred; k++) {
+			r = bb[b].pred[k];
+			if (bb[r].rpo < 0)
+				continue;
+			while (r != bb[b].idom) {
+				if (dfHead[r] < 0 || dfBlock[dfHead[r]] != b) {
+					if (nDf == maxDf) {
+						maxDf = maxDf ? maxDf * 2 : 256;
+						dfNext = realloc(dfNext, maxDf * sizeof(int));
+						dfBlock = realloc(dfBlock, maxDf * sizeof(int));
+						if (!dfNext || !dfBlock) {
+							ok = 0;
+							break;
+						}
+					}
+					dfBlock[nDf] = b;
+					dfNext[nDf] = dfHead[r];
+					dfHead[r] = nDf++;
+				}
+				r = bb[r].idom;
+			}
+		}
+	}
+	/* 変数ごとの代入のある位置 */
+	for (s = 0; ok && s < nSlot; s++)
+		defHead[s] = -1;
+	for (p = 0; ok && p < n; p++)
+		if (bb[bOf[p]].rpo >= 0 && (s = slotOf(p)) >= 0 && cd[p].opCode == sto) {
+			defNext[p] = defHead[s];
+			defHead[s] = p;
+		}
+	for (s = 0; ok && s < nSlot; s++) {
+		if (defHead[s] < 0)
+			continue;
+		nWork = 0;
+		for (p = defHead[s]; p >= 0; p = defNext[p]) {
+			b = bOf[p];
+			if (inWork[b] != s + 1) {
+				inWork[b] = s + 1;
+				work[nWork++] = b;
+			}
+		}
+		while (ok && nWork > 0) {
+			b = work[--nWork];
+			for (d = dfHead[b]; d >= 0; d = dfNext[d]) {
+				r = dfBlock[d];
+				if (placed[r] == s + 1)
+					continue;
+				placed[r] = s + 1;
+				if (!addPhi(r, s)) {
+					ok = 0;
+					break;
+				}
+				if (inWork[r] != s + 1) {
+					inWork[r] = s + 1;
+					work[nWork++] = r;
+				}
+			}
+		}
+	}
+	free(dfHead); free(dfNext); free(dfBlock);
+	free(defHead); free(defNext);
+	free(placed); free(inWork); free(work);
+	return ok;
+}
+
+/* 変数sの現在の値をvにする */
+static void define(int s, int v)
+{
+	logSlot[nLog] = s;
+	logVal[nLog++] = cur_[s];
+	cur_[s] = v;
+}
+
+/* ブロックbのsuccへの辺が実行しうるか */
+static int edgeExec(int b, int succ)
+{
+	int k;
+	for (k = 0; k < bb[b].nSucc; k++)
+		if (bb[b].succ[k] == succ && bb[b].exec[k])
+			return 1;
+	return 0;
+}
+
+/* 支配木をたどって変数の名前を替える.
+   buildが真ならlodの読む値とφ関数の引数を記録し、
+   偽なら取り除かれていない命令語についてコピー伝播をして、使われる値に印をつける */
+static void renameVars(int b, int build)
+{
+	int mark = nLog, k, p, s, y, v, c, i;
+
+	for (k = bb[b].phi; k >= 0; k = phiNext[k])
+		define(phiSlot[k], n + nSlot + k);
+	for (p = bb[b].first; p <= bb[b].last; p++) {
+		if (dead[cur->entry + p] || (s = slotOf(p)) < 0)
+			continue;
+		if (cd[p].opCode == sto) {
+			define(s, opA[p]);
+			continue;
+		}
+		if (build) {
+			src[p] = cur_[s];
+			continue;
+		}
+		/* x := y のあとでyが変わっていなければxの代わりにyを読む */
+		v = cur_[s];
+		y = s;
+		while (v < n && !dead[cur->entry + v] && (i = slotOf(v)) >= 0 && cd[v].opCode == lod
+				&& cur_[i] == src[v]) {
+			y = i;
+			v = src[v];
+		}
+		if (y != s)
+			cd[p].u.addr.addr = y - cur->pars;
+		src[p] = v;
+		live[v] = 1;
+	}
+	if (build)
+		for (k = 0; k < bb[b].nSucc; k++) {
+			c = bb[b].succ[k];
+			for (i = 0; i < bb[c].nPred; i++)
+				if (bb[c].pred[i] == b)
+					for (v = bb[c].phi; v >= 0; v = phiNext[v])
+						argPool[phiArg[v] + i] = cur_[phiSlot[v]];
+		}
+	for (c = bb[b].child; c >= 0; c = bb[c].sibling)
+		renameVars(c, build);
+	while (nLog > mark) {
+		nLog--;
+		cur_[logSlot[nLog]] = logVal[nLog];
+	}
+}
+
+/* 格子の交わり */
+static Lat meet(Lat a, Lat b)
+{
+	if (a.kind == topL)
+		return b;
+	if (b.kind == topL)
+		return a;
+	if (a.kind == constL && b.kind == constL && a.value == b.value)
+		return a;
+	a.kind = botL;
+	return a;
+}
+
+/* 演算の畳み込み(実行時と同じ計算をする) */
+static Lat fold(Operator o, Lat a, Lat b)
+{
+	Lat r;
+	int unary = o == neg || o == odd;
+	if (a.kind == botL || (!unary && b.kind == botL)) {
+		r.kind = botL;
+		return r;
+	}
+	if (a.kind == topL || (!unary && b.kind == topL)) {
+		r.kind = topL;
+		return r;
+	}
+	r.kind = constL;
+	switch (o) {
+	case neg: r.value = -a.value; break;
+	case odd: r.value = a.value & 1; break;
+	case add: r.value = a.value + b.value; break;
+	case sub: r.value = a.value - b.value; break;
+	case mul: r.value = a.value * b.value; break;
+	case div:
+		if (b.value == 0)            /* 0での割り算は実行時に任せる */
+			r.kind = botL;
+		else
+			r.value = a.value / b.value;
+		break;
+	case eq: r.value = a.value == b.value; break;
+	case ls: r.value = a.value < b.value; break;
+	case gr: r.value = a.value > b.value; break;
+	case neq: r.value = a.value != b.value; break;
+	case lseq: r.value = a.value <= b.value; break;
+	case greq: r.value = a.value >= b.value; break;
+	default: r.kind = botL; break;
+	}
+	return r;
+}
+
+/* 値vの格子の値をlにする(変わったら1を返す) */
+static int setLat(int v, Lat l)
+{
+	if (lat[v].kind == l.kind && (l.kind != constL || lat[v].value == l.value))
+		return 0;
+	lat[v] = l;
+	return 1;
+}
+
+/* ブロックbからk番目の後続ブロックへの辺を実行しうるとする */
+static int markEdge(int b, int k)
+{
+	int changed = 0;
+	if (!bb[b].exec[k]) {
+		bb[b].exec[k] = 1;
+		changed = 1;
+	}
+	if (!bb[bb[b].succ[k]].reach) {
+		bb[bb[b].succ[k]].reach = 1;
+		changed = 1;
+	}
+	return changed;
+}
+
+/* 疎な条件付き定数伝播 */
+static void sccp()
+{
+	int changed, i, b, p, k, j, s;
+	Lat l, bot, none;
+
+	bot.kind = botL; bot.value = 0;
+	none.kind = topL; none.value = 0;
+	for (s = 0; s < nSlot; s++)
+		lat[n + s] = bot;            /* 入口の値(パラメタ、初期化していない局所変数)は分からない */
+	bb[0].reach = 1;
+	do {
+		changed = 0;
+		for (i = 0; i < nOrder; i++) {
+			b = order[i];
+			if (!bb[b].reach)
+				continue;
+			for (k = bb[b].phi; k >= 0; k = phiNext[k]) {
+				l = none;
+				for (j = 0; j < bb[b].nPred; j++)
+					if (bb[bb[b].pred[j]].reach && edgeExec(bb[b].pred[j], b))
+						l = meet(l, lat[argPool[phiArg[k] + j]]);
+				changed |= setLat(n + nSlot + k, l);
+			}
+			for (p = bb[b].first; p <= bb[b].last; p++) {
+				if (dead[cur->entry + p])
+					continue;
+				switch (cd[p].opCode) {
+				case lit:
+					l.kind = constL;
+					l.value = cd[p].u.value;
+					break;
+				case lod:
+					l = slotOf(p) >= 0 ? lat[src[p]] : bot;
+					break;
+				case opr:
+					if (cd[p].u.optr == wrt || cd[p].u.optr == wrl)
+						continue;
+					l = fold(cd[p].u.optr, lat[opA[p]], opB[p] >= 0 ? lat[opB[p]] : none);
+					break;
+				case shl:                /* 複製では簡単化した命令語も現れる */
+				case shr:
+				case msk:
+					l = lat[opA[p]];
+					if (l.kind != constL)
+						break;
+					if (cd[p].opCode == shl)
+						l.value = (int)((unsigned)l.value << cd[p].u.value);
+					else if (cd[p].opCode == shr)
+						l.value /= 1 << cd[p].u.value;
+					else
+						l.value &= cd[p].u.value;
+					break;
+				case loda:
+				case cal:
+				case vlp:
+				case vlen:
+				case pfor:
+				case spn:
+					l = bot;
+					break;
+				default:
+					continue;
+				}
+				changed |= setLat(p, l);
+			}
+			p = bb[b].last;
+			if (cd[p].opCode == jpc && !dead[cur->entry + p]) {
+				l = lat[opA[p]];
+				if (l.kind == botL || (l.kind == constL && l.value != 0))
+					changed |= markEdge(b, 0);
+				if (l.kind == botL || (l.kind == constL && l.value == 0))
+					changed |= markEdge(b, 1);
+			}
+			else
+				for (k = 0; k < bb[b].nSucc; k++)
+					changed |= markEdge(b, k);
+		}
+	} while (changed);
+}
+
+/* 命令語pからqまでを取り除く */
+static void kill(int p, int q)
+{
+	for (; p <= q; p++)
+		dead[cur->entry + p] = 1;
+}
+
+/* 定数伝播の結果で目的コードを書き換える */
+static void rewriteConst()
+{
+	int b, p, c;
+	for (b = 0; b < nb; b++) {
+		if (bb[b].rpo < 0 || !bb[b].reach) {
+			kill(bb[b].first, bb[b].last);    /* 実行されないブロック */
+			continue;
+		}
+		for (p = bb[b].first; p <= bb[b].last; p++) {
+			if (dead[cur->entry + p])
+				continue;
+			switch (cd[p].opCode) {
+			case lod:
+			case opr:
+				if (lat[p].kind != constL || (cd[p].opCode == opr && (cd[p].u.optr == wrt || cd[p].u.optr == wrl)))
+					break;
+				kill(first[p], p - 1);    /* 式をlitに置き換える */
+				cd[p].opCode = lit;
+				cd[p].u.value = lat[p].value;
+				break;
+			case jpc:
+				c = opA[p];
+				if (lat[c].kind != constL)
+					break;
+				kill(first[c], c);        /* 条件式を取り除く */
+				if (lat[c].value == 0)
+					cd[p].opCode = jmp;   /* 必ず飛ぶ */
+				else
+					dead[cur->entry + p] = 1;    /* 飛ばない */
+				break;
+			default:
+				break;
+			}
+		}
+	}
+}
+
+/* 値vが定数cのlitか */
+static int isLit(int v, int c)
+{
+	return v >= 0 && !dead[cur->entry + v] && cd[v].opCode == lit && cd[v].u.value == c;
+}
+
+/* 値vが2のk乗(1<=k<=30)のlitならkを、そうでなければ0を返す */
+static int litLog2(int v)
+{
+	int k;
+	if (v < 0 || dead[cur->entry + v] || cd[v].opCode != lit)
+		return 0;
+	for (k = 1; k <= 30; k++)
+		if (cd[v].u.value == 1 << k)
+			return k;
+	return 0;
+}
+
+/* 値vを計算する式に呼び出しがないか */
+static int pureExpr(int v)
+{
+	int q;
+	for (q = first[v]; q <= v; q++)
+		if (!dead[cur->entry + q] && (cd[q].opCode == cal || cd[q].opCode == pfor || cd[q].opCode == spn))
+			return 0;
+	return 1;
+}
+
+/* 代数的な簡約: 0の加減算、1の乗除算、0の乗算、二重の符号反転を取り除き、
+   2のべき乗の乗除算とoddをシフトとマスクの命令にする.
+   取り除いた演算の値はrep[p]の命令語の値で置き換わる */
+static void simplify()
+{
+	int *rep = allocI(n, sizeof(int));
+	int b, p, a, c, k, keep, lit;
+
+	if (rep == NULL)
+		return;
+	for (p = 0; p < n; p++)
+		rep[p] = p;
+	for (b = 0; b < nb; b++) {
+		if (bb[b].rpo < 0 || !bb[b].reach)
+			continue;
+		for (p = bb[b].first; p <= bb[b].last; p++) {
+			if (dead[cur->entry + p] || cd[p].opCode != opr)
+				continue;
+			a = opA[p] >= 0 ? rep[opA[p]] : -1;
+			c = opB[p] >= 0 ? rep[opB[p]] : -1;
+			switch (cd[p].u.optr) {
+			case add:
+				if (isLit(c, 0) || isLit(a, 0)) {        /* x+0, 0+x */
+					keep = isLit(c, 0) ? a : c;          /* 殺したlitはisLitにならないので先に決める */
+					lit = keep == a ? c : a;
+					kill(lit, lit);
+					kill(p, p);
+					rep[p] = keep;
+				}
+				break;
+			case sub:
+				if (isLit(c, 0)) {                       /* x-0 */
+					kill(c, c);
+					kill(p, p);
+					rep[p] = a;
+				} else if (isLit(a, 0)) {                /* 0-x */
+					kill(a, a);
+					cd[p].u.optr = neg;
+				}
+				break;
+			case mul:
+				if (isLit(c, 1) || isLit(a, 1)) {        /* x*1, 1*x */
+					keep = isLit(c, 1) ? a : c;
+					lit = keep == a ? c : a;
+					kill(lit, lit);
+					kill(p, p);
+					rep[p] = keep;
+				} else if (isLit(c, 0) && pureExpr(a)) {    /* x*0 */
+					kill(first[a], a);
+					kill(p, p);
+					rep[p] = c;
+				} else if (isLit(a, 0) && pureExpr(c)) {    /* 0*x */
+					kill(first[c], c);
+					kill(p, p);
+					rep[p] = a;
+				} else if (isLit(c, -1) || isLit(a, -1)) {    /* x*(-1) */
+					kill(isLit(c, -1) ? c : a, isLit(c, -1) ? c : a);
+					cd[p].u.optr = neg;
+				} else if ((k = litLog2(c)) > 0 || (k = litLog2(a)) > 0) {    /* x*2^k */
+					kill(litLog2(c) > 0 ? c : a, litLog2(c) > 0 ? c : a);
+					cd[p].opCode = shl;
+					cd[p].u.value = k;
+				}
+				break;
+			case div:
+				if (isLit(c, 1)) {                       /* x/1 */
+					kill(c, c);
+					kill(p, p);
+					rep[p] = a;
+				} else if (isLit(c, -1)) {               /* x/(-1) */
+					kill(c, c);
+					cd[p].u.optr = neg;
+				} else if ((k = litLog2(c)) > 0) {       /* x/2^k(0の方へ切り捨てる) */
+					kill(c, c);
+					cd[p].opCode = shr;
+					cd[p].u.value = k;
+				}
+				break;
+			case neg:
+				if (a >= 0 && !dead[cur->entry + a] && cd[a].opCode == opr && cd[a].u.optr == neg) {    /* -(-x) */
+					kill(a, a);
+					kill(p, p);
+					rep[p] = opA[a] >= 0 ? rep[opA[a]] : -1;
+				}
+				break;
+			case odd:
+				cd[p].opCode = msk;
+				cd[p].u.value = 1;
+				break;
+			default:
+				break;
+			}
+		}
+	}
+	free(rep);
+}
+
+/* 使われる値から、それを引数とするφ関数を通して印をつける */
+static void markLive()
+{
+	int *work = allocI(nPhi, sizeof(int)), nWork = 0, k, j, v, b;
+	if (work == NULL)
+		return;
+	for (k = 0; k < nPhi; k++)
+		if (live[n + nSlot + k])
+			work[nWork++] = k;
+	while (nWork > 0) {
+		k = work[--nWork];
+		b = phiBlock[k];
+		for (j = 0; j < bb[b].nPred; j++) {
+			if (!bb[bb[b].pred[j]].reach || !edgeExec(bb[b].pred[j], b))
+				continue;
+			v = argPool[phiArg[k] + j];
+			if (live[v])
+				continue;
+			live[v] = 1;
+			if (v >= n + nSlot)
+				work[nWork++] = v - n - nSlot;
+		}
+	}
+	free(work);
+}
+
+/* 値が使われない代入を取り除く(取り除いたら1を返す) */
+static int removeDeadStores()
+{
+	int b, p, q, v, pure, removed = 0;
+	for (b = 0; b < nb; b++) {
+		if (bb[b].rpo < 0 || !bb[b].reach)
+			continue;
+		for (p = bb[b].first; p <= bb[b].last; p++) {
+			if (dead[cur->entry + p] || cd[p].opCode != sto || slotOf(p) < 0 || live[v = opA[p]])
+				continue;
+			for (pure = 1, q = first[v]; q <= v; q++)
+				if (!dead[cur->entry + q] && (cd[q].opCode == cal || cd[q].opCode == pfor || cd[q].opCode == spn))
+					pure = 0;             /* 呼び出しは副作用があるかもしれない */
+			if (pure) {
+				kill(first[v], p);
+				removed = 1;
+			}
+		}
+	}
+	return removed;
+}
+
+/* 関数一つの最適化 */
+static void optProc(Proc *q)
+{
+	int b, nVal;
+
+	cur = q;
+	cd = codeAt(q->entry);
+	n = q->end - q->entry;
+	if (n <= 0 || cd[0].opCode != ict)
+		return;
+	nSlot = q->pars + cd[0].u.value;
+	nb = 0;
+	bb = NULL;
+	nPhi = nArg = 0;
+	ssa = allocI(nSlot, 1);
+	bOf = allocI(n, sizeof(int));
+	order = allocI(n, sizeof(int));
+	opA = allocI(n, sizeof(int));
+	opB = allocI(n, sizeof(int));
+	first = allocI(n, sizeof(int));
+	src = allocI(n, sizeof(int));
+	stk = allocI(n + 1, sizeof(int));
+	cur_ = allocI(nSlot, sizeof(int));
+	lat = NULL;
+	live = NULL;
+	logSlot = logVal = NULL;
+	if (!ssa || !bOf || !order || !opA || !opB || !first || !src || !stk || !cur_)
+		goto done;
+	findSlots();
+	if (!buildCFG())
+		goto done;
+	dominators();
+	for (b = 0; b < nb; b++)
+		if (bb[b].rpo >= 0 && !simulate(b))
+			goto done;
+	if (!placePhis())
+		goto done;
+	nVal = n + nSlot + nPhi;
+	lat = allocI(nVal, sizeof(Lat));
+	live = allocI(nVal, 1);
+	logSlot = allocI(n + nPhi + 1, sizeof(int));
+	logVal = allocI(n + nPhi + 1, sizeof(int));
+	if (!lat || !live || !logSlot || !logVal)
+		goto done;
+
+	for (b = 0; b < nSlot; b++)
+		cur_[b] = n + b;
+	nLog = 0;
+	renameVars(0, 1);
+	sccp();
+	rewriteConst();
+	simplify();
+	do {
+		for (b = 0; b < nVal; b++)
+			live[b] = 0;
+		renameVars(0, 0);
+		markLive();
+	} while (removeDeadStores());
+
+done:
+	for (b = 0; b < nb; b++)
+		free(bb[b].pred);
+	free(bb); free(ssa); free(bOf); free(order);
+	free(opA); free(opB); free(first); free(src); free(stk); free(cur_);
+	free(lat); free(live); free(logSlot); free(logVal);
+}
+
+/* 命令語xがスタックから取り出す数と積む数(分からない命令語なら0を返す) */
+static int stackEffect(int x, int *pop, int *push)
+{
+	Inst *c = codeAt(x);
+	int k;
+	*pop = 0;
+	*push = 1;
+	switch (c->opCode) {
+	case lit:
+	case lod:
+		return 1;
+	case loda:
+	case shl:
+	case shr:
+	case msk:
+		*pop = 1;
+		return 1;
+	case sto:
+		*pop = 1;
+		*push = 0;
+		return 1;
+	case stoa:
+		*pop = 2;
+		*push = 0;
+		return 1;
+	case vlp:
+		*pop = 2;
+		return 1;
+	case vlen:
+		return 1;
+	case vld:
+	case vst:
+	case vbc:
+		*pop = 1;
+		*push = 0;
+		return 1;
+	case vop:
+		*push = 0;
+		return 1;
+	case opr:
+		*pop = c->u.optr == neg || c->u.optr == odd || c->u.optr == wrt ? 1 : c->u.optr == wrl ? 0 : 2;
+		*push = c->u.optr != wrt && c->u.optr != wrl;
+		return 1;
+	case cal:
+	case spn:
+		if ((k = procAt[c->u.addr.addr]) == 0)
+			return 0;
+		*pop = procs[k - 1].pars;
+		*push = !procs[k - 1].isProc;
+		return 1;
+	case pfor:
+		*pop = 3;
+		return 1;
+	case syn:
+		*push = 0;
+		return 1;
+	default:                        /* 飛び越し、ブロックの入口と出口 */
+		return 0;
+	}
+}
+
+/* 番地pのcalのj番目(0から)の実引数を最後に積む命令語の番地を返す(分からなければ-1).
+   calから逆にたどり、飛び先を越えるところでやめる */
+static int argAt(int p, int nArgs, int j, char *target)
+{
+	int o = nArgs - 1 - j, x, pop, push;
+	if (target[p])
+		return -1;
+	for (x = p - 1; x >= 0; x--) {
+		if (dead[x])
+			continue;
+		if (!stackEffect(x, &pop, &push))
+			return -1;
+		if (o < push)
+			return x;
+		o += pop - push;
+		if (target[x])
+			return -1;
+	}
+	return -1;
+}
+
+/* 純粋な関数(値がパラメタだけで決まる関数)を求める. 純粋な関数は自分のレベルの変数だけを
+   読み書きし、出力せず、主文の外へ飛ばず、純粋な関数だけを呼ぶ */
+static void findPure(char *pure)
+{
+	int i, p, k, changed;
+	Proc *q;
+	Inst *c;
+
+	for (i = 0; i < nProcs; i++) {
+		q = &procs[i];
+		pure[i] = q->level > 0 && !q->isProc && q->end > q->entry && codeAt(q->entry)->opCode == ict;
+	}
+	do {                             /* 純粋でない関数を呼ぶ関数も純粋でない */
+		changed = 0;
+		for (i = 0; i < nProcs; i++) {
+			q = &procs[i];
+			for (p = q->entry + 1; pure[i] && p < q->end; p++) {
+				c = codeAt(p);
+				if (dead[p])
+					continue;
+				switch (c->opCode) {
+				case lit:
+				case ret:
+				case shl:
+				case shr:
+				case msk:
+				case syn:
+					break;
+				case lod:
+				case sto:
+				case loda:
+				case stoa:
+					pure[i] = c->u.addr.level == q->level;
+					break;
+				case opr:
+					pure[i] = c->u.optr != wrt && c->u.optr != wrl;
+					break;
+				case jmp:
+				case jpc:
+					pure[i] = q->entry <= c->u.value && c->u.value < q->end;
+					break;
+				case cal:
+				case spn:
+					pure[i] = (k = procAt[c->u.addr.addr]) > 0 && pure[k - 1];
+					break;
+				default:
+					pure[i] = 0;
+					break;
+				}
+				changed |= !pure[i];
+			}
+		}
+	} while (changed);
+}
+
+/* 純粋な関数をすべて定数の実引数で呼ぶcalを、コンパイル時に実行した値のlitにする.
+   実引数は前の番地から順に積むlitか、同じように値の求まった呼び出しであること.
+   実行する命令語の数がEVALSTEPSを越えるもの、実行時の誤りになるものはそのままにする */
+static void foldPureCalls()
+{
+	int m = nextCode(), p, j, k, x, np, pos, v;
+	char *pure = allocI(nProcs + 1, 1), *target = allocI(m + 1, 1), *known = allocI(m + 1, 1);
+	int *from = allocI(m + 1, sizeof(int)), *val = allocI(m + 1, sizeof(int)), *args = NULL;
+	Inst *c;
+	Proc *q;
+
+	if (pure == NULL || target == NULL || known == NULL || from == NULL || val == NULL)
+		goto done;
+	for (np = 0, k = 0; k < nProcs; k++)
+		if (procs[k].pars > np)
+			np = procs[k].pars;
+	if ((args = allocI(np + 1, sizeof(int))) == NULL)
+		goto done;
+	findPure(pure);
+	for (p = 0; p < m; p++) {
+		c = codeAt(p);
+		if (!dead[p] && (c->opCode == jmp || c->opCode == jpc) && c->u.value < m)
+			target[c->u.value] = 1;
+	}
+	for (p = 0; p < m; p++) {        /* 内側の呼び出しから先に求まる */
+		c = codeAt(p);
+		if (dead[p] || c->opCode != cal || (k = procAt[c->u.addr.addr]) == 0 || !pure[k - 1])
+			continue;
+		q = &procs[k - 1];
+		for (pos = -1, j = 0; j < q->pars; j++) {
+			if ((x = argAt(p, q->pars, j, target)) < 0)
+				break;
+			if (codeAt(x)->opCode == lit) {
+				args[j] = codeAt(x)->u.value;
+				k = x;
+			} else if (known[x]) {
+				args[j] = val[x];
+				k = from[x];
+			} else
+				break;
+			if (pos >= 0 && k != pos)     /* 実引数の間にほかの命令語がある */
+				break;
+			if (j == 0)
+				from[p] = k;
+			pos = x + 1;
+		}
+		if (j < q->pars || (q->pars > 0 && pos != p))
+			continue;
+		if (q->pars == 0)
+			from[p] = p;
+		if (evalCall(q->entry, q->level, args, q->pars, EVALSTEPS, &v)) {
+			known[p] = 1;
+			val[p] = v;
+		}
+	}
+	for (p = m - 1; p >= 0; p--)     /* 外側の呼び出しが内側の呼び出しを含めて置き換える */
+		if (known[p] && !dead[p]) {
+			for (x = from[p]; x < p; x++)
+				dead[x] = 1;
+			codeAt(p)->opCode = lit;
+			codeAt(p)->u.value = val[p];
+		}
+done:
+	free(pure); free(target); free(known); free(from); free(val); free(args);
+}
+
+/* 番地fromからtoの前までの取り除かれない命令語の数 */
+static int liveCount(int from, int to)
+{
+	int c = 0;
+	for (; from < to; from++)
+		c += !dead[from];
+	return c;
+}
+
+/* dead, procAtを番地mまで広げる */
+static int growArrays(int m)
+{
+	char *d = realloc(dead, m + 1);
+	int *a = realloc(procAt, (m + 1) * sizeof(int)), i;
+	if (d != NULL)
+		dead = d;
+	if (a != NULL)
+		procAt = a;
+	if (d == NULL || a == NULL)
+		return 0;
+	for (i = nCode + 1; i <= m; i++) {
+		dead[i] = 0;
+		procAt[i] = 0;
+	}
+	nCode = m;
+	return 1;
+}
+
+/* 手続きの間の定数伝播: 定数(lit)の実引数で呼ぶcalを呼び出し先ごとに定数の組で分け、
+   その定数をパラメタの代わりに埋め込んだ複製を作ってSSA形式の最適化をかける.
+   複製の方が短くなるか、その呼び出し先のすべての呼び出しが同じ組なら、
+   その組のcalを複製へ付け替えて定数の実引数のlitを取り除く.
+   パラメタに代入する関数と、内部のブロックを持つ関数(パラメタを参照されうる)は除く */
+static void cloneProcs()
+{
+	int m = nextCode(), nSite = 0, p, i, j, k, g, qi, np, nConst, nLive, keep, start, ci, len, nClone, x;
+	int *site = allocI(m + 1, sizeof(int)), *litOf = NULL, *group = allocI(m + 1, sizeof(int));
+	int *newIdx = NULL;
+	char *target = allocI(m + 1, 1), *stored = NULL;
+	Inst *c;
+	Proc *q;
+
+	nCode = m;
+	if (site == NULL || group == NULL || target == NULL)
+		goto done;
+	for (p = 0; p < m; p++) {
+		c = codeAt(p);
+		if (!dead[p] && (c->opCode == jmp || c->opCode == jpc) && c->u.value < m)
+			target[c->u.value] = 1;
+	}
+	for (p = 0; p < m; p++)                 /* 実引数のある呼び出し */
+		if (!dead[p] && codeAt(p)->opCode == cal && (k = procAt[codeAt(p)->u.addr.addr]) > 0
+				&& procs[k - 1].pars > 0)
+			site[nSite++] = p;
+	for (np = 0, i = 0; i < nProcs; i++)
+		if (procs[i].pars > np)
+			np = procs[i].pars;
+	litOf = allocI(nSite * np + 1, sizeof(int));
+	newIdx = allocI(np + 1, sizeof(int));
+	stored = allocI(np + 1, 1);
+	if (litOf == NULL || newIdx == NULL || stored == NULL)
+		goto done;
+	for (i = 0; i < nSite; i++) {
+		k = procAt[codeAt(site[i])->u.addr.addr] - 1;
+		for (j = 0; j < procs[k].pars; j++) {
+			if ((x = argAt(site[i], procs[k].pars, j, target)) >= 0 && codeAt(x)->opCode != lit)
+				x = -1;
+			litOf[i * np + j] = x;
+		}
+	}
+	for (qi = nProcs - 1; qi >= 0; qi--) {     /* 複製はnProcsの後ろに足す */
+		q = &procs[qi];
+		if (q->level == 0 || q->pars == 0 || q->end <= q->entry || codeAt(q->entry)->opCode != ict)
+			continue;
+		for (k = 0; k < nProcs; k++)
+			if (procs[k].parent == qi)
+				break;
+		if (k < nProcs)
+			continue;
+		for (j = 0; j < q->pars; j++)
+			stored[j] = 0;
+		for (p = q->entry; p < q->end; p++) {
+			c = codeAt(p);
+			if (!dead[p] && c->opCode == sto && c->u.addr.level == q->level && c->u.addr.addr < 0)
+				stored[c->u.addr.addr + q->pars] = 1;
+		}
+		for (i = 0; i < nSite; i++)           /* 代入されるパラメタへの定数は使わない */
+			if (procAt[codeAt(site[i])->u.addr.addr] - 1 == qi)
+				for (j = 0; j < q->pars; j++)
+					if (stored[j])
+						litOf[i * np + j] = -1;
+		nClone = 0;
+		for (i = 0; i < nSite; i++)
+			group[i] = 0;
+		for (i = 0; i < nSite && nClone < 4; i++) {
+			if (group[i] || procAt[codeAt(site[i])->u.addr.addr] - 1 != qi)
+				continue;
+			for (nConst = 0, j = 0; j < q->pars; j++)
+				nConst += litOf[i * np + j] >= 0;
+			if (nConst == 0)
+				continue;
+			g = i + 1;                        /* 同じ定数の組の呼び出しを集める */
+			keep = 1;                         /* すべての呼び出しが同じ組か */
+			for (k = 0; k < nSite; k++) {
+				if (procAt[codeAt(site[k])->u.addr.addr] - 1 != qi)
+					continue;
+				if (k < i || group[k]) {      /* 別の組か定数のない呼び出し */
+					keep = 0;
+					continue;
+				}
+				for (j = 0; j < q->pars; j++)
+					if ((litOf[i * np + j] >= 0) != (litOf[k * np + j] >= 0) || (litOf[i * np + j] >= 0
+							&& codeAt(litOf[i * np + j])->u.value != codeAt(litOf[k * np + j])->u.value))
+						break;
+				if (j == q->pars)
+					group[k] = g;
+				else
+					keep = 0;
+			}
+			len = q->end - q->entry;
+			nLive = liveCount(q->entry, q->end);
+			if ((start = copyCode(q->entry, q->end)) < 0 || !growArrays(nextCode()))
+				break;
+			q = &procs[qi];
+			for (p = 0; p < len; p++)
+				dead[start + p] = dead[q->entry + p];
+			for (k = 0, j = 0; j < q->pars; j++)
+				newIdx[j] = litOf[i * np + j] >= 0 ? -1 : k++;
+			for (p = start; p < start + len; p++) {    /* パラメタを定数に、残りのパラメタの番地を詰める */
+				c = codeAt(p);
+				if ((c->opCode == lod || c->opCode == sto) && c->u.addr.level == q->level && c->u.addr.addr < 0) {
+					j = c->u.addr.addr + q->pars;
+					if (newIdx[j] < 0) {          /* 代入されないのでlodだけ */
+						c->opCode = lit;
+						c->u.value = codeAt(litOf[i * np + j])->u.value;
+					} else
+						c->u.addr.addr = newIdx[j] - k;
+				} else if (c->opCode == ret || c->opCode == retp)
+					c->u.addr.addr = k;
+			}
+			enterProc(start, start, start + len, q->level, k, q->isProc);
+			ci = nProcs - 1;
+			q = &procs[qi];
+			procs[ci].parent = q->parent;
+			procAt[start] = ci + 1;
+			optProc(&procs[ci]);
+			q = &procs[qi];
+			if (!keep && liveCount(start, start + len) >= nLive) {    /* 得にならない複製は捨てる */
+				for (p = start; p < start + len; p++)
+					dead[p] = 1;
+				continue;
+			}
+			nClone++;
+			for (k = i; k < nSite; k++)
+				if (group[k] == g) {
+					codeAt(site[k])->u.addr.addr = start;
+					for (j = 0; j < q->pars; j++)
+						if (litOf[k * np + j] >= 0)
+							dead[litOf[k * np + j]] = 1;
+				}
+		}
+	}
+done:
+	free(site); free(litOf); free(group); free(newIdx); free(target); free(stored);
+}
+
+/* 番地0から実行しうる命令語をたどり、たどれない命令語を取り除く */
+static void removeUnreachable(int m)
+{
+	char *reach = allocI(m + 1, 1);
+	int *work = allocI(m + 1, sizeof(int)), nWork = 0, p;
+	Inst *c;
+
+	if (reach == NULL || work == NULL) {
+		free(reach);
+		free(work);
+		return;
+	}
+	work[nWork++] = 0;
+	while (nWork > 0) {
+		for (p = work[--nWork]; p < m && !reach[p]; ) {
+			reach[p] = 1;
+			c = codeAt(p);
+			if (dead[p]) {                  /* 取り除く命令語は次へ進むだけ */
+				p++;
+				continue;
+			}
+			switch (c->opCode) {
+			case jmp:
+				p = c->u.value;
+				break;
+			case jpc:
+				work[nWork++] = c->u.value;
+				p++;
+				break;
+			case cal:
+			case pfor:
+			case spn:
+				work[nWork++] = c->u.addr.addr;
+				p++;
+				break;
+			case ret:
+			case retp:
+				p = m;
+				break;
+			default:
+				p++;
+				break;
+			}
+		}
+	}
+	for (p = 0; p < m; p++)
+		if (!reach[p])
+			dead[p] = 1;
+	free(reach);
+	free(work);
+}
+
+/* 番地pから後で取り除かれない最初の命令語の番地 */
+static int liveFrom(int p, int m)
+{
+	while (p < m && dead[p])
+		p++;
+	return p;
+}
+
+/* jmpへの飛び越しをまとめ、次の命令語へのjmpを取り除く */
+static void removeJumps(int m)
+{
+	int p, t, k, changed;
+	Inst *c;
+
+	for (p = 0; p < m; p++) {
+		c = codeAt(p);
+		if (dead[p] || (c->opCode != jmp && c->opCode != jpc))
+			continue;
+		t = liveFrom(c->u.value, m);
+		for (k = 0; k < 16 && t < m && codeAt(t)->opCode == jmp; k++)    /* jmpの輪は途中でやめる */
+			t = liveFrom(codeAt(t)->u.value, m);
+		if (t < m)
+			c->u.value = t;
+	}
+	do {
+		changed = 0;
+		for (p = 0; p < m; p++)
+			if (!dead[p] && codeAt(p)->opCode == jmp && liveFrom(codeAt(p)->u.value, m) == liveFrom(p + 1, m)) {
+				dead[p] = 1;
+				changed = 1;
+			}
+	} while (changed);
+}
+
+/* 配列の要素を読み書きする命令語か */
+static int arrayOp(OpCode op)
+{
+	return op == loda || op == stoa || op == vld || op == vst;
+}
+
+/* ブロックkはブロックqiの内部のブロック(複製を含む)か */
+static int inside(int k, int qi)
+{
+	int j, d;
+	for (j = procs[k].parent, d = 0; j >= 0 && d < nProcs; j = procs[j].parent, d++)
+		if (j == qi)
+			return 1;
+	return 0;
+}
+
+/* 主文の命令語pの出口で生きている変数の集合をoutに求める(in[]は各命令語の入口の集合、
+   w語ずつ). 主文の外へ飛べば0を返す */
+static int liveOut(Proc *q, int p, unsigned *in, int w, unsigned *out)
+{
+	Inst *c = codeAt(q->entry + p);
+	int n = q->end - q->entry, t, j;
+	for (j = 0; j < w; j++)
+		out[j] = 0;
+	if (c->opCode == ret || c->opCode == retp)
+		return 1;
+	if (c->opCode == jmp || c->opCode == jpc) {
+		t = c->u.value - q->entry;
+		if (t < 0 || t >= n)
+			return 0;
+		for (j = 0; j < w; j++)
+			out[j] |= in[t * w + j];
+		if (c->opCode == jmp)
+			return 1;
+	}
+	if (p + 1 < n)
+		for (j = 0; j < w; j++)
+			out[j] |= in[(p + 1) * w + j];
+	return 1;
+}
+
+/* ブロックqiの局所変数(番地2..ict-1)のうち生きている範囲が重ならないものに
+   同じ番地を割り当て、ictのフレームを小さくする. 内部のブロックから参照される変数、
+   入口で生きている(代入する前に読まれうる)変数と配列は番地を共有しない */
+static void shareFrame(int qi, char *alive)
+{
+	Proc *q = &procs[qi];
+	int fr, n, nc = 0, w, p, k, j, s, a, b, next, nColor = 0, changed;
+	char *flag = NULL, *inner = NULL, *used = NULL;
+	int *cIdx = NULL, *slotA = NULL, *newA = NULL, *color = NULL;
+	unsigned *in = NULL, *out = NULL, *adj = NULL;
+	Inst *c;
+
+	n = q->end - q->entry;
+	if (n <= 0 || q->parent == qi || codeAt(q->entry)->opCode != ict || (fr = codeAt(q->entry)->u.value) <= 3)
+		return;                       /* 外側のブロックが分からなければ何もしない */
+	flag = allocI(fr, 1);         /* 1:主文で読み書きする 2:内部のブロックが読み書きする 4:配列の先頭 8:配列 */
+	inner = allocI(nProcs, 1);
+	cIdx = allocI(fr, sizeof(int));
+	slotA = allocI(fr, sizeof(int));
+	newA = allocI(fr, sizeof(int));
+	if (flag == NULL || inner == NULL || cIdx == NULL || slotA == NULL || newA == NULL)
+		goto done;
+	for (k = 0; k < nProcs; k++)
+		inner[k] = (alive[k] & 1) && (k == qi || inside(k, qi));
+	for (k = 0; k < nProcs; k++) {
+		if (!inner[k])
+			continue;
+		for (p = procs[k].entry; p < procs[k].end; p++) {
+			c = codeAt(p);
+			if ((c->opCode != lod && c->opCode != sto && !arrayOp(c->opCode))
+					|| c->u.addr.level != q->level || c->u.addr.addr < 2)
+				continue;
+			if (c->u.addr.addr >= fr)
+				goto done;
+			if (arrayOp(c->opCode))
+				flag[c->u.addr.addr] |= 4;
+			else
+				flag[c->u.addr.addr] |= k == qi ? 1 : 2;
+		}
+	}
+	for (a = 2; a < fr; a++)          /* 配列は次に参照される番地の前までとみなす */
+		if (flag[a] & 4)
+			for (b = a + 1; b < fr && flag[b] == 0; b++)
+				flag[b] = 8;
+	for (a = 2; a < fr; a++) {
+		cIdx[a] = -1;
+		if (flag[a] == 1) {
+			cIdx[a] = nc;
+			slotA[nc++] = a;
+		}
+	}
+	w = (nc + 31) / 32;
+	if (nc < 2 || (in = allocI(n * w, sizeof(unsigned))) == NULL || (out = allocI(w, sizeof(unsigned))) == NULL
+			|| (adj = allocI(nc * w, sizeof(unsigned))) == NULL || (color = allocI(nc, sizeof(int))) == NULL
+			|| (used = allocI(nc, 1)) == NULL)
+		goto done;
+
+	do {                              /* 命令語ごとの入口で生きている変数を後ろ向きに求める */
+		changed = 0;
+		for (p = n - 1; p >= 0; p--) {
+			if (!liveOut(q, p, in, w, out))
+				goto done;
+			c = codeAt(q->entry + p);
+			if ((c->opCode == lod || c->opCode == sto) && c->u.addr.level == q->level
+					&& c->u.addr.addr >= 2 && (s = cIdx[c->u.addr.addr]) >= 0) {
+				if (c->opCode == lod)
+					out[s / 32] |= 1u << s % 32;
+				else
+					out[s / 32] &= ~(1u << s % 32);
+			}
+			for (j = 0; j < w; j++)
+				if (in[p * w + j] != out[j]) {
+					in[p * w + j] = out[j];
+					changed = 1;
+				}
+		}
+	} while (changed);
+	for (s = 0; s < nc; s++)          /* 代入する前に読まれうる変数 */
+		if (in[s / 32] & 1u << s % 32)
+			flag[slotA[s]] |= 2;
+	for (p = 0; p < n; p++) {         /* 代入した変数はその出口で生きている変数と干渉する */
+		c = codeAt(q->entry + p);
+		if (c->opCode != sto || c->u.addr.level != q->level || c->u.addr.addr < 2 || (s = cIdx[c->u.addr.addr]) < 0)
+			continue;
+		liveOut(q, p, in, w, out);
+		for (k = 0; k < nc; k++)
+			if (k != s && (out[k / 32] & 1u << k % 32)) {
+				adj[s * w + k / 32] |= 1u << k % 32;
+				adj[k * w + s / 32] |= 1u << s % 32;
+			}
+	}
+
+	for (s = 0; s < nc; s++) {        /* 番地の順に、干渉する変数と違う番号で一番小さいものをとる */
+		if (flag[slotA[s]] != 1)
+			continue;
+		for (k = 0; k < nColor; k++)
+			used[k] = 0;
+		for (k = 0; k < s; k++)
+			if (flag[slotA[k]] == 1 && (adj[s * w + k / 32] & 1u << k % 32))
+				used[color[k]] = 1;
+		for (k = 0; k < nColor && used[k]; k++)
+			;
+		color[s] = k;
+		if (k == nColor)
+			nColor++;
+	}
+	next = 2 + nColor;                /* 共有する番地、共有しない変数、配列の順に並べる */
+	for (a = 2; a < fr; a++) {
+		if (flag[a] == 1)
+			newA[a] = 2 + color[cIdx[a]];
+		else if (flag[a] == 2 || flag[a] == 3)
+			newA[a] = next++;
+	}
+	for (a = 2; a < fr; a++)
+		if (flag[a] & 4)
+			for (newA[a] = next++, b = a + 1; b < fr && flag[b] == 8; b++)
+				newA[b] = next++;
+	if (next >= fr)
+		goto done;
+	for (k = 0; k < nProcs; k++) {
+		if (!inner[k])
+			continue;
+		for (p = procs[k].entry; p < procs[k].end; p++) {
+			c = codeAt(p);
+			if ((c->opCode == lod || c->opCode == sto || arrayOp(c->opCode))
+					&& c->u.addr.level == q->level && c->u.addr.addr >= 2)
+				c->u.addr.addr = newA[c->u.addr.addr];
+		}
+	}
+	codeAt(q->entry)->u.value = next;
+done:
+	free(flag); free(inner); free(cIdx); free(slotA); free(newA);
+	free(color); free(used); free(in); free(out); free(adj);
+}
+
+/* 静的フレームの割り当てに使う呼び出しグラフ */
+static int *succ, *succFirst;    /* ブロックiが呼ぶブロックはsucc[succFirst[i]..succFirst[i+1]-1] */
+static int *idx, *low, *onStk, *sccStk, nScc, nIdx;
+static char *inCycle;            /* inCycle[i]が真のブロックは再帰的に呼ばれうる */
+
+/* 呼び出しグラフの強連結成分を求める(Tarjan) */
+static void strong(int v)
+{
+	int k, w;
+	idx[v] = low[v] = ++nIdx;
+	sccStk[nScc++] = v;
+	onStk[v] = 1;
+	for (k = succFirst[v]; k < succFirst[v + 1]; k++) {
+		w = succ[k];
+		if (w == v)
+			inCycle[v] = 1;
+		if (idx[w] == 0) {
+			strong(w);
+			if (low[w] < low[v])
+				low[v] = low[w];
+		} else if (onStk[w] && idx[w] < low[v])
+			low[v] = idx[w];
+	}
+	if (low[v] == idx[v]) {
+		k = nScc;
+		do {
+			w = sccStk[--nScc];
+			onStk[w] = 0;
+			if (sccStk[k - 1] != v)        /* 二つ以上のブロックからなる成分 */
+				inCycle[w] = 1;
+		} while (w != v);
+	}
+}
+
+/* pfor命令の繰り返しの手続き、spn命令の関数と、そこから呼び出しをたどれるブロックの
+   par[i]を1にする(at[番地]-1はその番地を呼び出し先とするブロック). これらはワーカー
+   スレッドが並行に実行するので、静的なフレームも値を覚える表も使わない */
+static void parallelProcs(int *at, char *par, int *work)
+{
+	int m = nextCode(), nWork = 0, i, k, p;
+	Inst *c;
+
+	for (i = 0; i < nProcs; i++)
+		par[i] = 0;
+	for (p = 0; p < m; p++)
+		if ((codeAt(p)->opCode == pfor || codeAt(p)->opCode == spn) && (k = at[codeAt(p)->u.addr.addr]) > 0 && !par[k - 1]) {
+			par[k - 1] = 1;
+			work[nWork++] = k - 1;
+		}
+	while (nWork > 0) {
+		i = work[--nWork];
+		for (p = procs[i].entry; p < procs[i].end; p++) {
+			c = codeAt(p);
+			if ((c->opCode == cal || c->opCode == pfor || c->opCode == spn) && (k = at[c->u.addr.addr]) > 0 && !par[k - 1]) {
+				par[k - 1] = 1;
+				work[nWork++] = k - 1;
+			}
+		}
+	}
+}
+
+/* 再帰的に呼ばれず内部のブロックを持たない関数と手続きのフレームを主ブロックの
+   フレームの後ろに静的にとり、cal, ict, ret(retp)をcals, ents, retsにする.
+   変数は番地を直接指し、ディスプレイの退避と回復、返す値の移し替えがなくなる */
+static void staticFrames(char *alive)    /* alive[i]の1はブロックiが残る、2は先頭のjmpも残る */
+{
+	int m = nextCode(), i, k, p, w, base, fr, nEdge = 0;
+	int *owner = allocI(m + 1, sizeof(int)), *callee = allocI(m + 1, sizeof(int));
+	int *sBase = allocI(nProcs, sizeof(int)), *work = allocI(nProcs, sizeof(int));
+	char *par = allocI(nProcs, 1);
+	Proc *q, *mainB = NULL;
+	Inst *c;
+
+	succ = allocI(m + 1, sizeof(int));
+	succFirst = allocI(nProcs + 1, sizeof(int));
+	idx = allocI(nProcs, sizeof(int));
+	low = allocI(nProcs, sizeof(int));
+	onStk = allocI(nProcs, sizeof(int));
+	sccStk = allocI(nProcs, sizeof(int));
+	inCycle = allocI(nProcs, 1);
+	if (owner == NULL || callee == NULL || sBase == NULL || work == NULL || par == NULL || succ == NULL
+			|| succFirst == NULL || idx == NULL || low == NULL || onStk == NULL || sccStk == NULL || inCycle == NULL)
+		goto done;
+	for (i = 0; i < nProcs; i++) {
+		q = &procs[i];
+		if (!(alive[i] & 1))
+			continue;
+		if (q->level == 0)
+			mainB = q;
+		for (p = q->entry; p < q->end; p++)
+			owner[p] = i + 1;
+		callee[q->entry] = i + 1;
+		if (alive[i] & 2)                  /* 取り除いたjmpの番地は別の命令語のもの */
+			callee[q->start] = i + 1;
+	}
+	if (mainB == NULL || codeAt(mainB->entry)->opCode != ict)
+		goto done;
+	for (i = 0; i < nProcs; i++) {    /* 呼び出しグラフの辺をブロックごとに並べる */
+		succFirst[i] = nEdge;
+		if (!(alive[i] & 1))
+			continue;
+		for (p = procs[i].entry; p < procs[i].end; p++)
+			if ((codeAt(p)->opCode == cal || codeAt(p)->opCode == pfor || codeAt(p)->opCode == spn)
+					&& (k = callee[codeAt(p)->u.addr.addr]) > 0)
+				succ[nEdge++] = k - 1;
+	}
+	succFirst[nProcs] = nEdge;
+	for (i = 0; i < nProcs; i++)
+		if ((alive[i] & 1) && idx[i] == 0)
+			strong(i);
+	parallelProcs(callee, par, work);
+	base = codeAt(mainB->entry)->u.value;
+	for (i = 0; i < nProcs; i++) {
+		q = &procs[i];
+		sBase[i] = -1;
+		if (!(alive[i] & 1) || q->level == 0 || inCycle[i] || par[i] || codeAt(q->entry)->opCode != ict)
+			continue;
+		for (k = 0; k < nProcs; k++)       /* 内部のブロックがあれば静的にしない */
+			if ((alive[k] & 1) && procs[k].parent == i)
+				break;
+		if (k < nProcs)
+			continue;
+		fr = codeAt(q->entry)->u.value;
+		if (base + q->pars + fr > MAXMEM / 4)    /* 再帰のためのスタックを残す */
+			continue;
+		sBase[i] = base + q->pars;        /* フレームの先頭、パラメタはその前 */
+		base += q->pars + fr;
+	}
+	codeAt(mainB->entry)->u.value = base;
+	for (p = 0; p < m; p++) {
+		c = codeAt(p);
+		if (c->opCode == cal && (k = callee[c->u.addr.addr]) > 0 && sBase[k - 1] >= 0) {
+			c->opCode = cals;
+			c->u.addr.addr = procs[k - 1].entry;    /* calsはents命令を読んでその次へ飛ぶ */
+			continue;
+		}
+		if (owner[p] == 0 || (w = sBase[owner[p] - 1]) < 0)
+			continue;
+		q = &procs[owner[p] - 1];
+		switch (c->opCode) {
+		case ict:
+			c->opCode = ents;
+			c->u.addr.level = q->pars;
+			c->u.addr.addr = w - q->pars;
+			break;
+		case ret:
+		case retp:
+			c->opCode = rets;
+			c->u.addr.level = 0;
+			c->u.addr.addr = w + 1;
+			break;
+		case lod:
+		case sto:
+		case loda:
+		case stoa:
+		case vld:
+		case vst:
+			if (c->u.addr.level == q->level) {
+				c->u.addr.level = 0;
+				c->u.addr.addr += w;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+done:
+	free(owner); free(callee); free(sBase); free(work); free(par);
+	free(succ); free(succFirst); free(idx); free(low); free(onStk); free(sccStk); free(inCycle);
+}
+
+/* 各ブロックの外側のブロックを求める. ブロックは内部のブロックのあとに登録され、
+   内部のブロックのコードは外側のstartとentryの間にある */
+static void findParents()
+{
+	int *stack = allocI(nProcs, sizeof(int)), sp = 0, i;
+	if (stack == NULL) {
+		for (i = 0; i < nProcs; i++)
+			procs[i].parent = i;            /* 内部のブロックがあるとみなす */
+		return;
+	}
+	for (i = 0; i < nProcs; i++) {
+		while (sp > 0 && procs[stack[sp - 1]].entry >= procs[i].start && procs[stack[sp - 1]].entry < procs[i].entry)
+			procs[stack[--sp]].parent = i;
+		stack[sp++] = i;
+	}
+	free(stack);
+}
+
+/* 目的コードの最適化 */
+void optimize()
+{
+	int i, m = nextCode();
+	int *newAddr;
+	char *alive;
+	double t = statsMode ? statsClock() : 0;
+
+	dead = allocI(m + 1, 1);
+	procAt = allocI(m + 1, sizeof(int));
+	newAddr = allocI(m + 1, sizeof(int));
+	if (dead && procAt && newAddr) {
+		for (i = 0; i < nProcs; i++)
+			procAt[procs[i].start] = procAt[procs[i].entry] = i + 1;
+		findParents();
+		foldPureCalls();
+		for (i = 0; i < nProcs; i++)
+			optProc(&procs[i]);
+		cloneProcs();
+		m = nextCode();
+		free(newAddr);
+		newAddr = allocI(m + 1, sizeof(int));
+	}
+	if (dead && procAt && newAddr) {
+		removeUnreachable(m);
+		removeJumps(m);
+		alive = allocI(nProcs, 1);
+		for (i = 0; i < nProcs && alive; i++)
+			alive[i] = !dead[procs[i].entry] + 2 * !dead[procs[i].start];
+		removeCode(dead, newAddr);
+		for (i = 0; i < nProcs; i++) {
+			procs[i].start = newAddr[procs[i].start];
+			procs[i].entry = newAddr[procs[i].entry];
+			procs[i].end = newAddr[procs[i].end];
+		}
+		if (alive) {
+			for (i = 0; i < nProcs; i++)
+				if (alive[i] & 1)
+					shareFrame(i, alive);
+			staticFrames(alive);
+		}
+		for (i = 0; i < nProcs; i++) {    /* 取り除いたブロックは空に、取り除いたjmpは入口にしておく */
+			if (alive == NULL || !(alive[i] & 1))
+				procs[i].end = procs[i].entry;
+			if (alive == NULL || !(alive[i] & 2))
+				procs[i].start = procs[i].entry;
+		}
+		free(alive);
+	}
+	free(dead);
+	free(procAt);
+	dead = NULL;
+	procAt = NULL;
+	free(newAddr);
+	free(phiSlot); free(phiBlock); free(phiNext); free(phiArg); free(argPool);
+	phiSlot = phiBlock = phiNext = phiArg = argPool = NULL;
+	maxPhi = maxArg = 0;
+	if (statsMode)
+		stats.time[optPh] += statsClock() - t;
+}
+
+/* ブロックiから呼び出しをたどってiに戻れるか */
+static int recursive(int i, char *seen, int *work)
+{
+	int nWork = 0, k, p;
+	Proc *q;
+
+	for (k = 0; k < nProcs; k++)
+		seen[k] = 0;
+	work[nWork++] = i;
+	while (nWork > 0) {
+		q = &procs[work[--nWork]];
+		for (p = q->entry; p < q->end; p++)
+			if (codeAt(p)->opCode == cal && (k = procAt[codeAt(p)->u.addr.addr]) > 0 && !seen[k - 1]) {
+				if (k - 1 == i)
+					return 1;
+				seen[k - 1] = 1;
+				work[nWork++] = k - 1;
+			}
+	}
+	return 0;
+}
+
+/* 値を覚えておく関数を決め、その呼び出しをcalm、入口のictをentm、retをretmにする(--memo).
+   再帰的に呼ばれる純粋な関数で、パラメタがMEMOARGS個以下で、パラメタに代入しないもの.
+   -Oのときは最適化のあとに呼ぶ */
+void memoize()
+{
+	int m = nextCode(), i, k, p;
+	char *pure = allocI(nProcs + 1, 1), *memo = allocI(nProcs + 1, 1), *seen = allocI(nProcs + 1, 1);
+	char *par = allocI(nProcs + 1, 1);
+	int *work = allocI(nProcs + 1, sizeof(int));
+	double t = statsMode ? statsClock() : 0;
+	Inst *c;
+	Proc *q;
+
+	dead = allocI(m + 1, 1);
+	procAt = allocI(m + 1, sizeof(int));
+	if (!pure || !memo || !seen || !par || !work || !dead || !procAt)
+		goto done;
+	for (i = 0; i < nProcs; i++)
+		if (procs[i].end > procs[i].entry)
+			procAt[procs[i].start] = procAt[procs[i].entry] = i + 1;
+	findPure(pure);
+	parallelProcs(procAt, par, work);    /* 表はスレッドの間で共有できない */
+	for (i = 0; i < nProcs; i++) {
+		q = &procs[i];
+		if (!pure[i] || par[i] || q->pars > MEMOARGS)
+			continue;
+		for (p = q->entry; p < q->end; p++) {
+			c = codeAt(p);
+			if (c->opCode == sto && c->u.addr.level == q->level && c->u.addr.addr < 0)
+				break;                  /* 戻るときにはパラメタが実引数でなくなっている */
+		}
+		memo[i] = p == q->end && recursive(i, seen, work);
+	}
+	for (p = 0; p < m; p++) {
+		c = codeAt(p);
+		if (c->opCode == cal && (k = procAt[c->u.addr.addr]) > 0 && memo[k - 1]) {
+			c->opCode = calm;
+			c->u.addr.addr = procs[k - 1].entry;
+		}
+	}
+	for (i = 0; i < nProcs; i++) {
+		if (!memo[i])
+			continue;
+		q = &procs[i];
+		c = codeAt(q->entry);
+		k = c->u.value;
+		c->opCode = entm;
+		c->u.addr.level = q->pars;
+		c->u.addr.addr = k;
+		for (p = q->entry + 1; p < q->end; p++)
+			if (codeAt(p)->opCode == ret)
+				codeAt(p)->opCode = retm;
+	}
+done:
+	free(pure); free(memo); free(seen); free(par); free(work);
+	free(dead); free(procAt);
+	dead = NULL;
+	procAt = NULL;
+	if (statsMode)
+		stats.time[optPh] += statsClock() - t;
+}
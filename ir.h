@@ -0,0 +1,13 @@
+/********** ir.h **********/
+#ifndef IR_H_
+#define IR_H_
+
+extern int optMode;    /* 真なら目的コードを最適化する(-O) */
+extern int memoMode;   /* 真なら再帰的な純粋な関数の値を実行時に覚えておく(--memo) */
+
+void enterProc(int start, int entry, int end, int level, int pars, int isProc);
+                       /* ブロックの目的コードの位置を登録(startは先頭のjmp、entryはict、endは主文の終りの次) */
+void optimize();       /* 目的コードの最適化 */
+void memoize();        /* 値を覚えておく関数の呼び出しをcalmにする(--memo) */
+
+#endif
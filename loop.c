@@ -0,0 +1,744 @@
+/********** loop.c **********/
+/*
+ * 構文木の上でのループの最適化(-O)
+ *
+ * ループ不変式の移動: while, do ... while, repeat ... until, for文の中で
+ * ループを回っても値の変わらない式を、ループの前(プリヘッダ)で一時変数に
+ * 計算しておき、ループの中ではその一時変数を読む. 一時変数はそのブロックの
+ * 局所変数として新しく割り当てる(ict命令の値が増える).
+ * 内側のループから先に移動するので、移動した式が外側のループでも不変なら
+ * さらに外へ出る.
+ *   - ループの中で代入される変数、配列を読む式は不変でない
+ *   - ループの中に呼び出しがあれば、内部のブロックから参照されない
+ *     そのブロックの局所変数とパラメタ以外は呼び出しで変わるものとする
+ *   - 呼び出しを含む式、定数でない数での割り算は移動しない
+ *     (ループが一度も回らないときに0での割り算を起こさないため)
+ *
+ * 誘導変数の強さの軽減: ループの中の代入がすべて i := i + c, i := i - c
+ * (cは定数)の形の変数iを誘導変数とし、i*k, i*k+j, j-i*kなど(k, jは
+ * 不変な定数か変数)の式を一時変数tに置き換える. tはプリヘッダで
+ * その式の値にしておき、iへの代入のたびに t := t + c*k で更新する.
+ * 同じ形の式は同じ一時変数を使うので、添字の計算の繰り返しも消える.
+ *
+ * for文の展開: for文は本体のあとに増分を続けたwhile文にする(繰り返しごとの
+ * jmpが一つ減る). 終りの値が定数かループ不変な変数で、誘導変数が本体で
+ * 変わらないループは、本体と増分をunrollFactor回並べたループと残りの回数の
+ * ループにする. 回数が定数なら残りはループにしない. 展開でコードがMAXCODEを
+ * 越えないように、残りの命令語の数の見積もりに収まるまでunrollFactorを減らす.
+ * 不変式の移動と強さの軽減で見積もりを越えるループは元のままにする.
+ */
+#include <stdio.h>
+#include <stddef.h>
+#include <limits.h>
+#include "ast.h"
+#include "loop.h"
+#include "stats.h"
+
+/* stdlib.hはOperatorのdivと衝突するので読まない */
+extern void *calloc(size_t n, size_t size);
+extern void *realloc(void *p, size_t size);
+extern void free(void *p);
+
+static Node *blk;           /* 最適化中のブロック */
+static int nPars;           /* そのパラメタ数(主ブロックは0) */
+static char *shared;        /* shared[addr+pars]が真の変数は内部のブロックから参照される */
+static int nShared;
+
+static RelAddr *mod;        /* ループの中で代入される変数(配列なら先頭) */
+static int nMod, maxMod;
+static int hasCall;         /* ループの中に呼び出しがあるか */
+
+/* 誘導変数の候補 */
+typedef struct iv {
+	RelAddr a;              /* 変数 */
+	int ok;                 /* 代入がすべて i := i ± c の形か */
+	int updates;            /* 代入の数 */
+} Iv;
+
+/* 誘導変数から導かれる式 s*i*k + (jNeg ? -j : j) */
+typedef struct derived {
+	int iv;                 /* 誘導変数 */
+	Node *k, *j;            /* 不変な定数か変数(jはNULLのこともある) */
+	int s, jNeg;            /* iの係数の符号(1か-1)、jを引くか */
+	int uses;               /* ループの中で現れる数 */
+	int use;                /* 一時変数に置き換えるか */
+	RelAddr t;              /* 値を入れておく一時変数(addrが負ならまだない) */
+} Derived;
+
+static Iv *ivs;
+static int nIv, maxIv;
+static Derived *ders;
+static int nDer, maxDer;
+static Node **steps;        /* プリヘッダで計算する増分 */
+static int nStep, maxStep;
+static int room;            /* 展開で増やせる命令語の数 */
+
+#define UNROLLSIZE 60       /* 展開するfor文の本体と増分の節点の数の上限 */
+int unrollFactor = 4;
+
+/* 内部のブロックから参照されるこのブロックの変数に印をつける */
+static void markShared(Node *n)
+{
+	int i, k;
+	if (n == NULL)
+		return;
+	switch (n->kind) {
+	case VarN:
+	case ArrN:
+	case AssignN:
+	case AssignArrN:
+		k = n->u.addr.addr + nPars;
+		if (n->u.addr.level == blk->u.blk->level && 0 <= k && k < nShared)
+			shared[k] = 1;
+		break;
+	case BlockN:
+		markShared(n->u.blk->body);
+		break;
+	default:
+		break;
+	}
+	for (i = 0; i < n->nKid; i++)
+		markShared(n->kid[i]);
+}
+
+/* ループの中で代入される変数と呼び出しを集める */
+static void collect(Node *n)
+{
+	int i;
+	if (n == NULL)
+		return;
+	switch (n->kind) {
+	case AssignN:
+	case AssignArrN:
+		if (nMod == maxMod) {
+			maxMod = maxMod ? maxMod * 2 : 32;
+			mod = realloc(mod, maxMod * sizeof(RelAddr));
+		}
+		mod[nMod++] = n->u.addr;
+		break;
+	case CallN:
+	case CallStN:
+	case ParForN:                   /* 繰り返しの手続きは配列に代入しうる */
+		hasCall = 1;
+		break;
+	default:
+		break;
+	}
+	for (i = 0; i < n->nKid; i++)
+		collect(n->kid[i]);
+}
+
+/* 変数aがループの中で変わりうるか */
+static int modified(RelAddr a)
+{
+	int i, k;
+	for (i = 0; i < nMod; i++)
+		if (mod[i].level == a.level && mod[i].addr == a.addr)
+			return 1;
+	if (!hasCall)
+		return 0;
+	/* 呼び出しで変わらないのは内部のブロックから見えないこのブロックの変数だけ */
+	k = a.addr + nPars;
+	return a.level != blk->u.blk->level || (0 <= k && k < nShared && shared[k]);
+}
+
+/* 式が定数だけでできているか(定数伝播に任せる) */
+static int constant(Node *n)
+{
+	int i;
+	if (n->kind == VarN || n->kind == ArrN || n->kind == CallN)
+		return 0;
+	for (i = 0; i < n->nKid; i++)
+		if (!constant(n->kid[i]))
+			return 0;
+	return 1;
+}
+
+/* 不変な式*npを一時変数に置き換え、その代入をプリヘッダの文として集める */
+static void hoist(Node **np)
+{
+	Node *n = *np, *a, *v;
+	RelAddr t;
+	if (n->kind != UnN && n->kind != BinN && n->kind != ArrN)
+		return;                             /* 定数や変数はそのまま読むのと変わらない */
+	if (constant(n))
+		return;
+	t.level = blk->u.blk->level;
+	t.addr = blk->u.blk->frame++;            /* 一時変数 */
+	a = newNode1(AssignN, n);
+	a->u.addr = t;
+	a->line = n->line;
+	v = newNode(VarN, 0);
+	v->u.addr = t;
+	v->line = n->line;
+	pushKid(a);
+	*np = v;
+}
+
+/* *npの中の不変な最大の式を移動する. *np自身が不変な式なら移動せずに1を返す */
+static int scan(Node **np)
+{
+	Node *n = *np;
+	int i, inv0, inv1;
+
+	if (n == NULL)
+		return 0;
+	switch (n->kind) {
+	case NumN:
+		return 1;
+	case VarN:
+		return !modified(n->u.addr);
+	case ArrN:
+	case UnN:
+	case BinN:
+		inv0 = scan(&n->kid[0]);
+		inv1 = n->nKid > 1 ? scan(&n->kid[1]) : 1;
+		if (inv0 && inv1) {
+			if (n->kind == ArrN && !modified(n->u.addr))
+				return 1;
+			if (n->kind != ArrN && (n->u.optr != div ||
+					(n->kid[1]->kind == NumN && n->kid[1]->u.value != 0)))
+				return 1;
+		}
+		if (inv0)
+			hoist(&n->kid[0]);
+		if (inv1 && n->nKid > 1)
+			hoist(&n->kid[1]);
+		return 0;
+	default:                                /* 呼び出し、文 */
+		for (i = 0; i < n->nKid; i++)
+			if (scan(&n->kid[i]))
+				hoist(&n->kid[i]);
+		return 0;
+	}
+}
+
+/* ループnの中で代入される変数と呼び出しを調べる(fromはループの部分の最初の子) */
+static void loopMods(Node *n, int from)
+{
+	int i;
+	nMod = 0;
+	hasCall = 0;
+	for (i = from; i < n->nKid; i++)
+		collect(n->kid[i]);
+}
+
+/* ループnの不変式をプリヘッダに移動する(プリヘッダの文は集める) */
+static void licm(Node *n, int from)
+{
+	int i;
+	loopMods(n, from);
+	for (i = from; i < n->nKid; i++)
+		if (scan(&n->kid[i]))
+			hoist(&n->kid[i]);
+}
+
+/* 変数aの誘導変数の候補(なければ作る) */
+static Iv *ivEntry(RelAddr a)
+{
+	int i;
+	for (i = 0; i < nIv; i++)
+		if (ivs[i].a.level == a.level && ivs[i].a.addr == a.addr)
+			return &ivs[i];
+	if (nIv == maxIv) {
+		maxIv = maxIv ? maxIv * 2 : 16;
+		ivs = realloc(ivs, maxIv * sizeof(Iv));
+	}
+	ivs[nIv].a = a;
+	ivs[nIv].ok = 1;
+	ivs[nIv].updates = 0;
+	return &ivs[nIv++];
+}
+
+/* 代入文nが i := i + c, i := c + i, i := i - c の形ならiに足す数を*cに入れて1を返す */
+static int ivStep(Node *n, int *c)
+{
+	Node *e = n->kid[0];
+	if (e == NULL || e->kind != BinN)
+		return 0;
+	if (e->kid[0]->kind == VarN && e->kid[1]->kind == NumN
+			&& e->kid[0]->u.addr.level == n->u.addr.level && e->kid[0]->u.addr.addr == n->u.addr.addr
+			&& (e->u.optr == add || e->u.optr == sub)) {
+		*c = e->u.optr == add ? e->kid[1]->u.value : -e->kid[1]->u.value;
+		return 1;
+	}
+	if (e->kid[1]->kind == VarN && e->kid[0]->kind == NumN && e->u.optr == add
+			&& e->kid[1]->u.addr.level == n->u.addr.level && e->kid[1]->u.addr.addr == n->u.addr.addr) {
+		*c = e->kid[0]->u.value;
+		return 1;
+	}
+	return 0;
+}
+
+/* ループの中の代入を調べて誘導変数の候補を集める */
+static void findIvs(Node *n)
+{
+	int i, c, k;
+	Iv *v;
+	if (n == NULL)
+		return;
+	if (n->kind == AssignN || n->kind == AssignArrN) {
+		v = ivEntry(n->u.addr);
+		v->updates++;
+		k = n->u.addr.addr + nPars;
+		if (n->kind == AssignArrN || n->u.addr.level != blk->u.blk->level || !ivStep(n, &c)
+				|| (hasCall && 0 <= k && k < nShared && shared[k]))
+			v->ok = 0;                      /* 呼び出しで変わりうる変数も除く */
+	}
+	for (i = 0; i < n->nKid; i++)
+		findIvs(n->kid[i]);
+}
+
+/* 変数aが誘導変数ならその番号、でなければ-1 */
+static int ivIndex(RelAddr a)
+{
+	int i;
+	for (i = 0; i < nIv; i++)
+		if (ivs[i].ok && ivs[i].a.level == a.level && ivs[i].a.addr == a.addr)
+			return i;
+	return -1;
+}
+
+/* 変数の参照eが誘導変数ならその番号、でなければ-1 */
+static int ivOf(Node *e)
+{
+	return e->kind == VarN ? ivIndex(e->u.addr) : -1;
+}
+
+/* eはループで不変な定数か変数か */
+static int simpleInv(Node *e)
+{
+	return e->kind == NumN || (e->kind == VarN && !modified(e->u.addr));
+}
+
+/* eが i*k か k*i の形ならdに入れて1を返す */
+static int ivMul(Node *e, Derived *d)
+{
+	if (e->kind != BinN || e->u.optr != mul)
+		return 0;
+	if ((d->iv = ivOf(e->kid[0])) >= 0 && simpleInv(e->kid[1]))
+		d->k = e->kid[1];
+	else if ((d->iv = ivOf(e->kid[1])) >= 0 && simpleInv(e->kid[0]))
+		d->k = e->kid[0];
+	else
+		return 0;
+	return 1;
+}
+
+/* eが誘導変数から導かれる式ならdに入れて1を返す */
+static int affine(Node *e, Derived *d)
+{
+	d->j = NULL;
+	d->s = 1;
+	d->jNeg = 0;
+	if (e->kind != BinN)
+		return 0;
+	if (ivMul(e, d))
+		return 1;
+	if (e->u.optr != add && e->u.optr != sub)
+		return 0;
+	if (ivMul(e->kid[0], d) && simpleInv(e->kid[1])) {          /* i*k + j, i*k - j */
+		d->j = e->kid[1];
+		d->jNeg = e->u.optr == sub;
+		return 1;
+	}
+	if (ivMul(e->kid[1], d) && simpleInv(e->kid[0])) {          /* j + i*k, j - i*k */
+		d->j = e->kid[0];
+		d->s = e->u.optr == sub ? -1 : 1;
+		return 1;
+	}
+	return 0;
+}
+
+/* 定数か変数の参照として同じか */
+static int sameLeaf(Node *a, Node *b)
+{
+	if (a == NULL || b == NULL)
+		return a == b;
+	if (a->kind != b->kind)
+		return 0;
+	if (a->kind == NumN)
+		return a->u.value == b->u.value;
+	return a->u.addr.level == b->u.addr.level && a->u.addr.addr == b->u.addr.addr;
+}
+
+/* 一時変数tの参照 */
+static Node *varNode(RelAddr t, int line)
+{
+	Node *v = newNode(VarN, 0);
+	v->u.addr = t;
+	v->line = line;
+	return v;
+}
+
+/* 誘導変数から導かれる式を数える(replaceが0のとき)か、一時変数に置き換える
+ * (初期化はプリヘッダの文として集める) */
+static void replaceAffine(Node **np, int replace)
+{
+	Node *n = *np, *a;
+	Derived d;
+	int i;
+
+	if (n == NULL)
+		return;
+	if (n->kind >= AssignN || !affine(n, &d)) {
+		for (i = 0; i < n->nKid; i++)
+			replaceAffine(&n->kid[i], replace);
+		return;
+	}
+	for (i = 0; i < nDer; i++)
+		if (ders[i].iv == d.iv && ders[i].s == d.s && ders[i].jNeg == d.jNeg
+				&& sameLeaf(ders[i].k, d.k) && sameLeaf(ders[i].j, d.j))
+			break;
+	if (!replace) {
+		if (i == nDer) {
+			if (nDer == maxDer) {
+				maxDer = maxDer ? maxDer * 2 : 16;
+				ders = realloc(ders, maxDer * sizeof(Derived));
+			}
+			d.uses = 0;
+			d.t.addr = -1;
+			ders[nDer++] = d;
+		}
+		ders[i].uses++;
+		return;
+	}
+	if (!ders[i].use)
+		return;
+	if (ders[i].t.addr < 0) {
+		ders[i].t.level = blk->u.blk->level;
+		ders[i].t.addr = blk->u.blk->frame++;
+		a = newNode1(AssignN, copyNode(n));    /* プリヘッダで t := i*k + j */
+		a->u.addr = ders[i].t;
+		a->line = n->line;
+		pushKid(a);
+	}
+	*np = varNode(ders[i].t, n->line);
+}
+
+/* 誘導変数への代入のあとに、それから導かれる一時変数の更新を置く */
+static void insertUpdates(Node **np)
+{
+	Node *n = *np, *e, *u;
+	int i, k, c, coef, mark;
+	RelAddr st;
+
+	if (n == NULL || n->kind < AssignN)
+		return;
+	for (i = 0; i < n->nKid; i++)
+		insertUpdates(&n->kid[i]);
+	if (n->kind != AssignN || (k = ivIndex(n->u.addr)) < 0 || !ivStep(n, &c))
+		return;
+	mark = kidMark();
+	pushKid(n);
+	for (i = 0; i < nDer; i++) {
+		if (ders[i].iv != k || !ders[i].use)
+			continue;
+		coef = ders[i].s * c;               /* t := t + coef*k */
+		if (ders[i].k->kind == NumN) {
+			e = newNode(NumN, 0);
+			e->u.value = coef * ders[i].k->u.value;
+			e = newNode2(BinN, varNode(ders[i].t, n->line), e);
+			e->u.optr = add;
+		}
+		else if (coef == 1 || coef == -1) {
+			e = newNode2(BinN, varNode(ders[i].t, n->line), copyNode(ders[i].k));
+			e->u.optr = coef == 1 ? add : sub;
+		}
+		else {
+			/* 増分 coef*k はプリヘッダで計算しておく */
+			st.level = blk->u.blk->level;
+			st.addr = blk->u.blk->frame++;
+			e = newNode(NumN, 0);
+			e->u.value = coef;
+			e = newNode2(BinN, copyNode(ders[i].k), e);
+			e->u.optr = mul;
+			u = newNode1(AssignN, e);
+			u->u.addr = st;
+			u->line = n->line;
+			if (nStep == maxStep) {
+				maxStep = maxStep ? maxStep * 2 : 16;
+				steps = realloc(steps, maxStep * sizeof(Node *));
+			}
+			steps[nStep++] = u;
+			e = newNode2(BinN, varNode(ders[i].t, n->line), varNode(st, n->line));
+			e->u.optr = add;
+		}
+		e->line = n->line;
+		u = newNode1(AssignN, e);
+		u->u.addr = ders[i].t;
+		u->line = n->line;
+		pushKid(u);
+	}
+	e = endKids(newNode(BeginN, 0), mark);
+	e->line = n->line;
+	*np = e;
+}
+
+/* ループnの誘導変数の強さの軽減(一時変数の初期化はプリヘッダの文として集める) */
+static void reduce(Node *n, int from)
+{
+	int i, use;
+	loopMods(n, from);
+	nIv = nDer = 0;
+	for (i = from; i < n->nKid; i++)
+		findIvs(n->kid[i]);
+	for (i = 0; i < nIv; i++)
+		if (ivs[i].ok)
+			break;
+	if (i == nIv)
+		return;
+	for (i = from; i < n->nKid; i++)
+		replaceAffine(&n->kid[i], 0);
+	/* 式の命令(i*kで3, i*k+jで5)を一時変数の参照1つにする分が、代入ごとの更新の
+	 * 4命令以上になるときだけ置き換える(同じなら掛け算が足し算になる分を得とする) */
+	use = 0;
+	for (i = 0; i < nDer; i++) {
+		ders[i].use = ders[i].uses * (ders[i].j ? 4 : 2) >= 4 * ivs[ders[i].iv].updates;
+		use |= ders[i].use;
+	}
+	if (!use)
+		return;
+	for (i = from; i < n->nKid; i++)
+		replaceAffine(&n->kid[i], 1);
+	nStep = 0;
+	for (i = from; i < n->nKid; i++)
+		insertUpdates(&n->kid[i]);
+	for (i = 0; i < nStep; i++)
+		pushKid(steps[i]);
+}
+
+/* 節点xが変数vの参照か代入か */
+static int sameVar(Node *x, RelAddr v)
+{
+	return x != NULL && (x->kind == VarN || x->kind == AssignN)
+		&& x->u.addr.level == v.level && x->u.addr.addr == v.addr;
+}
+
+/* 節点の数 */
+static int nodeCount(Node *n)
+{
+	int i, c = 1;
+	if (n == NULL)
+		return 0;
+	for (i = 0; i < n->nKid; i++)
+		c += nodeCount(n->kid[i]);
+	return c;
+}
+
+/* 増分の文nの中の誘導変数の代入(強さの軽減で更新の文が後ろに付くこともある) */
+static Node *ivAssign(Node *n, int *c)
+{
+	if (n != NULL && n->kind == BeginN && n->nKid > 0)
+		n = n->kid[0];
+	return n != NULL && n->kind == AssignN && ivStep(n, c) ? n : NULL;
+}
+
+/* ループの繰り返しの文(本体と増分)を集める */
+static void pushIter(Node *n)
+{
+	pushKid(copyNode(n->kid[3]));
+	pushKid(copyNode(n->kid[2]));
+}
+
+/* 本体と増分の命令語の数がsize、条件式がcondのfor文をu回に展開すると増える命令語の数.
+   tripsは回数(分からなければ-1)、initは終りの値を一時変数に入れる文の命令語の数 */
+static int growth(int u, long long trips, int size, int cond, int init)
+{
+	if (trips < 0)                             /* 展開したループを足し、もとのループは残す */
+		return u * size + cond + 2 + init;
+	return (trips >= u ? u * size + cond + 2 : 0) + (int)(trips % u) * size - (size + cond + 2);
+}
+
+/* for文*npを本体と増分が続く形のwhile文にし、回数の数えられるループは展開する.
+   for i := a; i < e; i := i + c do S (eは定数かループ不変な変数、<は<=, >, >=でもよい)は
+     i := a; t := e - (u-1)*c; while i < t do begin S; i := i + c; ... (u回) end;
+     while i < e do begin S; i := i + c end
+   にする(uはunrollFactor、tは新しい一時変数). eが定数ならtも定数にし、aも定数なら
+   回数が分かるので、残りの回数分はループにせずに並べる.
+   e - (u-1)*cがあふれる(c > 0でeが整数の最小値に近い)ときの動きは元のループと違う */
+static void unroll(Node **np)
+{
+	Node *n = *np, *cnd = n->kid[1], *iv, *e, *a = NULL, *w, *t, *x, *lv = NULL;
+	int c, i, mark, size, init, u = unrollFactor;
+	long long trips = -1, lim;
+	Operator rel;
+	RelAddr v;
+
+	mark = kidMark();                          /* 展開しないときの形 */
+	pushKid(n->kid[3]);
+	pushKid(n->kid[2]);
+	w = newNode2(WhileN, cnd, endKids(newNode(BeginN, 0), mark));
+	w->line = n->line;
+	*np = newNode2(BeginN, n->kid[0], w);
+	(*np)->line = n->line;
+	if (u <= 1 || (iv = ivAssign(n->kid[2], &c)) == NULL || c == 0
+			|| cnd == NULL || cnd->kind != BinN || nodeCount(n->kid[3]) + nodeCount(n->kid[2]) > UNROLLSIZE)
+		return;
+	v = iv->u.addr;
+	rel = cnd->u.optr;
+	if (sameVar(cnd->kid[0], v))
+		e = cnd->kid[1];
+	else if (sameVar(cnd->kid[1], v)) {        /* e < i は i > e にする */
+		e = cnd->kid[0];
+		rel = rel == ls ? gr : rel == gr ? ls : rel == lseq ? greq : rel == greq ? lseq : rel;
+	} else
+		return;
+	if (!(c > 0 && (rel == ls || rel == lseq)) && !(c < 0 && (rel == gr || rel == greq)))
+		return;
+	nMod = 0;                                  /* 本体と増分の他の文は誘導変数もeも変えない */
+	hasCall = 0;
+	collect(n->kid[3]);
+	if (n->kid[2]->kind == BeginN)
+		for (i = 1; i < n->kid[2]->nKid; i++)
+			collect(n->kid[2]->kid[i]);
+	if (modified(v) || (e->kind != NumN && (e->kind != VarN || sameVar(e, v) || modified(e->u.addr))))
+		return;
+	if (n->kid[0] != NULL)                     /* 初期化(後ろにプリヘッダの文が付くこともある) */
+		a = n->kid[0]->kind == BeginN && n->kid[0]->nKid > 0 ? n->kid[0]->kid[0] : n->kid[0];
+	if (e->kind == NumN && a != NULL && a->kind == AssignN && sameVar(a, v)
+			&& a->kid[0] != NULL && a->kid[0]->kind == NumN) {
+		lim = e->u.value;                      /* 回数を数える(終りの値も範囲内であること) */
+		if (rel == lseq)
+			lim++;
+		if (rel == greq)
+			lim--;
+		trips = c > 0 ? (lim - a->kid[0]->u.value + c - 1) / c : (a->kid[0]->u.value - lim - c - 1) / -c;
+		if (trips < 0)
+			trips = 0;
+		lim = a->kid[0]->u.value + (trips + u) * (long long)c;
+		if (lim > INT_MAX || lim < INT_MIN)
+			return;
+	}
+	size = codeSize(n->kid[3]) + codeSize(n->kid[2]);
+	init = e->kind == NumN ? 0 : codeSize(e) + 3;
+	while (u > 1 && growth(u, trips, size, codeSize(cnd), init) > room)
+		u--;                                   /* 収まらなければ回数を減らす */
+	if (u <= 1)
+		return;
+	room -= growth(u, trips, size, codeSize(cnd), init);
+	x = copyNode(sameVar(cnd->kid[0], v) ? cnd->kid[0] : cnd->kid[1]);
+	t = newNode(NumN, 0);
+	if (e->kind == NumN) {                     /* i < e-(u-1)*c */
+		lim = e->u.value - (long long)(u - 1) * c;
+		if (lim > INT_MAX || lim < INT_MIN)
+			return;
+		t->u.value = (int)lim;
+		cnd = newNode2(BinN, x, t);
+	} else {                                   /* i < t (tはプリヘッダで t := e-(u-1)*c) */
+		t->u.value = (u - 1) * c;
+		t = newNode2(BinN, copyNode(e), t);
+		t->u.optr = sub;
+		lv = newNode1(AssignN, t);
+		lv->u.addr.level = blk->u.blk->level;
+		lv->u.addr.addr = blk->u.blk->frame++;
+		t = newNode(VarN, 0);
+		t->u.addr = lv->u.addr;
+		cnd = newNode2(BinN, x, t);
+	}
+	cnd->u.optr = rel;
+	cnd->line = n->line;
+	mark = kidMark();
+	pushKid(n->kid[0]);
+	pushKid(lv);
+	if (trips < 0 || trips >= u) {
+		i = kidMark();
+		for (c = 0; c < u; c++)
+			pushIter(n);
+		t = newNode2(WhileN, cnd, endKids(newNode(BeginN, 0), i));
+		t->line = n->line;
+		pushKid(t);
+	}
+	if (trips < 0)
+		pushKid(w);                            /* 残りの回数はもとのループで */
+	else
+		for (c = 0; c < trips % u; c++)
+			pushIter(n);
+	*np = endKids(newNode(BeginN, 0), mark);
+	(*np)->line = n->line;
+}
+
+/* ループ*npの最適化. 不変式の計算と一時変数の初期化はプリヘッダに置く */
+static void optLoop(Node **np)
+{
+	Node *n = *np, *pre, *save = copyNode(n);   /* 収まらなければ元に戻す */
+	int mark = kidMark(), from = n->kind == ForN ? 1 : 0;    /* for文の初期化はループの外 */
+	int size = codeSize(n), frame = blk->u.blk->frame;
+
+	licm(n, from);
+	reduce(n, from);
+	if (kidMark() == mark)
+		return;
+	pre = endKids(newNode(BeginN, 0), mark);
+	pre->line = n->line;
+	if (n->kind == ForN)                    /* 初期化のあとで計算する */
+		n->kid[0] = n->kid[0] ? newNode2(BeginN, n->kid[0], pre) : pre;
+	else
+		*np = newNode2(BeginN, pre, n);
+	if (codeSize(*np) - size > room) {      /* 一時変数の計算と更新でMAXCODEを越える */
+		*np = save;
+		blk->u.blk->frame = frame;
+		return;
+	}
+	room -= codeSize(*np) - size;
+}
+
+/* 文*npの中のループを内側から最適化する */
+static void optStmt(Node **np)
+{
+	Node *n = *np;
+	int i;
+	if (n == NULL || n->kind < AssignN || n->kind == BlockN)
+		return;                             /* 式にはループはない */
+	for (i = 0; i < n->nKid; i++)
+		optStmt(&n->kid[i]);
+	switch (n->kind) {
+	case WhileN:
+	case DoN:
+	case RepeatN:
+		optLoop(np);
+		break;
+	case ForN:
+		optLoop(np);
+		unroll(np);
+		break;
+	default:
+		break;
+	}
+}
+
+/* ブロックbとその内部のブロックのループの最適化 */
+static void optBlock(Node *b)
+{
+	int i;
+	for (i = 0; i < b->nKid; i++)
+		optBlock(b->kid[i]);
+	blk = b;
+	nPars = b->u.blk->level == 0 ? 0 : b->u.blk->pars;
+	nShared = nPars + b->u.blk->frame;
+	if ((shared = calloc(nShared > 0 ? nShared : 1, 1)) == NULL)
+		return;
+	for (i = 0; i < b->nKid; i++)
+		markShared(b->kid[i]);
+	optStmt(&b->u.blk->body);
+	free(shared);
+}
+
+/* 構文木の上でのループの最適化 */
+void optimizeLoops(Node *prog)
+{
+	double t = statsMode ? statsClock() : 0;
+	room = MAXCODE - codeSize(prog);
+	optBlock(prog);
+	free(mod);
+	free(ivs);
+	free(ders);
+	free(steps);
+	mod = NULL;
+	ivs = NULL;
+	ders = NULL;
+	steps = NULL;
+	nMod = maxMod = maxIv = maxDer = maxStep = 0;
+	if (statsMode)
+		stats.time[optPh] += statsClock() - t;
+}
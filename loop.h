@@ -0,0 +1,11 @@
+/********** loop.h **********/
+#ifndef LOOP_H_
+#define LOOP_H_
+
+#include "ast.h"
+
+extern int unrollFactor;           /* for文を展開する数(1以下なら展開しない) */
+
+void optimizeLoops(Node *prog);    /* 構文木の上でのループの最適化 */
+
+#endif
@@ -1,31 +1,128 @@
 /********** main.c **********/
 #include <stdio.h>
+#include <string.h>
 #include "getSource.h"
+#include "codegen.h"
+#include "stats.h"
+#include "perf.h"
+#include "ir.h"
+#include "inline.h"
+#include "loop.h"
+#include "pool.h"
+#include "spawn.h"
+#include "batch.h"
+
+int compile();
+
+static void usage()
+{
+	printf("pl0d [-l] [-O] [--inline=n] [--unroll=n] [--memo] [--spawn] [--threads=n] [--stats[=json]] [--prof[=n]] [--heat] [--perf] src\n");
+	printf("pl0d [-O] [--inline=n] [--unroll=n] [--memo] [--spawn] [--threads=n] [--steps=n] --batch src...\n");
+}
 
 int main(int argc, char* argv[])
 {
-	if (argc == 2) {
-		/* pl0d src */
-		if (!openSource(argv[1]))
-			return;
-		if (compile()) {
-			execute();
+	int list = 0;    /* -l なら目的コードのリスティング */
+	int batch = 0;   /* --batch なら多くのプログラムを並列に実行 */
+	int steps = 0;   /* --steps=n があったか(--batchのときだけ) */
+	int i, ok;
+	double t;
+
+	nThreads = poolDefault();
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (strcmp(argv[i], "-l") == 0)
+			list = 1;
+		else if (strcmp(argv[i], "-O") == 0)
+			optMode = 1;
+		else if (strncmp(argv[i], "--inline=", 9) == 0 && sscanf(argv[i] + 9, "%d", &inlineMax) == 1 && inlineMax >= 0)
+			;
+		else if (strncmp(argv[i], "--unroll=", 9) == 0 && sscanf(argv[i] + 9, "%d", &unrollFactor) == 1 && unrollFactor >= 0)
+			;
+		else if (strcmp(argv[i], "--memo") == 0)
+			memoMode = 1;
+		else if (strcmp(argv[i], "--spawn") == 0)
+			spawnMode = 1;
+		else if (strcmp(argv[i], "--batch") == 0)
+			batch = 1;
+		else if (strncmp(argv[i], "--steps=", 8) == 0 && sscanf(argv[i] + 8, "%ld", &batchSteps) == 1 && batchSteps >= 0)
+			steps = 1;
+		else if (strncmp(argv[i], "--threads=", 10) == 0 && sscanf(argv[i] + 10, "%d", &nThreads) == 1
+				&& nThreads >= 1 && nThreads <= MAXTHREADS)
+			;
+		else if (strcmp(argv[i], "--stats") == 0 || strcmp(argv[i], "--stats=text") == 0)
+			statsMode = textStats;
+		else if (strcmp(argv[i], "--stats=json") == 0)
+			statsMode = jsonStats;
+		else if (strcmp(argv[i], "--perf") == 0)
+			perfMode = 1;
+		else if (strcmp(argv[i], "--heat") == 0)
+			heatMode = 1;
+		else if (strcmp(argv[i], "--prof") == 0)
+			profTop = 20;
+		else if (strncmp(argv[i], "--prof=", 7) == 0 && sscanf(argv[i] + 7, "%d", &profTop) == 1 && profTop > 0)
+			;
+		else {
+			usage();
+			return 1;
 		}
-		/* ソースプログラムファイルのclose */
-		closeSource();
 	}
-	else if (argc == 3 && strcmp(argv[1], "-l") == 0) {
-		/* pl0d -l src */
-		if (!openSource(argv[2]))
-			return;
-		if (compile()) {
+	if (batch) {    /* 計数やリスティングは一つのプログラムのときだけ */
+		if (i == argc || list || statsMode || perfMode || heatMode || profTop) {
+			usage();
+			return 1;
+		}
+		return batchRun(argv + i, argc - i) != 0;
+	}
+	if (i != argc - 1 || steps) {
+		usage();
+		return 1;
+	}
+
+	/* pl0d [-l] src */
+	if (!openSource(argv[i]))
+		return 1;
+	if (perfMode)
+		perfOpen();    /* 開けなかったカウンタはperfReportで報告する */
+	t = statsMode ? statsClock() : 0;
+	if (perfMode)
+		perfBegin();
+	ok = compile();
+	if (perfMode)
+		perfEnd(compilePf);
+	if (statsMode) {
+		/* 字句解析とトークンの印字の分はnextToken()で、最適化の分はoptimize()で計っている */
+		stats.time[parsePh] = statsClock() - t - stats.time[lexPh] - stats.time[listPh] - stats.time[optPh];
+		stats.codes = nextCode();
+	}
+	if (ok) {
+		t = statsMode ? statsClock() : 0;
+		if (list) {
 			listCode();
+			if (statsMode)
+				stats.time[listPh] += statsClock() - t;
+		}
+		else {
+			if (perfMode)
+				perfBegin();
+			execute();
+			if (perfMode)
+				perfEnd(executePf);
+			if (statsMode)
+				stats.time[execPh] = statsClock() - t;
+			if (profTop)
+				profileReport(profTop);
 		}
-		/* ソースプログラムファイルのclose */
-		closeSource();
 	}
-	else {
-		printf("pl0d [-l] src\n");
+	/* ソースプログラムファイルのclose */
+	closeSource();
+	if (ok && !list && heatMode)
+		heatMap();    /* .htmlファイルを閉じてから書き直す */
+	if (statsMode)
+		statsReport();
+	if (perfMode) {
+		if (statsMode != jsonStats)
+			perfReport();    /* jsonならstatsReportの中で出力した */
+		perfClose();
 	}
 
 	return 0;
@@ -0,0 +1,492 @@
+/********** parfor.c **********/
+/*
+ * 並列のfor文
+ *
+ * parallel for i := a; i < e; i := i + c do S  (cは0でない定数. <=, >, >=, e > i などでもよい)
+ * の本体Sを、ループ変数をパラメタとする手続きのブロック(繰り返しの手続き)にして、
+ * ParForNのpfor命令が繰り返しをスレッドプール(pool.c)のスレッドに分けて呼ぶ.
+ * 各スレッドは実行時スタックの自分の領域にフレームとオペランドを積み、外側の
+ * ブロックの変数はディスプレイを通して共有する. 繰り返しの手続きのブロックは
+ * 並列のforのあるブロックの内部のブロック(最後の子)にする.
+ * 繰り返しが共有する変数に書かないことをコンパイル時に確かめる.
+ *   - 本体の文の並びの中で、それより前の文が参照しない変数xに x := f (fはxを含まない)
+ *     か for x := f; ... で代入する文があれば、xは繰り返しごとの変数(繰り返しの
+ *     手続きの局所変数)にする. ループのあとの共有の変数xの値は変わらない
+ *   - 本体はそれ以外の変数(ループ変数を含む)に代入せず、出力せず、return文を含まない
+ *   - 呼び出す関数と手続き(呼び出しをたどったものすべて)は、自分のブロックより外の
+ *     変数に代入せず、出力せず、繰り返しごとの変数とループ変数を参照しない.
+ *     主文をまだ解析していないブロック(再帰的な呼び出し)は呼ばない
+ *   - eは呼び出し、配列の要素、ループ変数、繰り返しごとの変数を含まない(一度だけ計算する)
+ *   - 並列のforの本体の中の並列のforは普通のfor文にする
+ * 配列の要素への代入を繰り返しごとに別の要素にすることはプログラムに任せる.
+ * 条件に合わなければ理由を注意書きとして.htmlファイルに出して(エラーには数えない)
+ * 普通のfor文にする.
+ * 呼び出し先は、主文の構文解析と一緒に作ったブロックの要約で調べる
+ * (構文木の上の最適化をしないときは、ブロックの構文木はコードを生成してすぐ解放する).
+ */
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <limits.h>
+#include "getSource.h"
+#include "ast.h"
+#include "parfor.h"
+
+#define FIRSTADDR 2         /* 各ブロックの最初の変数のアドレス(compile.cと同じ) */
+#define MAXPRIV 32          /* 繰り返しごとの変数の数の上限 */
+
+static RelAddr iv;          /* ループ変数 */
+static RelAddr priv[MAXPRIV];    /* 繰り返しごとの変数 */
+static int nPriv;
+static char *seen;          /* 調べた呼び出し先のブロック */
+static int nSeen;
+static char *why;           /* 並列にできない理由(なければNULL) */
+
+/* stdlib.hはOperatorのdivと衝突するので読まない */
+extern void *malloc(size_t size);
+extern void *realloc(void *p, size_t size);
+extern void free(void *p);
+
+/* 呼び出し先のブロックの要約 */
+typedef struct summary {
+	char *why;              /* 並列のforから呼べない理由(繰り返しによらないもの、なければNULL) */
+	RelAddr *outer;         /* 参照する、自分のブロックより外の変数 */
+	int nOuter;
+	Node **callee;          /* 呼び出すブロック */
+	int nCallee;
+} Summary;
+
+static Summary **sums = NULL;     /* ブロックの番号から要約を引く表 */
+static int maxSums;
+static RelAddr *outerBuf = NULL;  /* 要約を作る途中の変数の並び */
+static int maxOuter;
+static Node **calleeBuf = NULL;   /* 要約を作る途中の呼び出し先の並び */
+static int maxCallee;
+static Summary *cur = NULL;       /* 作りかけの要約 */
+static Node *curBlk;              /* そのブロック */
+static int curLev;                /* そのレベル */
+static int stamp;                 /* 作っている要約の通し番号(次の二つの表で今の要約のものを見分ける) */
+static struct varSlot {           /* 要約に加えた変数のハッシュ表(開番地法) */
+	RelAddr a;
+	int stamp;
+} *varSlot = NULL;
+static int nSlot;                 /* varSlot[]の大きさ(2のべき) */
+static int *calleeStamp = NULL;   /* ブロックの番号ごとの、要約に加えたときのstamp */
+static int maxStamp;
+
+/* 番地aとbが同じか */
+static int same(RelAddr a, RelAddr b)
+{
+	return a.level == b.level && a.addr == b.addr;
+}
+
+/* 節点xが変数aの参照か */
+static int isVar(Node *x, RelAddr a)
+{
+	return x != NULL && x->kind == VarN && same(x->u.addr, a);
+}
+
+/* 変数aは繰り返しごとの変数か(番号+1、でなければ0) */
+static int privOf(RelAddr a)
+{
+	int k;
+	for (k = 0; k < nPriv; k++)
+		if (same(priv[k], a))
+			return k + 1;
+	return 0;
+}
+
+/* 文や式nが変数aを参照(代入を含む)するか */
+static int refers(Node *n, RelAddr a)
+{
+	int i;
+	if (n == NULL || n->kind == BlockN)
+		return 0;
+	if ((n->kind == VarN || n->kind == AssignN) && same(n->u.addr, a))
+		return 1;
+	for (i = 0; i < n->nKid; i++)
+		if (refers(n->kid[i], a))
+			return 1;
+	return 0;
+}
+
+/* 文sが繰り返しごとの変数にできる x := f か for x := f; ... なら、その代入文を返す */
+static Node *initOf(Node *s)
+{
+	if (s != NULL && s->kind == ForN)
+		s = s->kid[0];
+	if (s == NULL || s->kind != AssignN || s->kid[0] == NULL || same(s->u.addr, iv) || refers(s->kid[0], s->u.addr))
+		return NULL;
+	return s;
+}
+
+/* 本体sの文の並びから繰り返しごとの変数を集める */
+static void findPrivate(Node *s)
+{
+	Node **st = &s, *a;
+	int n = 1, i, j;
+	if (s != NULL && s->kind == BeginN) {
+		st = s->kid;
+		n = s->nKid;
+	}
+	for (i = 0; i < n; i++) {
+		if ((a = initOf(st[i])) == NULL || privOf(a->u.addr) || nPriv == MAXPRIV)
+			continue;
+		for (j = 0; j < i; j++)
+			if (refers(st[j], a->u.addr))
+				break;
+		if (j == i)
+			priv[nPriv++] = a->u.addr;
+	}
+}
+
+/* 変数aのハッシュ表の位置(なければ加える位置) */
+static int varSlotOf(RelAddr a)
+{
+	unsigned h = (unsigned)a.addr * 32 + a.level;
+	for (h = (h ^ h >> 7) & (nSlot - 1); varSlot[h].stamp == stamp; h = (h + 1) & (nSlot - 1))
+		if (same(varSlot[h].a, a))
+			break;
+	return h;
+}
+
+/* 外の変数aを要約sに加える */
+static void addOuter(RelAddr a, Summary *s)
+{
+	int i, h;
+	if (2 * (s->nOuter + 1) > nSlot) {        /* 表を大きくして入れ直す */
+		nSlot = nSlot ? nSlot * 2 : 256;
+		if ((varSlot = realloc(varSlot, nSlot * sizeof(varSlot[0]))) == NULL)
+			errorF("out of memory");
+		memset(varSlot, 0, nSlot * sizeof(varSlot[0]));
+		for (i = 0; i < s->nOuter; i++) {
+			h = varSlotOf(outerBuf[i]);
+			varSlot[h].a = outerBuf[i];
+			varSlot[h].stamp = stamp;
+		}
+	}
+	h = varSlotOf(a);
+	if (varSlot[h].stamp == stamp)            /* 加えてある */
+		return;
+	varSlot[h].a = a;
+	varSlot[h].stamp = stamp;
+	if (s->nOuter == maxOuter) {
+		maxOuter = maxOuter ? maxOuter * 2 : 64;
+		if ((outerBuf = realloc(outerBuf, maxOuter * sizeof(RelAddr))) == NULL)
+			errorF("out of memory");
+	}
+	outerBuf[s->nOuter++] = a;
+}
+
+/* 呼び出し先のブロックbを要約sに加える */
+static void addCallee(Node *b, Summary *s)
+{
+	int id = b->u.blk->id;
+	if (id >= maxStamp) {
+		int m = maxStamp ? maxStamp : 64;
+		while (m <= id)
+			m *= 2;
+		if ((calleeStamp = realloc(calleeStamp, m * sizeof(int))) == NULL)
+			errorF("out of memory");
+		memset(calleeStamp + maxStamp, 0, (m - maxStamp) * sizeof(int));
+		maxStamp = m;
+	}
+	if (calleeStamp[id] == stamp)             /* 加えてある */
+		return;
+	calleeStamp[id] = stamp;
+	if (s->nCallee == maxCallee) {
+		maxCallee = maxCallee ? maxCallee * 2 : 64;
+		if ((calleeBuf = realloc(calleeBuf, maxCallee * sizeof(Node *))) == NULL)
+			errorF("out of memory");
+	}
+	calleeBuf[s->nCallee++] = b;
+}
+
+/* ブロックbの主文の解析を始める(主文の中の参照や呼び出しをsummaryVarなどで加えていく).
+   並列のforの本体もこのブロックのものとする. 内部のブロックの主文はbの主文より前に
+   解析を終えるので、作りかけの要約は一つだけ */
+void summaryBegin(Node *b, int level)
+{
+	if ((cur = malloc(sizeof(Summary))) == NULL)
+		errorF("out of memory");
+	cur->why = NULL;
+	cur->nOuter = cur->nCallee = 0;
+	curBlk = b;
+	curLev = level;
+	stamp++;
+}
+
+/* 主文で変数aを参照した */
+void summaryVar(RelAddr a)
+{
+	if (cur != NULL && a.level < curLev)
+		addOuter(a, cur);
+}
+
+/* 主文で変数aに代入した */
+void summaryAssign(RelAddr a)
+{
+	if (cur != NULL && a.level < curLev && cur->why == NULL)
+		cur->why = "shared variable assigned in a called function";
+}
+
+/* 主文で出力した */
+void summaryWrite()
+{
+	if (cur != NULL && cur->why == NULL)
+		cur->why = "write in a called function";
+}
+
+/* 主文でブロックbを呼んだ */
+void summaryCall(Node *b)
+{
+	if (cur != NULL && b != NULL)
+		addCallee(b, cur);
+}
+
+/* ブロックの主文の解析を終えた. 要約を登録する */
+void summaryEnd()
+{
+	Summary *s = cur;
+	int id;
+
+	if (s == NULL)
+		return;
+	cur = NULL;
+	id = curBlk->u.blk->id;
+	if (id >= maxSums) {
+		int m = maxSums ? maxSums : 64;
+		while (m <= id)
+			m *= 2;
+		if ((sums = realloc(sums, m * sizeof(Summary *))) == NULL)
+			errorF("out of memory");
+		memset(sums + maxSums, 0, (m - maxSums) * sizeof(Summary *));
+		maxSums = m;
+	}
+	s->outer = malloc((s->nOuter > 0 ? s->nOuter : 1) * sizeof(RelAddr));
+	s->callee = malloc((s->nCallee > 0 ? s->nCallee : 1) * sizeof(Node *));
+	if (s->outer == NULL || s->callee == NULL)
+		errorF("out of memory");
+	memcpy(s->outer, outerBuf, s->nOuter * sizeof(RelAddr));
+	memcpy(s->callee, calleeBuf, s->nCallee * sizeof(Node *));
+	sums[id] = s;
+}
+
+/* ブロックの要約を解放する */
+void summaryFree()
+{
+	int i;
+	for (i = 0; i < maxSums; i++)
+		if (sums[i] != NULL) {
+			free(sums[i]->outer);
+			free(sums[i]->callee);
+			free(sums[i]);
+			sums[i] = NULL;
+		}
+}
+
+/* 呼び出し先のブロックbを調べる */
+static void checkBlock(Node *b)
+{
+	Summary *s;
+	int i, id;
+	if (b == NULL || why != NULL || (id = b->u.blk->id) >= nSeen || seen[id])
+		return;
+	if (id >= maxSums || (s = sums[id]) == NULL) {
+		why = "recursive call";             /* 主文をまだ解析していない */
+		return;
+	}
+	seen[id] = 1;
+	for (i = 0; i < s->nOuter; i++)
+		if (privOf(s->outer[i]) || same(s->outer[i], iv)) {
+			why = "private variable used in a called function";
+			return;
+		}
+	if (s->why != NULL) {
+		why = s->why;
+		return;
+	}
+	for (i = 0; i < s->nCallee && why == NULL; i++)
+		checkBlock(s->callee[i]);
+}
+
+/* 本体の文や式nを調べる */
+static void checkBody(Node *n)
+{
+	int i;
+	if (n == NULL || why != NULL)
+		return;
+	switch (n->kind) {
+	case AssignN:
+		if (same(n->u.addr, iv))
+			why = "loop variable assigned";
+		else if (!privOf(n->u.addr))
+			why = "shared variable assigned";
+		break;
+	case WriteN:
+	case WriteLnN:
+		why = "write in parallel for";
+		break;
+	case RetN:
+		why = "return in parallel for";
+		break;
+	case CallN:
+	case CallStN:
+		checkBlock(n->u.call.blk);
+		break;
+	default:
+		break;
+	}
+	for (i = 0; i < n->nKid; i++)
+		checkBody(n->kid[i]);
+}
+
+/* 終りの値eを一度だけ計算してよいか */
+static int invariant(Node *e)
+{
+	int i;
+	if (e == NULL || e->kind == CallN || e->kind == ArrN || e->kind == SeqN)
+		return 0;
+	if (e->kind == VarN && (isVar(e, iv) || privOf(e->u.addr)))
+		return 0;
+	for (i = 0; i < e->nKid; i++)
+		if (!invariant(e->kid[i]))
+			return 0;
+	return 1;
+}
+
+/* 増分 i := i + c, i := c + i, i := i - c の定数cを*stepに入れる */
+static int stepOf(Node *s, int *step)
+{
+	Node *e;
+	if (s == NULL || s->kind != AssignN || !same(s->u.addr, iv) || (e = s->kid[0]) == NULL || e->kind != BinN)
+		return 0;
+	if (isVar(e->kid[0], iv) && e->kid[1]->kind == NumN && (e->u.optr == add
+			|| (e->u.optr == sub && e->kid[1]->u.value != INT_MIN))) {
+		*step = e->u.optr == add ? e->kid[1]->u.value : -e->kid[1]->u.value;
+		return *step != 0 && *step != INT_MIN;
+	}
+	if (isVar(e->kid[1], iv) && e->kid[0]->kind == NumN && e->u.optr == add) {
+		*step = e->kid[0]->u.value;
+		return *step != 0 && *step != INT_MIN;
+	}
+	return 0;
+}
+
+/* 条件cndから終りの値(含まない)の式を作る(できなければNULL) */
+static Node *endOf(Node *cnd, int step)
+{
+	Operator rel;
+	Node *e, *one;
+	if (cnd == NULL || cnd->kind != BinN)
+		return NULL;
+	rel = cnd->u.optr;
+	if (isVar(cnd->kid[0], iv))
+		e = cnd->kid[1];
+	else if (isVar(cnd->kid[1], iv)) {         /* e > i は i < e にする */
+		e = cnd->kid[0];
+		rel = rel == gr ? ls : rel == greq ? lseq : rel == ls ? gr : rel == lseq ? greq : rel;
+	} else
+		return NULL;
+	if (step > 0 ? rel != ls && rel != lseq : rel != gr && rel != greq)
+		return NULL;
+	if (!invariant(e))
+		return NULL;
+	if (rel == lseq || rel == greq) {
+		one = newNode(NumN, 0);
+		one->u.value = 1;
+		e = newNode2(BinN, e, one);
+		e->u.optr = rel == lseq ? add : sub;
+		e->line = cnd->line;
+	}
+	return e;
+}
+
+/* 本体の変数の参照を繰り返しの手続きのものにする(ループ変数はパラメタ) */
+static void remap(Node *n, int level)
+{
+	int i, k;
+	if (n == NULL || n->kind == BlockN)
+		return;
+	if (n->kind == VarN || n->kind == AssignN) {
+		if (same(n->u.addr, iv)) {
+			n->u.addr.level = level;
+			n->u.addr.addr = -1;
+		}
+		else if ((k = privOf(n->u.addr)) > 0) {
+			n->u.addr.level = level;
+			n->u.addr.addr = FIRSTADDR + k - 1;
+		}
+	}
+	for (i = 0; i < n->nKid; i++)
+		remap(n->kid[i], level);
+}
+
+/* ブロックbの子にkを加える */
+static void addKid(Node *b, Node *k)
+{
+	Node **kid = astAlloc((b->nKid + 1) * sizeof(Node *));
+	if (b->nKid > 0)
+		memcpy(kid, b->kid, b->nKid * sizeof(Node *));
+	kid[b->nKid++] = k;
+	b->kid = kid;
+}
+
+/* for文fを、レベルlevelのブロックbの中の並列のforにする(できなければfを返す) */
+Node *parallelFor(Node *f, Node *b, int level)
+{
+	Node *n, *e, *it, *v;
+	int step = 0;
+
+	why = NULL;
+	nPriv = 0;
+	if (f->kid[0] == NULL || f->kid[0]->kind != AssignN)
+		why = "not a counting loop";
+	else {
+		iv = f->kid[0]->u.addr;
+		if (!stepOf(f->kid[2], &step) || (e = endOf(f->kid[1], step)) == NULL)
+			why = "not a counting loop";
+		else if (level + 1 >= MAXLEVEL)
+			why = "too many nested blocks";
+	}
+	if (why == NULL) {
+		findPrivate(f->kid[3]);
+		for (nSeen = 0; blockOf(nSeen) != NULL; nSeen++)
+			;
+		seen = astAlloc(nSeen > 0 ? nSeen : 1);
+		memset(seen, 0, nSeen > 0 ? nSeen : 1);
+		checkBody(f->kid[3]);
+		if (why == NULL && !invariant(e))  /* 本体で決まった繰り返しごとの変数を読まない */
+			why = "loop bound not invariant";
+	}
+	if (why != NULL) {
+		noteMessage(why);
+		return f;
+	}
+	it = newBlock();                          /* 繰り返しの手続き */
+	it->line = f->line;
+	it->u.blk->level = level + 1;
+	it->u.blk->isProc = 1;
+	it->u.blk->pars = 1;
+	it->u.blk->frame = FIRSTADDR + nPriv;
+	it->u.blk->started = 1;
+	it->u.blk->endLine = sourceLine();
+	remap(f->kid[3], level + 1);
+	it->u.blk->body = f->kid[3];
+	addKid(b, it);
+
+	n = newNode(ParForN, 4);
+	n->line = f->line;
+	n->u.call.level = level;
+	n->u.call.toEntry = 1;
+	n->u.call.blk = it;
+	n->kid[0] = f->kid[0];
+	n->kid[1] = e;
+	n->kid[2] = newNode(NumN, 0);
+	n->kid[2]->u.value = step;
+	v = newNode(VarN, 0);
+	v->u.addr = iv;
+	v->line = f->line;
+	n->kid[3] = v;
+	return n;
+}
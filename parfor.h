@@ -0,0 +1,16 @@
+/********** parfor.h **********/
+#ifndef PARFOR_H_
+#define PARFOR_H_
+
+#include "ast.h"
+
+Node *parallelFor(Node *f, Node *b, int level);    /* for文fをブロックbの中の並列のforにする */
+void summaryBegin(Node *b, int level);             /* ブロックbの主文の要約を作り始める */
+void summaryVar(RelAddr a);                        /* 主文で変数aを参照した */
+void summaryAssign(RelAddr a);                     /* 主文で変数aに代入した */
+void summaryWrite();                               /* 主文で出力した */
+void summaryCall(Node *b);                         /* 主文でブロックbを呼んだ */
+void summaryEnd();                                 /* 主文の要約を登録する */
+void summaryFree();                                /* ブロックの要約を解放する */
+
+#endif
@@ -0,0 +1,172 @@
+/********** perf.c **********/
+/*
+ * Linuxのperf_event_openでハードウェアカウンタを読む
+ * カーネルが許さない場合やLinux以外では、読めないカウンタを報告して何もしない
+ */
+#include <stdio.h>
+#include <string.h>
+#include "perf.h"
+#include "stats.h"
+
+#if defined(__linux__)
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+int perfMode = 0;
+
+static char *eventName[] = { "cycles", "instructions", "branch-misses", "cache-misses" };
+static char *phaseName[] = { "compile", "execute" };
+
+static int fd[end_of_PerfEvent];                          /* 各イベントのファイル記述子(開けなければ-1) */
+static char *why[end_of_PerfEvent];                       /* 開けなかった理由 */
+static double count[end_of_PerfPhase][end_of_PerfEvent];  /* 各区間の値 */
+static int measured[end_of_PerfPhase];                    /* その区間を計測したか */
+
+#if defined(__linux__)
+/* 読み出す値の形式(PERF_FORMAT_TOTAL_TIME_ENABLED|PERF_FORMAT_TOTAL_TIME_RUNNING) */
+typedef struct perfValue {
+	unsigned long long value;
+	unsigned long long enabled;
+	unsigned long long running;
+} PerfValue;
+
+static unsigned long long config[] = {
+	PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES
+};
+
+/* カウンタを開く(一つも開けなければ0を返す) */
+int perfOpen()
+{
+	struct perf_event_attr pe;
+	int i, n = 0;
+
+	for (i = 0; i < end_of_PerfEvent; i++) {
+		memset(&pe, 0, sizeof(pe));
+		pe.type = PERF_TYPE_HARDWARE;
+		pe.size = sizeof(pe);
+		pe.config = config[i];
+		pe.disabled = 1;
+		pe.exclude_kernel = 1;    /* perf_event_paranoidが2でも読めるように利用者空間だけを数える */
+		pe.exclude_hv = 1;
+		pe.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		fd[i] = syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+		if (fd[i] < 0)
+			why[i] = strerror(errno);
+		else
+			n++;
+	}
+	return n > 0;
+}
+
+/* 区間の計測を始める */
+void perfBegin()
+{
+	int i;
+	for (i = 0; i < end_of_PerfEvent; i++)
+		if (fd[i] >= 0) {
+			ioctl(fd[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(fd[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+}
+
+/* 区間の計測を終え、phの値に加える */
+void perfEnd(PerfPhase ph)
+{
+	PerfValue v;
+	int i;
+	for (i = 0; i < end_of_PerfEvent; i++)
+		if (fd[i] >= 0)
+			ioctl(fd[i], PERF_EVENT_IOC_DISABLE, 0);
+	for (i = 0; i < end_of_PerfEvent; i++) {
+		if (fd[i] < 0)
+			continue;
+		if (read(fd[i], &v, sizeof(v)) != sizeof(v))
+			continue;
+		/* 他のイベントと多重化された場合は動いていた時間の割合で補正する */
+		if (v.running > 0 && v.running < v.enabled)
+			count[ph][i] += (double)v.value * v.enabled / v.running;
+		else
+			count[ph][i] += v.value;
+	}
+	measured[ph] = 1;
+}
+
+/* カウンタを閉じる */
+void perfClose()
+{
+	int i;
+	for (i = 0; i < end_of_PerfEvent; i++)
+		if (fd[i] >= 0) {
+			close(fd[i]);
+			fd[i] = -1;
+		}
+}
+#else
+int perfOpen()
+{
+	int i;
+	for (i = 0; i < end_of_PerfEvent; i++) {
+		fd[i] = -1;
+		why[i] = "perf_event_open is only available on Linux";
+	}
+	return 0;
+}
+
+void perfBegin()
+{
+}
+
+void perfEnd(PerfPhase ph)
+{
+}
+
+void perfClose()
+{
+}
+#endif
+
+/* 計測結果を標準エラー出力に出力. --stats=jsonならstatsReportのオブジェクトに"perf"の項を書く */
+void perfReport()
+{
+	int i, p;
+
+	if (statsMode == jsonStats) {
+		fprintf(stderr, ", \"perf\": {");
+		for (p = 0; p < end_of_PerfPhase; p++) {
+			fprintf(stderr, p ? ", \"%s\": {" : "\"%s\": {", phaseName[p]);
+			for (i = 0; i < end_of_PerfEvent; i++) {
+				fprintf(stderr, i ? ", " : "");
+				if (fd[i] >= 0 && measured[p])
+					fprintf(stderr, "\"%s\": %.0f", eventName[i], count[p][i]);
+				else
+					fprintf(stderr, "\"%s\": null", eventName[i]);
+			}
+			fprintf(stderr, "}");
+		}
+		fprintf(stderr, "}");
+		return;
+	}
+	fprintf(stderr, "; perf\n");
+	for (i = 0; i < end_of_PerfEvent; i++)
+		if (fd[i] < 0)
+			fprintf(stderr, ";   %-14s not available (%s)\n", eventName[i], why[i]);
+	for (p = 0; p < end_of_PerfPhase; p++) {
+		if (!measured[p])
+			continue;
+		for (i = 0; i < end_of_PerfEvent && fd[i] < 0; i++)
+			;
+		if (i == end_of_PerfEvent)
+			continue;                       /* 読めたカウンタがない */
+		fprintf(stderr, ";   %s\n", phaseName[p]);
+		for (i = 0; i < end_of_PerfEvent; i++)
+			if (fd[i] >= 0)
+				fprintf(stderr, ";     %-14s %15.0f\n", eventName[i], count[p][i]);
+		if (fd[cyclesEv] >= 0 && fd[instrEv] >= 0 && count[p][cyclesEv] > 0)
+			fprintf(stderr, ";     %-14s %15.2f\n", "IPC", count[p][instrEv] / count[p][cyclesEv]);
+	}
+}
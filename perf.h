@@ -0,0 +1,25 @@
+/********** perf.h **********/
+#ifndef PERF_H_
+#define PERF_H_
+
+/* 計測するハードウェアイベント */
+typedef enum perfEvents {
+	cyclesEv, instrEv, branchMissEv, cacheMissEv,
+	end_of_PerfEvent
+} PerfEvent;
+
+/* 計測する区間 */
+typedef enum perfPhases {
+	compilePf, executePf,
+	end_of_PerfPhase
+} PerfPhase;
+
+extern int perfMode;          /* 真ならハードウェアカウンタを読む */
+
+int perfOpen();               /* カウンタを開く(一つも開けなければ0を返す) */
+void perfBegin();             /* 区間の計測を始める */
+void perfEnd(PerfPhase ph);   /* 区間の計測を終え、phの値に加える */
+void perfReport();            /* 計測結果を標準エラー出力に出力(--stats=jsonならstatsReportが呼ぶ) */
+void perfClose();             /* カウンタを閉じる */
+
+#endif
@@ -0,0 +1,247 @@
+/********** pool.c **********/
+/*
+ * 仕事を盗み合うスレッドプール
+ *
+ * スレッド(主スレッドとワーカースレッド)はそれぞれ仕事の両端キューを持つ. 仕事は
+ * 自分の両端キューの底に積み、待つときにまだ底にあれば取り出して自分で実行する.
+ * 手の空いたスレッドはほかのスレッドの両端キューの天辺(いちばん古い仕事)を盗む.
+ * 盗まれた仕事を待つスレッドも、終わるまでほかの仕事を盗んで実行する.
+ * ワーカースレッドは最初に仕事を積むときにnThreads-1個作る. しばらく盗めなければ
+ * 条件変数で眠り、仕事が積まれると起こされる.
+ * 並列のfor(poolFor)は、繰り返しの範囲をスレッドあたりCHUNKS個ほどの小さな範囲に
+ * 分けておき、仕事として積んでほかのスレッドに盗ませ、呼び出したスレッドも加わって
+ * 次の範囲を原子的に取っていくので、繰り返しの重さが揃っていなくても早く終わった
+ * スレッドが残りを引き受ける.
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "pool.h"
+
+#if defined(__GNUC__)
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
+#define CHUNKS 8                    /* スレッドあたりに分ける範囲の数 */
+#define DEQUESIZE 64                /* 両端キューに積める仕事の数 */
+#define SPINS 100                   /* 眠る前に仕事を盗もうとする回数 */
+
+int nThreads = 1;
+
+/* 仕事の両端キュー. task[top..bottom-1]が積まれていて、盗むのはtopから */
+typedef struct deque {
+	pthread_mutex_t lock;
+	int top, bottom;
+	PoolTask *task[DEQUESIZE];
+} Deque;
+
+static Deque deque[MAXTHREADS];
+static THREAD_LOCAL int self;       /* このスレッドの番号 */
+static int started;                 /* ワーカースレッドを作ったか */
+static int queued;                  /* 両端キューに積まれている仕事の数 */
+static int sleeping;                /* 眠っているワーカーの数 */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;     /* 仕事が積まれた */
+
+/* 小さな範囲に分けた繰り返し */
+typedef struct forJob {
+	void (*fn)(void *arg, void *ctx, long from, long to);
+	void *arg;
+	long count, chunk;
+	long next;                      /* まだ誰も取っていない最初の繰り返し */
+} ForJob;
+
+/* ほかのスレッドに繰り返しを手伝わせる仕事 */
+typedef struct forTask {
+	PoolTask t;
+	ForJob *job;
+} ForTask;
+
+/* 既定のスレッドの数(使えるプロセッサの数、MAXTHREADSまで) */
+int poolDefault()
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n < 1 ? 1 : n > MAXTHREADS ? MAXTHREADS : (int)n;
+}
+
+/* 呼んだスレッドの番号 */
+int poolSelf()
+{
+	return self;
+}
+
+/* 仕事を積むとよいか */
+int poolIdle()
+{
+	Deque *d = &deque[self];
+	return nThreads > 1 && __atomic_load_n(&d->top, __ATOMIC_RELAXED) == d->bottom;
+}
+
+/* 仕事tを実行して終わったことにする */
+static void runTask(PoolTask *t, void *ctx)
+{
+	t->fn(t, ctx);
+	__atomic_store_n(&t->done, 1, __ATOMIC_RELEASE);
+}
+
+/* ほかのスレッドの両端キューから仕事を盗む(なければNULL) */
+static PoolTask *steal()
+{
+	PoolTask *t = NULL;
+	Deque *d;
+	int k;
+	for (k = 1; k < nThreads && t == NULL; k++) {
+		d = &deque[(self + k) % nThreads];
+		if (__atomic_load_n(&d->top, __ATOMIC_RELAXED) >= __atomic_load_n(&d->bottom, __ATOMIC_RELAXED))
+			continue;
+		pthread_mutex_lock(&d->lock);
+		if (d->top < d->bottom) {
+			t = d->task[d->top];
+			__atomic_store_n(&d->top, d->top + 1, __ATOMIC_RELAXED);
+			__atomic_sub_fetch(&queued, 1, __ATOMIC_SEQ_CST);
+		}
+		pthread_mutex_unlock(&d->lock);
+	}
+	return t;
+}
+
+/* ワーカースレッド(番号はp) */
+static void *worker(void *p)
+{
+	PoolTask *t;
+	int idle = 0;
+	self = (int)(long)p;
+	for (;;) {
+		if ((t = steal()) != NULL) {
+			runTask(t, NULL);
+			idle = 0;
+		}
+		else if (++idle < SPINS)
+			sched_yield();
+		else {                          /* 積んだスレッドはsleepingを見てから起こす */
+			pthread_mutex_lock(&lock);
+			__atomic_add_fetch(&sleeping, 1, __ATOMIC_SEQ_CST);
+			while (__atomic_load_n(&queued, __ATOMIC_SEQ_CST) == 0)
+				pthread_cond_wait(&wake, &lock);
+			__atomic_sub_fetch(&sleeping, 1, __ATOMIC_SEQ_CST);
+			pthread_mutex_unlock(&lock);
+			idle = 0;
+		}
+	}
+	return NULL;
+}
+
+/* ワーカースレッドを作る(主スレッドが最初に仕事を積むとき) */
+static void startWorkers()
+{
+	pthread_t t;
+	int w;
+	for (w = 0; w < MAXTHREADS; w++)
+		pthread_mutex_init(&deque[w].lock, NULL);
+	started = 1;
+	for (w = 1; w < nThreads; w++) {    /* 作れなかった分は積んだスレッドが自分で実行する */
+		if (pthread_create(&t, NULL, worker, (void *)(long)w) != 0)
+			break;
+		pthread_detach(t);
+	}
+}
+
+/* 呼んだスレッドの両端キューに仕事tを積む */
+int poolSpawn(PoolTask *t)
+{
+	Deque *d = &deque[self];
+	if (!started)
+		startWorkers();
+	t->done = 0;
+	pthread_mutex_lock(&d->lock);
+	if (d->top == d->bottom)
+		__atomic_store_n(&d->top, d->bottom = 0, __ATOMIC_RELAXED);
+	if (d->bottom == DEQUESIZE) {
+		pthread_mutex_unlock(&d->lock);
+		return 0;
+	}
+	d->task[d->bottom] = t;
+	__atomic_store_n(&d->bottom, d->bottom + 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&queued, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&d->lock);
+	if (__atomic_load_n(&sleeping, __ATOMIC_SEQ_CST) > 0) {
+		pthread_mutex_lock(&lock);
+		pthread_cond_signal(&wake);
+		pthread_mutex_unlock(&lock);
+	}
+	return 1;
+}
+
+/* 仕事tの終りを待つ(積んだ仕事は積んだ順の逆に待つ) */
+void poolJoin(PoolTask *t, void *ctx)
+{
+	Deque *d = &deque[self];
+	PoolTask *s;
+	int mine = 0;
+	pthread_mutex_lock(&d->lock);
+	if (d->top < d->bottom && d->task[d->bottom - 1] == t) {
+		__atomic_store_n(&d->bottom, d->bottom - 1, __ATOMIC_RELAXED);
+		__atomic_sub_fetch(&queued, 1, __ATOMIC_SEQ_CST);
+		mine = 1;
+	}
+	pthread_mutex_unlock(&d->lock);
+	if (mine) {                         /* 盗まれていない */
+		runTask(t, ctx);
+		return;
+	}
+	while (!__atomic_load_n(&t->done, __ATOMIC_ACQUIRE)) {
+		if (ctx != NULL && (s = steal()) != NULL)
+			runTask(s, ctx);
+		else
+			sched_yield();
+	}
+}
+
+/* 範囲を取ってはfnを呼ぶ */
+static void forWork(ForJob *job, void *ctx)
+{
+	long from, to;
+	while ((from = __atomic_fetch_add(&job->next, job->chunk, __ATOMIC_RELAXED)) < job->count) {
+		to = from + job->chunk < job->count ? from + job->chunk : job->count;
+		job->fn(job->arg, ctx, from, to);
+	}
+}
+
+/* 盗んだスレッドが繰り返しを手伝う */
+static void forRun(PoolTask *t, void *ctx)
+{
+	forWork(((ForTask *)t)->job, ctx);
+}
+
+/* 範囲0..count-1をnThreads個までのスレッドで分けてfn(arg, ctx, from, to)を呼ぶ */
+void poolFor(long count, void (*fn)(void *arg, void *ctx, long from, long to), void *arg, void *ctx)
+{
+	int n = nThreads < count ? nThreads : (int)count, k, m = 0;
+	ForJob job;
+	ForTask help[MAXTHREADS];
+
+	if (n <= 1) {
+		if (count > 0)
+			fn(arg, ctx, 0, count);
+		return;
+	}
+	job.fn = fn;
+	job.arg = arg;
+	job.count = count;
+	job.chunk = count / ((long)n * CHUNKS);
+	if (job.chunk < 1)
+		job.chunk = 1;
+	job.next = 0;
+	for (k = 0; k < n - 1; k++) {       /* 手伝う仕事を積む */
+		help[k].t.fn = forRun;
+		help[k].job = &job;
+		if (!poolSpawn(&help[k].t))
+			break;
+		m++;
+	}
+	forWork(&job, ctx);
+	while (m > 0)
+		poolJoin(&help[--m].t, ctx);
+}
@@ -0,0 +1,28 @@
+/********** pool.h **********/
+#ifndef POOL_H_
+#define POOL_H_
+
+#define MAXTHREADS 16     /* 並列に実行するスレッドの数の上限 */
+
+extern int nThreads;      /* 並列に実行するスレッドの数(呼び出したスレッドを含む、--threads=n) */
+
+/* スレッドで実行する仕事. fnの第二引数ctxは実行するスレッドの文脈で、poolJoinで待つ
+   あいだに実行するときはそれに渡したもの、ワーカーが手が空いて実行するときはNULL */
+typedef struct poolTask {
+	void (*fn)(struct poolTask *t, void *ctx);
+	int done;                                  /* 実行を終えたか */
+} PoolTask;
+
+int poolDefault();        /* 既定のスレッドの数(使えるプロセッサの数、MAXTHREADSまで) */
+int poolSelf();           /* 呼んだスレッドの番号(0は主スレッド、ワーカーは1から) */
+int poolIdle();           /* 仕事を積むとよいか(スレッドが二つ以上あり、呼んだスレッドの両端キューが空) */
+int poolSpawn(PoolTask *t);    /* 呼んだスレッドの両端キューにtを積む(いっぱいなら0を返す) */
+/* tの終りを待つ. 盗まれていなければ自分でctxで実行し、盗まれていれば待つあいだに
+   ほかの仕事を盗んでctxで実行する(ctxがNULLなら盗まずに待つ) */
+void poolJoin(PoolTask *t, void *ctx);
+/* 範囲0..count-1を小さな範囲に分け、nThreads個までのスレッドでfn(arg, ctx, from, to)を
+   呼ぶ(ctxは上と同じ、呼び出したスレッドはctxを渡す). すべて終わってから戻る.
+   仕事の中から呼んでもよい */
+void poolFor(long count, void (*fn)(void *arg, void *ctx, long from, long to), void *arg, void *ctx);
+
+#endif
@@ -0,0 +1,215 @@
+/********** spawn.c **********/
+/*
+ * 独立な純粋な関数の呼び出しの並列な評価(--spawn)
+ *
+ * f(x) + g(y) のように二項演算の左の項が純粋な関数の呼び出しで右の項も重ければ、
+ * 左の呼び出しをSpawnNにしてほかのスレッドで評価する仕事にし、そのあいだにこの
+ * スレッドで右の項を評価して、演算の前に待ち合わせる(SyncN). 実引数の並びも同じく、
+ * 最後の重い実引数より前の、仕事にできる呼び出しをすべてSpawnNにする.
+ *   - 純粋な関数: 自分のブロックの変数(パラメタを含む)だけを読み書きし、出力せず、
+ *     並列のforを含まず、純粋な関数だけを呼ぶ(呼び出しをたどって決める). ほかの式と
+ *     同時に評価しても値は変わらない. 仕事にするのはパラメタがSPAWNARGS個までのもの
+ *   - 重さは節点の数で見積もり、ループはLOOPWEIGHT倍、呼び出しは呼び出し先の主文の
+ *     重さを加える. 再帰的に呼ばれる関数はSPAWNCOSTとする. 仕事にする呼び出しと、
+ *     並行に評価する最後の式の両方がSPAWNCOST以上のときだけ仕事にする
+ * 仮想機械はspn命令で呼び出しを仕事にしてスレッドプール(pool.c)の自分の両端キューに
+ * 積み、暇なスレッドが盗んで実行する. 両端キューに盗まれていない仕事が残っていれば
+ * calと同じに呼ぶので、仕事は暇なスレッドがあるときだけ増える. syn命令は仕事の終りを
+ * 待って(盗まれていなければ自分で実行して)値をspn命令が空けておいた場所に入れる.
+ * 再帰的な分割統治の関数はどの深さでも仕事を盗めるので、スレッドの数に応じて速くなる.
+ */
+#include <stdio.h>
+#include <stddef.h>
+#include "ast.h"
+#include "spawn.h"
+#include "stats.h"
+
+/* stdlib.hはOperatorのdivと衝突するので読まない */
+extern void *calloc(size_t n, size_t size);
+extern void free(void *p);
+
+#define SPAWNCOST 200       /* 仕事にする式の重さの下限 */
+#define LOOPWEIGHT 10       /* ループの重さの倍率 */
+#define MAXCOST (SPAWNCOST * 1000)    /* 重さの上限(溢れないように) */
+
+int spawnMode = 0;
+
+static int nBlks;
+static char *impure;        /* 純粋でない関数か */
+static char *state;         /* 主文の重さを 0:求めていない 1:求めている 2:求めた */
+static int *cost;           /* 主文の重さ */
+
+/* 文や式nが、レベルlevelの変数だけを使って出力しないか(呼び出し先は見ない) */
+static int localPure(Node *n, int level)
+{
+	int i;
+	if (n == NULL)
+		return 1;
+	switch (n->kind) {
+	case VarN:
+	case ArrN:
+	case AssignN:
+	case AssignArrN:
+		if (n->u.addr.level != level)
+			return 0;
+		break;
+	case WriteN:
+	case WriteLnN:
+	case ParForN:
+		return 0;
+	default:
+		break;
+	}
+	for (i = 0; i < n->nKid; i++)
+		if (!localPure(n->kid[i], level))
+			return 0;
+	return 1;
+}
+
+/* 文や式nが純粋でない関数を呼ぶか */
+static int callsImpure(Node *n)
+{
+	int i;
+	if (n == NULL)
+		return 0;
+	if ((n->kind == CallN || n->kind == CallStN || n->kind == TailN)
+			&& (n->u.call.blk == NULL || impure[n->u.call.blk->u.blk->id]))
+		return 1;
+	for (i = 0; i < n->nKid; i++)
+		if (callsImpure(n->kid[i]))
+			return 1;
+	return 0;
+}
+
+static int blockCost(Node *b);
+
+/* 文や式nの重さ */
+static int weigh(Node *n)
+{
+	int i;
+	long w = 1;
+	if (n == NULL)
+		return 0;
+	for (i = 0; i < n->nKid; i++)
+		w += weigh(n->kid[i]);
+	switch (n->kind) {
+	case CallN:
+	case CallStN:
+	case TailN:
+	case SpawnN:
+		w += blockCost(n->u.call.blk);
+		break;
+	case WhileN:
+	case DoN:
+	case RepeatN:
+	case ForN:
+	case VecN:
+		w *= LOOPWEIGHT;
+		break;
+	default:
+		break;
+	}
+	return w > MAXCOST ? MAXCOST : (int)w;
+}
+
+/* ブロックbの主文の重さ(求めている途中のブロックを呼べば再帰的なのでSPAWNCOST) */
+static int blockCost(Node *b)
+{
+	int id;
+	if (b == NULL)
+		return 0;
+	id = b->u.blk->id;
+	if (state[id] == 1)
+		return SPAWNCOST;
+	if (state[id] == 0) {
+		state[id] = 1;
+		cost[id] = weigh(b->u.blk->body);
+		state[id] = 2;
+	}
+	return cost[id];
+}
+
+/* 式nが仕事にできる純粋な関数の重い呼び出しか */
+static int spawnable(Node *n)
+{
+	Node *b;
+	if (n == NULL || n->kind != CallN || (b = n->u.call.blk) == NULL)
+		return 0;
+	return !impure[b->u.blk->id] && b->u.blk->pars <= SPAWNARGS && weigh(n) >= SPAWNCOST;
+}
+
+/* 順に評価してまとめて使う式kid[0..n-1]の、最後の重い式より前の呼び出しを仕事にし、
+   最後の重い式のあとで待ち合わせる */
+static void forkKids(Node **kid, int n)
+{
+	int j, k, count = 0;
+	Node *s;
+	for (j = n - 1; j > 0 && weigh(kid[j]) < SPAWNCOST; j--)
+		;
+	for (k = 0; k < j; k++)
+		if (spawnable(kid[k])) {
+			kid[k]->kind = SpawnN;
+			count++;
+		}
+	if (count > 0) {
+		s = newNode1(SyncN, kid[j]);
+		s->u.value = count;
+		s->line = kid[j]->line;
+		kid[j] = s;
+	}
+}
+
+/* 文や式nの中の二項演算と実引数の並びを調べる(内側から) */
+static void walk(Node *n)
+{
+	int i;
+	if (n == NULL || n->kind == BlockN)
+		return;
+	for (i = 0; i < n->nKid; i++)
+		walk(n->kid[i]);
+	switch (n->kind) {
+	case BinN:
+	case CallN:
+	case CallStN:
+	case TailN:
+		forkKids(n->kid, n->nKid);
+		break;
+	default:
+		break;
+	}
+}
+
+/* 重い純粋な関数の呼び出しをスレッドで評価する仕事にする */
+void spawnCalls(Node *prog)
+{
+	double t = statsMode ? statsClock() : 0;
+	int id, changed;
+	Node *b;
+
+	for (nBlks = 0; blockOf(nBlks) != NULL; nBlks++)
+		;
+	impure = calloc(nBlks + 1, 1);
+	state = calloc(nBlks + 1, 1);
+	cost = calloc(nBlks + 1, sizeof(int));
+	if (impure && state && cost) {
+		for (id = 0; id < nBlks; id++) {
+			b = blockOf(id);
+			impure[id] = b->u.blk->level == 0 || b->u.blk->isProc || !localPure(b->u.blk->body, b->u.blk->level);
+		}
+		do {                                /* 純粋でない関数を呼ぶ関数も純粋でない */
+			changed = 0;
+			for (id = 0; id < nBlks; id++)
+				if (!impure[id] && callsImpure(blockOf(id)->u.blk->body)) {
+					impure[id] = 1;
+					changed = 1;
+				}
+		} while (changed);
+		for (id = 0; id < nBlks; id++)
+			walk(blockOf(id)->u.blk->body);
+	}
+	free(impure);
+	free(state);
+	free(cost);
+	if (statsMode)
+		stats.time[optPh] += statsClock() - t;
+}
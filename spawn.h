@@ -0,0 +1,11 @@
+/********** spawn.h **********/
+#ifndef SPAWN_H_
+#define SPAWN_H_
+
+#include "ast.h"
+
+extern int spawnMode;    /* 真なら独立な純粋な関数の呼び出しを並列に評価する(--spawn) */
+
+void spawnCalls(Node *prog);    /* 重い純粋な関数の呼び出しをスレッドで評価する仕事にする */
+
+#endif
@@ -0,0 +1,57 @@
+/********** stats.c **********/
+#include <stdio.h>
+#include <time.h>
+#include "stats.h"
+#include "perf.h"
+
+StatsMode statsMode = noStats;
+int profTop = 0;
+int heatMode = 0;
+Stats stats;
+
+static char *phaseName[] = { "lex", "parse", "opt", "list", "exec" };
+
+/* 時刻(秒) */
+double statsClock()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* 統計情報を標準エラー出力に出力 */
+void statsReport()
+{
+	int i;
+
+	if (statsMode == jsonStats) {
+		fprintf(stderr, "{\"time\": {");
+		for (i = 0; i < end_of_Phase; i++)
+			fprintf(stderr, i ? ", \"%s\": %.9f" : "\"%s\": %.9f", phaseName[i], stats.time[i]);
+		fprintf(stderr, "}, ");
+		fprintf(stderr, "\"tokens\": %ld, \"names\": %ld, \"codes\": %ld, ",
+			stats.tokens, stats.names, stats.codes);
+		fprintf(stderr, "\"steps\": %ld, \"calls\": %ld, \"maxStack\": %d, ",
+			stats.steps, stats.calls, stats.maxStack);
+		fprintf(stderr, "\"memoCalls\": %ld, \"memoHits\": %ld", stats.memoCalls, stats.memoHits);
+		if (perfMode)
+			perfReport();                   /* 一つのオブジェクトにまとめる */
+		fprintf(stderr, "}\n");
+		return;
+	}
+	fprintf(stderr, "; stats\n");
+	fprintf(stderr, ";   lex      %12.3f ms\n", stats.time[lexPh] * 1e3);
+	fprintf(stderr, ";   parse    %12.3f ms    (parse and code generation)\n", stats.time[parsePh] * 1e3);
+	fprintf(stderr, ";   opt      %12.3f ms\n", stats.time[optPh] * 1e3);
+	fprintf(stderr, ";   list     %12.3f ms\n", stats.time[listPh] * 1e3);
+	fprintf(stderr, ";   exec     %12.3f ms\n", stats.time[execPh] * 1e3);
+	fprintf(stderr, ";   tokens   %12ld\n", stats.tokens);
+	fprintf(stderr, ";   names    %12ld\n", stats.names);
+	fprintf(stderr, ";   codes    %12ld\n", stats.codes);
+	fprintf(stderr, ";   steps    %12ld    (instructions executed)\n", stats.steps);
+	fprintf(stderr, ";   calls    %12ld\n", stats.calls);
+	fprintf(stderr, ";   maxStack %12d    (words)\n", stats.maxStack);
+	if (stats.memoCalls > 0)
+		fprintf(stderr, ";   memo     %12ld    (hits of %ld calls, %.1f%%)\n",
+			stats.memoHits, stats.memoCalls, 100.0 * stats.memoHits / stats.memoCalls);
+}
@@ -0,0 +1,41 @@
+/********** stats.h **********/
+#ifndef STATS_H_
+#define STATS_H_
+
+/* 時間を計る段階 */
+typedef enum phases {
+	lexPh,        /* 字句解析 */
+	parsePh,      /* 構文解析とコード生成(compile()全体から字句解析、トークンの印字、最適化の分を引いたもの) */
+	optPh,        /* 目的コードの最適化(-O) */
+	listPh,       /* リスティング(.htmlへのトークンの印字とlistCode) */
+	execPh,       /* 実行 */
+	end_of_Phase
+} Phase;
+
+/* 統計情報の出力形式 */
+typedef enum statsModes {
+	noStats, textStats, jsonStats
+} StatsMode;
+
+/* 統計情報 */
+typedef struct stats {
+	double time[end_of_Phase];    /* 各段階の経過時間(秒) */
+	long tokens;                  /* 読んだトークン数 */
+	long names;                   /* 名前表に登録した名前の数 */
+	long codes;                   /* 生成した命令語の数 */
+	long steps;                   /* 実行した命令語の数 */
+	long calls;                   /* 実行したcal命令の数 */
+	int maxStack;                 /* 実行時スタックの最大の深さ */
+	long memoCalls;               /* 実行したcalm命令の数(--memo) */
+	long memoHits;                /* そのうち覚えておいた値を使った数 */
+} Stats;
+
+extern StatsMode statsMode;       /* noStatsなら統計をとらない */
+extern int heatMode;              /* 真なら実行後に.htmlファイルにヒートマップを書き込む */
+extern int profTop;               /* 実行プロファイルで出力する個数(0ならプロファイルをとらない) */
+extern Stats stats;
+
+double statsClock();              /* 時刻(秒) */
+void statsReport();               /* 統計情報を標準エラー出力に出力 */
+
+#endif
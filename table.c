@@ -1,8 +1,11 @@
 /********** table.c **********/
 #include "table.h"
 #include "getSource.h"
+#include "stats.h"
 
+#ifndef MAXTABLE
 #define MAXTABLE 100    /* 名前表の最大長さ */
+#endif
 #define MAXNAME  31     /* 名前の最大長さ */
 #define MAXLEVEL 5      /* ブロックの最大深さ */
 
@@ -100,7 +103,8 @@ static int enterTsequence(char *id, int v, KindT kind)
 /* 名前表に名前を登録 */
 void enterT(char *id)
 {
-	if (tIndex++ < MAXTABLE)
+	stats.names++;
+	if (++tIndex < MAXTABLE)
 		strcpy(nameTable[tIndex].name, id);
 	else
 		errorF("too many names");
@@ -0,0 +1,105 @@
+/********** tail.c **********/
+/*
+ * 自分自身の末尾呼び出しの除去(-O)
+ *
+ * 関数の中の return f(...) と、手続きの中の call p(...) のうち主文の最後に
+ * 実行されるもの(return文がすぐあとに続くものも含む)で、呼び出し先が自分自身の
+ * ものをTailNに置き換える. TailNは実引数を計算してからパラメタに代入し、主文の
+ * 先頭(ict命令の次)へ飛ぶので、再帰が深くなってもスタックは伸びない.
+ * 局所変数には前の値が残るが、呼び出したときも初期化されていないので変わらない.
+ */
+#include <stdio.h>
+#include "ast.h"
+#include "tail.h"
+#include "stats.h"
+
+static Node *blk;           /* 処理中のブロック */
+
+/* 呼び出しnが自分自身の呼び出しか */
+static int selfCall(Node *n, NodeKind k)
+{
+	return n != NULL && n->kind == k && n->u.call.blk == blk;
+}
+
+/* 呼び出しnをTailNにする */
+static Node *tailNode(Node *n)
+{
+	Node *t = newNode(TailN, n->nKid);
+	int i;
+	t->line = n->line;
+	t->u = n->u;
+	for (i = 0; i < n->nKid; i++)
+		t->kid[i] = n->kid[i];
+	return t;
+}
+
+/* 主文の最後に実行される文*npが自分自身のcall文ならTailNにする */
+static void tailPos(Node **np)
+{
+	Node *n = *np;
+	if (n == NULL)
+		return;
+	switch (n->kind) {
+	case CallStN:
+		if (selfCall(n, CallStN))
+			*np = tailNode(n);
+		break;
+	case BeginN:
+		if (n->nKid > 0)
+			tailPos(&n->kid[n->nKid - 1]);
+		break;
+	case IfN:
+		tailPos(&n->kid[1]);
+		if (n->nKid > 2)
+			tailPos(&n->kid[2]);
+		break;
+	case UnlessN:
+		tailPos(&n->kid[1]);
+		break;
+	default:
+		break;
+	}
+}
+
+/* 文*npの中の return f(...) と call p(...); return を探す */
+static void retCalls(Node **np)
+{
+	Node *n = *np;
+	int i;
+	if (n == NULL || n->kind < AssignN || n->kind == BlockN)
+		return;
+	if (n->kind == RetN && n->nKid == 1 && selfCall(n->kid[0], CallN)) {
+		*np = tailNode(n->kid[0]);
+		return;
+	}
+	if (n->kind == BeginN)
+		for (i = 0; i + 1 < n->nKid; i++)
+			if (selfCall(n->kid[i], CallStN) && n->kid[i + 1] != NULL
+					&& n->kid[i + 1]->kind == RetN && n->kid[i + 1]->nKid == 0)
+				n->kid[i] = tailNode(n->kid[i]);
+	for (i = 0; i < n->nKid; i++)
+		retCalls(&n->kid[i]);
+}
+
+/* ブロックbとその内部のブロックの末尾呼び出しを置き換える */
+static void tailBlock(Node *b)
+{
+	int i;
+	for (i = 0; i < b->nKid; i++)
+		tailBlock(b->kid[i]);
+	if (b->u.blk->level == 0)
+		return;                     /* 主ブロックは呼ばれない */
+	blk = b;
+	retCalls(&b->u.blk->body);
+	if (b->u.blk->isProc)
+		tailPos(&b->u.blk->body);
+}
+
+/* 自分自身の末尾呼び出しを飛び越しにする */
+void tailCalls(Node *prog)
+{
+	double t = statsMode ? statsClock() : 0;
+	tailBlock(prog);
+	if (statsMode)
+		stats.time[optPh] += statsClock() - t;
+}
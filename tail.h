@@ -0,0 +1,9 @@
+/********** tail.h **********/
+#ifndef TAIL_H_
+#define TAIL_H_
+
+#include "ast.h"
+
+void tailCalls(Node *prog);    /* 自分自身の末尾呼び出しを飛び越しにする */
+
+#endif
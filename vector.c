@@ -0,0 +1,230 @@
+/********** vector.c **********/
+/*
+ * 要素ごとの配列のループのベクトル化(-O)
+ *
+ * for i := a; i < e; i := i + 1 do c[i] := a[i] + b[i]*k のように、本体が配列の
+ * 要素への代入の並びで、配列の添字がすべて i+c (cは定数)の形のfor文をVecNにする.
+ * VecNは残りの要素から最大VECLEN個(codegen.c)をまとめて、ベクトル命令(vlp, vlen,
+ * vld, vst, vbc, vop)で計算する. 仮想機械はそれを実行時スタックの連続した要素の上の
+ * 固定長の繰り返し(Cコンパイラがその機械のSIMD命令にする)で実行する.
+ *   - 条件は i < e, i <= e (e > i, e >= iでもよい)で、eはループで不変な式
+ *   - 代入する式は配列の要素、ループで不変な式とその+, -, *, 符号反転だけからなる.
+ *     不変な式はまとめた要素ごとに一度計算してすべての要素に広げる
+ *   - ループで不変な式は、呼び出しとiを含まず、ループの中で代入される配列を読まず、
+ *     定数でない数で割らない式
+ *   - 依存: ループの中で代入される配列は、どの文でも同じ添字 i+c で参照されること.
+ *     各繰り返しは自分の要素だけを読み書きするので、まとめて計算しても値は変わらない
+ *   - iは添字の中でしか使わない. ベクトルレジスタはVECDEPTH個まで
+ * 条件に合わないループは、もとのスカラーのループのままにする.
+ */
+#include <stdio.h>
+#include <limits.h>
+#include "ast.h"
+#include "vector.h"
+#include "stats.h"
+
+#define MAXVSTMT 16         /* ベクトル化するループの本体の文の数の上限 */
+
+static RelAddr iv;          /* ループ変数 */
+static Node *stmt[MAXVSTMT];    /* 本体の配列の要素への代入 */
+static int nStmt;
+
+/* 節点xが変数aの参照か */
+static int isVar(Node *x, RelAddr a)
+{
+	return x != NULL && x->kind == VarN && x->u.addr.level == a.level && x->u.addr.addr == a.addr;
+}
+
+/* 添字xが i, i+c, c+i, i-c の形ならcを*offに入れて1を返す */
+static int offsetOf(Node *x, int *off)
+{
+	if (isVar(x, iv)) {
+		*off = 0;
+		return 1;
+	}
+	if (x == NULL || x->kind != BinN)
+		return 0;
+	if (isVar(x->kid[0], iv) && x->kid[1]->kind == NumN && (x->u.optr == add
+			|| (x->u.optr == sub && x->kid[1]->u.value != INT_MIN))) {
+		*off = x->u.optr == add ? x->kid[1]->u.value : -x->kid[1]->u.value;
+		return 1;
+	}
+	if (isVar(x->kid[1], iv) && x->kid[0]->kind == NumN && x->u.optr == add) {
+		*off = x->kid[0]->u.value;
+		return 1;
+	}
+	return 0;
+}
+
+/* 配列aがループの中で代入されるか */
+static int written(RelAddr a)
+{
+	int k;
+	for (k = 0; k < nStmt; k++)
+		if (stmt[k]->u.addr.level == a.level && stmt[k]->u.addr.addr == a.addr)
+			return 1;
+	return 0;
+}
+
+/* ループの中の配列aへの代入がどれも添字 i+off か */
+static int sameOffset(RelAddr a, int off)
+{
+	int k, c;
+	for (k = 0; k < nStmt; k++)
+		if (stmt[k]->u.addr.level == a.level && stmt[k]->u.addr.addr == a.addr
+				&& (!offsetOf(stmt[k]->kid[0], &c) || c != off))
+			return 0;
+	return 1;
+}
+
+/* 式nがループで不変か(呼び出し、i、代入される配列、定数でない数での割り算を含まない) */
+static int invariant(Node *n)
+{
+	switch (n->kind) {
+	case NumN:
+		return 1;
+	case VarN:
+		return !isVar(n, iv);
+	case ArrN:
+		return !written(n->u.addr) && invariant(n->kid[0]);
+	case UnN:
+		return invariant(n->kid[0]);
+	case BinN:
+		if (n->u.optr == div && (n->kid[1]->kind != NumN || n->kid[1]->u.value == 0))
+			return 0;
+		return invariant(n->kid[0]) && invariant(n->kid[1]);
+	default:
+		return 0;
+	}
+}
+
+/* 代入する式nに必要なベクトルレジスタの数(ベクトル化できなければ0) */
+static int vecDepth(Node *n)
+{
+	int d0, d1;
+	if (invariant(n))
+		return 1;
+	switch (n->kind) {
+	case ArrN:
+		return offsetOf(n->kid[0], &d0) && sameOffset(n->u.addr, d0);    /* 代入される配列は同じ添字でだけ読む */
+	case UnN:
+		return n->u.optr == neg ? vecDepth(n->kid[0]) : 0;
+	case BinN:
+		if (n->u.optr != add && n->u.optr != sub && n->u.optr != mul)
+			return 0;
+		d0 = vecDepth(n->kid[0]);
+		d1 = vecDepth(n->kid[1]);
+		if (d0 == 0 || d1 == 0)
+			return 0;
+		return d0 > d1 + 1 ? d0 : d1 + 1;
+	default:
+		return 0;
+	}
+}
+
+/* 本体の文sの配列の要素への代入を集める(それ以外の文があれば0を返す) */
+static int collectStmts(Node *s)
+{
+	int k;
+	if (s == NULL)
+		return 1;
+	if (s->kind == BeginN) {
+		for (k = 0; k < s->nKid; k++)
+			if (!collectStmts(s->kid[k]))
+				return 0;
+		return 1;
+	}
+	if (s->kind != AssignArrN || nStmt == MAXVSTMT)
+		return 0;
+	stmt[nStmt++] = s;
+	return 1;
+}
+
+/* for文*npがベクトル化できればBeginN[初期化, VecN]に置き換える */
+static void vectorize(Node **np)
+{
+	Node *n = *np, *inc = n->kid[2], *cnd = n->kid[1], *e, *v, *one;
+	Operator rel;
+	int k, d, off, mark;
+
+	if (inc == NULL || inc->kind != AssignN || inc->kid[0] == NULL || inc->kid[0]->kind != BinN
+			|| inc->kid[0]->u.optr != add)
+		return;
+	iv = inc->u.addr;                          /* i := i + 1, i := 1 + i */
+	e = inc->kid[0];
+	if (!(isVar(e->kid[0], iv) && e->kid[1]->kind == NumN && e->kid[1]->u.value == 1)
+			&& !(isVar(e->kid[1], iv) && e->kid[0]->kind == NumN && e->kid[0]->u.value == 1))
+		return;
+	if (cnd == NULL || cnd->kind != BinN)
+		return;
+	rel = cnd->u.optr;
+	if (isVar(cnd->kid[0], iv) && (rel == ls || rel == lseq))
+		e = cnd->kid[1];
+	else if (isVar(cnd->kid[1], iv) && (rel == gr || rel == greq)) {
+		e = cnd->kid[0];                       /* e > i は i < e にする */
+		rel = rel == gr ? ls : lseq;
+	} else
+		return;
+	nStmt = 0;
+	if (!collectStmts(n->kid[3]) || nStmt == 0)
+		return;
+	if (!invariant(e))
+		return;
+	for (k = 0; k < nStmt; k++) {
+		if (!offsetOf(stmt[k]->kid[0], &off) || !sameOffset(stmt[k]->u.addr, off))
+			return;
+		d = vecDepth(stmt[k]->kid[1]);
+		if (d == 0 || d > VECDEPTH)
+			return;
+	}
+	if (rel == lseq) {                         /* 終りの値は含まない */
+		one = newNode(NumN, 0);
+		one->u.value = 1;
+		e = newNode2(BinN, e, one);
+		e->u.optr = add;
+		e->line = n->line;
+	}
+	mark = kidMark();
+	pushKid(e);
+	v = newNode1(AssignN, NULL);               /* 外側のループの最適化にiが変わることを示す */
+	v->u.addr = iv;
+	v->line = n->line;
+	pushKid(v);
+	for (k = 0; k < nStmt; k++)
+		pushKid(stmt[k]);
+	v = endKids(newNode(VecN, 0), mark);
+	v->line = n->line;
+	*np = newNode2(BeginN, n->kid[0], v);
+	(*np)->line = n->line;
+}
+
+/* 文*npの中のfor文をベクトル化する */
+static void vecStmt(Node **np)
+{
+	Node *n = *np;
+	int i;
+	if (n == NULL || n->kind < AssignN || n->kind == BlockN)
+		return;                             /* 式にはループはない */
+	for (i = 0; i < n->nKid; i++)
+		vecStmt(&n->kid[i]);
+	if (n->kind == ForN)
+		vectorize(np);
+}
+
+/* ブロックbとその内部のブロックのループのベクトル化 */
+static void vecBlock(Node *b)
+{
+	int i;
+	for (i = 0; i < b->nKid; i++)
+		vecBlock(b->kid[i]);
+	vecStmt(&b->u.blk->body);
+}
+
+/* 要素ごとの配列のループをベクトル命令にする */
+void vectorizeLoops(Node *prog)
+{
+	double t = statsMode ? statsClock() : 0;
+	vecBlock(prog);
+	if (statsMode)
+		stats.time[optPh] += statsClock() - t;
+}
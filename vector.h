@@ -0,0 +1,9 @@
+/********** vector.h **********/
+#ifndef VECTOR_H_
+#define VECTOR_H_
+
+#include "ast.h"
+
+void vectorizeLoops(Node *prog);    /* 要素ごとの配列のループをベクトル命令にする */
+
+#endif